@@ -22,10 +22,31 @@ References:
 #include <bitset>
 #include <limits>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <iomanip>
+#include <cstdlib>
 #include "RLE_Algorithms.hpp"
 #include "LZ_Algorithms.hpp"
 #include "ImageQuantize.hpp"
 #include "Huff_Algo.hpp"
+#include "TiledImage.hpp"
+#include "PNG_Functions.hpp"
+#include "Deflate_Algo.hpp"
+#include "Codec_Pipeline.hpp"
+#include "Container.hpp"
+#include "AutoCodec.hpp"
+#include "ParallelLZ.hpp"
+#include "AsyncIO.hpp"
+#include "BatchCompress.hpp"
+#include "DedupArchive.hpp"
+#include "FMIndex.hpp"
+#include "MappedFile.hpp"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 //Transformations
 #include "BWTransform.hpp"
 //Encryptions
@@ -36,7 +57,7 @@ References:
 namespace globals {
 
 //Allowed file types for certain compression and decompression
-    std::set<std::string> allowedFileTypes {"png", "bmp", "txt"};
+    std::set<std::string> allowedFileTypes {"png", "bmp", "txt", "arb"};
 }
 
 /*Helper function; c++11 constant expression to aid switch string statements*/
@@ -52,7 +73,35 @@ void printCompressionInstructions() {
         "To compress and decompress the file, type either of the following, respectively: " << std::endl <<
         "    LZCompress.exe -c AlgX inputFileName" << std::endl <<
         "    LZCompress.exe -d AlgX compressedFileName" << std::endl <<
-        "    'AlgX' is the algorithm to be used, currently 'LZ' or 'RLE'" << std::endl <<
+        "    'AlgX' is the algorithm to be used, currently 'LZ', 'PLZ', 'RLE', 'TILE' or 'DEFLATE'" << std::endl <<
+        "    Some algorithms take a parameter after a colon, e.g. 'DEFLATE:9' for the level (0-9)" << std::endl <<
+        "    or 'PLZ:4M' for the size of the chunks compressed in parallel" << std::endl <<
+        "    Stages can also be chained, e.g. 'BWT,MTF,RLE,HUFF' (stages: BWT, MTF, RLE, LZ, HUFF, DEFLATE, LRM, DELTA)," << std::endl <<
+        "    or 'AUTO' picks a chain (or raw storage) for every block from its statistics," << std::endl <<
+        "    with an optional block size: 'BWT,MTF,RLE,HUFF:256K'. Chains write a .arb container," << std::endl <<
+        "    which decodes without naming the algorithm and can return just a byte range:" << std::endl <<
+        "    LZCompress.exe -d compressedFileName.arb" << std::endl <<
+        "    LZCompress.exe -range start,length compressedFileName.arb" << std::endl <<
+        "    LZCompress.exe -append compressedFileName.arb grownFileName (or '-' for standard input)" << std::endl <<
+        "    Add --staged to run each stage of a chain on its own thread instead of splitting blocks" << std::endl <<
+        "Use '-' as the file to compress standard input into a .arb on standard output, or to decode one:" << std::endl <<
+        "    tail -f log | LZCompress.exe -c LZ - > log.arb" << std::endl <<
+        "    LZCompress.exe -d - < log.arb > log" << std::endl <<
+        "To build an LZ dictionary from sample files or directories, for many small similar inputs:" << std::endl <<
+        "    LZCompress.exe -train dictionaryFile path1 path2 ..." << std::endl <<
+        "    and add --dict=dictionaryFile when compressing with LZ and when decompressing;" << std::endl <<
+        "    LZ alone then writes a 12-byte frame around the codes instead of a .arb" << std::endl <<
+        "To index a text file for searching, then count and show matches without decoding it:" << std::endl <<
+        "    LZCompress.exe -index fileName" << std::endl <<
+        "    LZCompress.exe -search pattern fileName.fmi" << std::endl <<
+        "To compress many files or whole directories with a chain, each into its own .arb:" << std::endl <<
+        "    LZCompress.exe -batch AlgX path1 path2 ..." << std::endl <<
+        "To put many files in one .arb, storing content repeated between them once, and to unpack it:" << std::endl <<
+        "    LZCompress.exe -archive AlgX archive.arb path1 path2 ..." << std::endl <<
+        "    LZCompress.exe -extract archive.arb [outputDirectory]" << std::endl <<
+        "Add --stats anywhere to print time and bytes per stage, or --stats=file.json to also save them" << std::endl <<
+        "To decompress only a region of a TILE compressed image, add it as x,y,width,height:" << std::endl <<
+        "    LZCompress.exe -d TILE compressedFileName 0,0,64,64" << std::endl <<
         "This program currently allows for .png and .bmp input files." << std::endl << std::endl;
 }
 
@@ -63,21 +112,784 @@ void printStringToFile(std::string stringToPrint, std::ostream &os) {
     os << stringToPrint;
 }
 
+/*
+* Stage Stats Report
+* When enabled, prints the per-stage counters as main returns and writes
+* them to the JSON file, if one was named
+*/
+struct StageStatsReport {
+    bool enabled = false;
+    std::string jsonFile;
+    std::ostream *out = &std::cout; //Standard error when standard output carries the data
+
+    ~StageStatsReport() {
+        if (!enabled) {
+            return;
+        }
+        printStageStats(*out);
+        if (!jsonFile.empty()) {
+            std::ofstream json(jsonFile);
+            writeStageStatsJson(json);
+            if (!json) {
+                *out << "Could not write stage stats to " << jsonFile << std::endl;
+            }
+        }
+    }
+};
+
+/*
+* Pipeline File Tag
+* Chain name usable in a file name, e.g. BWT,MTF,RLE -> BWT-MTF-RLE; what
+* follows a '#' in a stage (LZ#<dictionary id>, DEFLATE#9) is left out
+*/
+std::string pipelineFileTag(const std::string &chain) {
+    std::string tag;
+    for (auto &name : chainStageNames(chain)) {
+        tag += (tag.empty() ? "" : "-") + name.substr(0, name.find('#'));
+    }
+    return tag;
+}
+
+/*
+* Run Container Compress
+* Streams the input through a chain of codec stages from the registry into a
+* container. The parameter, if any, is the block size (e.g. BWT,MTF,RLE,HUFF:256K).
+* Blocks are encoded in parallel, or with 'staged' each stage gets its own thread.
+*/
+int runContainerCompress(const std::string &chain, const std::string &param, const std::string &inputName,
+        const std::string &extension, const std::string &outputName, bool staged = false) {
+    try {
+        ContainerHeader header;
+        header.chain = chain;
+        size_t blockSize = param.empty() ? defaultBlockSize : parseByteSize(param);
+        if (blockSize == 0 || blockSize > 0xFFFFFFFFu) {
+            printCompressionInstructions();
+            return EXIT_FAILURE;
+        }
+        header.blockSize = uint32_t(blockSize);
+        header.extension = extension;
+
+        //Disk reads and writes overlap the encoding on their own threads
+        ReadAheadStream inputFile(inputName);
+        header.originalSize = inputFile.fileSize();
+
+        WriteBehindStream outputFile(outputName);
+        if (staged) {
+            containerCompressStaged(inputFile, outputFile, header);
+        } else {
+            ThreadPool pool;
+            containerCompress(inputFile, outputFile, header, pool);
+        }
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("could not write " + outputName);
+        }
+    }
+    catch(std::invalid_argument const &error) {
+        std::cout << error.what() << std::endl;
+        printCompressionInstructions();
+        return EXIT_FAILURE;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Compression failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* With LZ Dictionary
+* The algorithm argument with its LZ stages replaced by the dictionary's
+* stage, e.g. LZ,HUFF:64K -> LZ#1a2b3c4d,HUFF:64K
+*/
+std::string withLZDictionary(const std::string &algorithm, const std::string &dictionaryStage) {
+    size_t paramIndex = algorithm.find(':');
+    std::string chain = algorithm.substr(0, paramIndex);
+    std::string result;
+    for (auto &name : chainStageNames(chain)) {
+        result += (result.empty() ? "" : ",") + (name == "LZ" ? dictionaryStage : name);
+    }
+    return paramIndex == std::string::npos ? result : result + algorithm.substr(paramIndex);
+}
+
+/*
+* Run Preset LZ Compress
+* Compresses a file with LZ preloaded with the dictionary into a preset frame,
+* <name>_LZcompressed.<extension>, which costs 12 bytes where a container
+* costs about 90
+*/
+int runPresetLZCompress(const std::string &inputName, const LZDictionary &preset) {
+    size_t dot = inputName.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : inputName.substr(dot);
+    std::string outputName = inputName.substr(0, dot) + "_LZcompressed" + extension;
+    try {
+        MappedFile input(inputName);
+        std::ofstream outputFile(outputName, std::ios::binary);
+        lzPresetCompress(input.data(), input.size(), outputFile, preset);
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("could not write " + outputName);
+        }
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Compression failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Preset LZ Decompress
+* Decodes a preset frame into <name>_LZdecompressed.<extension>, with the
+* dictionary loaded by --dict, which has to be the one the frame names
+*/
+int runPresetLZDecompress(const std::string &inputName, const LZDictionary *preset) {
+    size_t dot = inputName.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : inputName.substr(dot);
+    std::string outputName = inputName.substr(0, dot) + "_LZdecompressed" + extension;
+    try {
+        MappedFile input(inputName);
+        uint32_t id = lzPresetId(input.data(), input.size());
+        if (preset == nullptr || preset->id != id) {
+            std::stringstream message;
+            message << "needs LZ dictionary " << std::hex << std::setw(8) << std::setfill('0') << id <<
+                ", load it with --dict=file";
+            throw std::runtime_error(message.str());
+        }
+        std::vector<unsigned char> decoded;
+        lzPresetDecompress(input.data(), input.size(), decoded, *preset);
+        std::ofstream outputFile(outputName, std::ios::binary);
+        outputFile.write(reinterpret_cast<const char *>(decoded.data()), std::streamsize(decoded.size()));
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("could not write " + outputName);
+        }
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Decompression failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Train Dictionary
+* Builds an LZ dictionary from every file named or found below a named
+* directory, and shows what it saves when each sample is compressed alone
+*/
+int runTrainDictionary(const std::string &dictionaryName, const std::vector<std::string> &paths) {
+    try {
+        std::vector<BatchFile> files = listBatchFiles(paths);
+        LZDictionaryTrainer trainer;
+        std::vector<std::unique_ptr<MappedFile>> samples;
+        uint64_t sampleBytes = 0;
+        for (auto &file : files) {
+            if (!file.error.empty()) {
+                std::cout << file.name << ": " << file.error << std::endl;
+                continue;
+            }
+            samples.emplace_back(new MappedFile(file.name));
+            trainer.addSample(samples.back()->data(), samples.back()->size());
+            sampleBytes += samples.back()->size();
+        }
+        LZDictionary dictionary = trainer.build();
+
+        std::ofstream dictionaryFile(dictionaryName, std::ios::binary);
+        writeLZDictionary(dictionary, dictionaryFile);
+        dictionaryFile.close();
+        if (!dictionaryFile) {
+            throw std::runtime_error("could not write " + dictionaryName);
+        }
+
+        uint64_t plain = 0, preset = 0;
+        std::vector<unsigned char> codes;
+        for (auto &sample : samples) {
+            codes.clear();
+            lzCompressBlock(sample->data(), sample->size(), codes);
+            plain += codes.size();
+            codes.clear();
+            lzCompressBlock(sample->data(), sample->size(), codes, SIZE_MAX, &dictionary);
+            preset += codes.size();
+        }
+        std::cout << "Trained " << dictionary.size() << " entries from " << samples.size() << " files (" <<
+            sampleBytes << " bytes), dictionary " << std::hex << std::setw(8) << std::setfill('0') <<
+            dictionary.id << std::dec << std::setfill(' ') << std::endl << "LZ on each sample alone: " <<
+            plain << " bytes, with the dictionary: " << preset << " bytes" << std::endl;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Training failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Stream Compress
+* Compresses standard input into a container on standard output, a batch of
+* blocks at a time, so memory stays bounded however long the input runs. The
+* length is not known up front, so the header records it as unknown.
+* Messages go to standard error.
+*/
+int runStreamCompress(const std::string &chain, const std::string &param, bool staged) {
+    try {
+        ContainerHeader header;
+        header.chain = chain;
+        size_t blockSize = param.empty() ? defaultBlockSize : parseByteSize(param);
+        if (blockSize == 0 || blockSize > 0xFFFFFFFFu) {
+            throw std::invalid_argument("invalid block size " + param);
+        }
+        header.blockSize = uint32_t(blockSize);
+        header.originalSize = containerUnknownSize;
+        if (staged) {
+            containerCompressStaged(std::cin, std::cout, header);
+        } else {
+            ThreadPool pool;
+            containerCompress(std::cin, std::cout, header, pool);
+        }
+        if (!std::cout.flush()) {
+            throw std::runtime_error("could not write to standard output");
+        }
+        if (std::cin.bad()) {
+            throw std::runtime_error("could not read standard input");
+        }
+    }
+    catch(std::invalid_argument const &error) {
+        std::cerr << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch(std::runtime_error const &error) {
+        std::cerr << "Compression failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Stream Decode
+* Decodes a container from standard input to standard output, reading it
+* strictly forward
+*/
+int runStreamDecode() {
+    try {
+        ThreadPool pool;
+        ContainerCodecs codecs;
+        containerDecompressStream(std::cin, std::cout, pool, codecs);
+        if (!std::cout.flush()) {
+            throw std::runtime_error("could not write to standard output");
+        }
+    }
+    catch(std::exception const &error) {
+        std::cerr << "Decompression failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Batch Compress
+* Compresses every file named, or found below a named directory, into its own
+* container next to it, all on one thread pool, then reports every file and
+* the totals. The algorithm and its parameter run as containerChain maps them.
+* Never prompts, so it can run unattended.
+*/
+int runBatchCompress(const std::string &algorithm, const std::string &param, const std::vector<std::string> &paths) {
+    std::vector<BatchFile> files;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        std::string chain, blockParam;
+        containerChain(algorithm, param, chain, blockParam);
+        ContainerHeader header;
+        header.chain = chain;
+        size_t blockSize = blockParam.empty() ? defaultBlockSize : parseByteSize(blockParam);
+        if (blockSize == 0 || blockSize > 0xFFFFFFFFu) {
+            printCompressionInstructions();
+            return EXIT_FAILURE;
+        }
+        header.blockSize = uint32_t(blockSize);
+        //Rejects an unknown stage before any file is touched
+        CodecPipeline check(chain);
+
+        files = listBatchFiles(paths);
+        //Files differing only in extension (image.bmp, image.png) keep it in the name, so no two share an output
+        std::string suffix = "_" + pipelineFileTag(algorithm) + "compr.arb";
+        std::set<std::string> outputNames;
+        for (auto &file : files) {
+            std::string stem, extension;
+            splitBatchName(file.name, stem, extension);
+            file.outputName = stem + suffix;
+            if (!outputNames.insert(file.outputName).second) {
+                file.outputName = stem + "_" + extension + suffix;
+                outputNames.insert(file.outputName);
+            }
+        }
+        ThreadPool pool;
+        batchCompress(files, header, pool);
+    }
+    catch(std::invalid_argument const &error) {
+        std::cout << error.what() << std::endl;
+        printCompressionInstructions();
+        return EXIT_FAILURE;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printBatchReport(files, seconds, std::cout);
+    for (auto &file : files) {
+        if (!file.error.empty() && !file.skipped) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Dedup Archive
+* Writes every file named, or found below a named directory, into one
+* container, with chunks repeated across the files stored once, and reports
+* how much was shared. The algorithm and its parameter run as containerChain
+* maps them.
+*/
+int runDedupArchive(const std::string &algorithm, const std::string &param, const std::string &archiveName,
+        const std::vector<std::string> &paths) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BatchFile> files;
+    DedupTotals totals;
+    uint64_t archiveSize = 0;
+    try {
+        std::string chain, blockParam;
+        containerChain(algorithm, param, chain, blockParam);
+        ContainerHeader header;
+        header.chain = chain;
+        size_t blockSize = blockParam.empty() ? defaultBlockSize : parseByteSize(blockParam);
+        if (blockSize == 0 || blockSize > 0xFFFFFFFFu) {
+            printCompressionInstructions();
+            return EXIT_FAILURE;
+        }
+        header.blockSize = uint32_t(blockSize);
+        CodecPipeline check(chain);
+
+        files = listBatchFiles(paths);
+        //An archive written inside one of the directories is not read back into itself
+        files.erase(std::remove_if(files.begin(), files.end(), [&](const BatchFile &file) {
+            return file.name == archiveName;
+        }), files.end());
+        WriteBehindStream outputFile(archiveName);
+        if (!outputFile.is_open()) {
+            throw std::runtime_error("could not create " + archiveName);
+        }
+        ThreadPool pool;
+        totals = dedupArchiveCompress(files, outputFile, header, pool);
+        archiveSize = uint64_t(outputFile.tellp());
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("could not write " + archiveName);
+        }
+    }
+    catch(std::invalid_argument const &error) {
+        std::cout << error.what() << std::endl;
+        printCompressionInstructions();
+        return EXIT_FAILURE;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Archiving failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t archived = 0;
+    for (auto &file : files) {
+        if (file.error.empty()) {
+            archived++;
+        } else {
+            std::cout << file.name << "  failed: " << file.error << std::endl;
+        }
+    }
+    uint64_t repeatedBytes = totals.inputBytes - totals.uniqueBytes;
+    std::cout << archived << " files, " << totals.inputBytes << " bytes in " << totals.chunks << " chunks" << std::endl;
+    std::cout << "unique:   " << totals.uniqueBytes << " bytes in " << (totals.chunks - totals.repeatedChunks) <<
+        " chunks" << std::endl;
+    std::cout << "repeated: " << repeatedBytes << " bytes in " << totals.repeatedChunks << " chunks" << std::fixed <<
+        std::setprecision(1) << " (" << (totals.inputBytes ? 100.0 * repeatedBytes / totals.inputBytes : 0) << "%)" <<
+        std::endl;
+    std::cout << archiveName << ": " << archiveSize << " bytes (" <<
+        (totals.inputBytes ? 100.0 * archiveSize / totals.inputBytes : 0) << "%) in " << std::setprecision(3) <<
+        seconds << " s" << std::endl;
+    return archived == files.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+* Run Dedup Extract
+* Recreates every file of an archive below the output directory
+*/
+int runDedupExtract(const std::string &archiveName, const std::string &outputDirectory) {
+    try {
+        std::ifstream inputFile(archiveName, std::ios_base::binary);
+        if (!inputFile.is_open()) {
+            std::cout << "Could not open the specified file." << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::vector<std::string> written = dedupArchiveExtract(inputFile, outputDirectory);
+        std::cout << written.size() << " files extracted to " << outputDirectory << std::endl;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Extraction failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Container Append
+* Adds the part of the source past what the container already holds (or all
+* of standard input for '-') as new blocks, so a growing log costs only its
+* new bytes each time
+*/
+int runContainerAppend(const std::string &containerName, const std::string &sourceName) {
+    try {
+        std::fstream container(containerName, std::ios::in | std::ios::out | std::ios::binary);
+        if (!container.is_open()) {
+            std::cout << "Could not open the specified file." << std::endl;
+            return EXIT_FAILURE;
+        }
+        ContainerHeader header = readContainer(container);
+        //A dedup archive's manifest has to stay at the end of its data
+        if (header.extension == "dedup") {
+            throw std::runtime_error(containerName + " is an archive; rebuild it with -archive instead");
+        }
+
+        std::ifstream sourceFile;
+        std::istream *source = &std::cin;
+        if (sourceName != "-") {
+            sourceFile.open(sourceName, std::ios::binary);
+            if (!sourceFile.is_open()) {
+                std::cout << "Could not open the specified file." << std::endl;
+                return EXIT_FAILURE;
+            }
+            sourceFile.seekg(0, std::ios::end);
+            uint64_t sourceSize = uint64_t(sourceFile.tellg());
+            if (sourceSize < header.rawSize()) {
+                throw std::runtime_error(sourceName + " is shorter than the data in " + containerName +
+                    "; it may have been rotated, so compress it anew");
+            }
+            sourceFile.seekg(std::streamoff(header.rawSize()));
+            source = &sourceFile;
+        }
+#ifdef _WIN32
+        else {
+            _setmode(_fileno(stdin), _O_BINARY);
+        }
+#endif
+
+        auto start = std::chrono::steady_clock::now();
+        ThreadPool pool;
+        ContainerCodecs codecs;
+        uint64_t appended = containerAppend(container, *source, pool, codecs);
+        container.seekg(0, std::ios::end);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Appended " << appended << " bytes; " << containerName << " now holds " <<
+            header.rawSize() + appended << " bytes in " << uint64_t(container.tellg()) << " (" << std::fixed <<
+            std::setprecision(3) << seconds << " s)" << std::endl;
+    }
+    catch(std::invalid_argument const &error) {
+        std::cout << error.what() << std::endl;
+        printCompressionInstructions();
+        return EXIT_FAILURE;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Append failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Build Index
+* Writes <file>.fmi, an FM index that can be searched without decoding the file
+*/
+int runBuildIndex(const std::string &fileName) {
+    try {
+        auto start = std::chrono::steady_clock::now();
+        MappedFile input(fileName);
+        FMIndex index;
+        index.build(input.data(), input.size());
+        std::string indexName = fileName + ".fmi";
+        std::ofstream outputFile(indexName, std::ios::binary);
+        if (!outputFile.is_open()) {
+            throw std::runtime_error("could not create " + indexName);
+        }
+        index.write(outputFile);
+        uint64_t indexSize = uint64_t(outputFile.tellp());
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("could not write " + indexName);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << indexName << ": " << input.size() << " -> " << indexSize << " bytes in " << std::fixed <<
+            std::setprecision(3) << seconds << " s" << std::endl;
+    }
+    catch(std::invalid_argument const &error) {
+        std::cout << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Indexing failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Search
+* Counts the pattern in an FM index and prints the line around each of the
+* first matches, decoding only those lines
+*/
+int runSearch(const std::string &pattern, const std::string &indexName, size_t shown = 20) {
+    try {
+        auto start = std::chrono::steady_clock::now();
+        std::ifstream inputFile(indexName, std::ios::binary);
+        if (!inputFile.is_open()) {
+            std::cout << "Could not open the specified file." << std::endl;
+            return EXIT_FAILURE;
+        }
+        FMIndex index;
+        index.read(inputFile);
+        auto loaded = std::chrono::steady_clock::now();
+
+        uint64_t matches = index.count(pattern);
+        std::vector<uint64_t> positions = index.locate(pattern, shown);
+        //A match's line, up to 80 bytes either side
+        const uint64_t context = 80;
+        for (uint64_t position : positions) {
+            uint64_t from = position < context ? 0 : position - context;
+            std::string around = index.extract(from, position - from + pattern.size() + context);
+            size_t matchStart = size_t(position - from);
+            size_t lineStart = matchStart == 0 ? std::string::npos : around.rfind('\n', matchStart - 1);
+            lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+            size_t lineEnd = around.find('\n', matchStart + pattern.size());
+            std::cout << position << ": " << around.substr(lineStart, lineEnd == std::string::npos ?
+                std::string::npos : lineEnd - lineStart) << std::endl;
+        }
+        auto searched = std::chrono::steady_clock::now();
+        std::cout << matches << " matches" << (matches > positions.size() ? ", " +
+            std::to_string(positions.size()) + " shown" : "") << std::fixed << std::setprecision(2) << " (load " <<
+            std::chrono::duration<double>(loaded - start).count() * 1e3 << " ms, search " <<
+            std::chrono::duration<double>(searched - loaded).count() * 1e3 << " ms)" << std::endl;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Search failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+* Run Container Decode
+* Decodes a container, or only bytes [start, start + length) of it, into
+* <name>_decompressed.<original extension> or <name>_range.<original extension>,
+* without the dot when there is no extension (e.g. a container made from a stream)
+*/
+int runContainerDecode(const std::string &inputName, bool wholeFile = true,
+        uint64_t start = 0, uint64_t length = 0) {
+    try {
+        ReadAheadStream inputFile(inputName);
+        if (!inputFile.is_open()) {
+            std::cout << "Could not open the specified file." << std::endl;
+            return EXIT_FAILURE;
+        }
+        ContainerHeader header = readContainer(inputFile);
+
+        std::string exactFileName = inputName.substr(0, inputName.find_last_of("."));
+        std::string outputName = exactFileName + (wholeFile ? "_decompressed" : "_range") +
+            (header.extension.empty() ? "" : "." + header.extension);
+        WriteBehindStream outputFile(outputName);
+
+        ThreadPool pool;
+        if (wholeFile) {
+            containerDecompress(inputFile, outputFile, header, pool);
+        } else {
+            containerDecodeRange(inputFile, outputFile, header, start, length, pool);
+        }
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("could not write " + outputName);
+        }
+    }
+    catch(std::invalid_argument const &error) {
+        std::cout << error.what() << std::endl;
+        printCompressionInstructions();
+        return EXIT_FAILURE;
+    }
+    catch(std::runtime_error const &error) {
+        std::cout << "Decompression failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
 /* 
 *  Main function of the program.
 *  Char* arg value takes in an arbitrary input.
 */
 int main (int argc, char* argv[]) {
     //argv[0]: executable, argv[1]: -c/-d option, argv[2]: algorithm choice, argv[3]: file input
+    //argv[4]: optional region for TILE decompression
+
+    //Takes --stats[=file.json], --staged and --dict=file out of the arguments wherever they appear
+    StageStatsReport statsReport;
+    bool staged = false;
+    std::string dictionaryFile;
+    std::vector<char *> args;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i > 0 && (arg == "--stats" || arg.compare(0, 8, "--stats=") == 0)) {
+            statsReport.enabled = true;
+            statsReport.jsonFile = arg.size() > 8 ? arg.substr(8) : "";
+        } else if (i > 0 && arg == "--staged") {
+            staged = true;
+        } else if (i > 0 && arg.compare(0, 7, "--dict=") == 0) {
+            dictionaryFile = arg.substr(7);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    stageStatsEnabled() = statsReport.enabled;
+    args.push_back(nullptr);
+    argc = int(args.size()) - 1;
+    argv = args.data();
+
+    //A dictionary is registered before anything runs, so containers naming it decode
+    std::string dictionaryChain;
+    std::shared_ptr<const LZDictionary> presetDictionary;
+    if (!dictionaryFile.empty()) {
+        std::string dictionaryStage;
+        try {
+            presetDictionary = readLZDictionaryFile(dictionaryFile);
+            dictionaryStage = registerLZDictionary(presetDictionary);
+        }
+        catch(std::runtime_error const &error) {
+            std::cerr << "Could not load the dictionary: " << error.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        //LZ alone on a file writes a preset frame, small enough for single records,
+        if (argc == 4 && std::string("-c") == argv[1] && std::string("LZ") == argv[2] &&
+            std::string("-") != argv[3]) {
+            return runPresetLZCompress(argv[3], *presetDictionary);
+        }
+        //and the LZ stages of a chain being compressed use it
+        if (argc >= 3 && (std::string("-c") == argv[1] || std::string("-batch") == argv[1] ||
+            std::string("-archive") == argv[1])) {
+            dictionaryChain = withLZDictionary(argv[2], dictionaryStage);
+            argv[2] = &dictionaryChain[0];
+        }
+    }
+
+    //A preset frame decodes with the dictionary it names, whatever the algorithm
+    if ((argc == 3 || argc == 4) && std::string("-d") == argv[1] && std::string("-") != argv[argc - 1] &&
+        isLZPresetFile(argv[argc - 1])) {
+        return runPresetLZDecompress(argv[argc - 1], presetDictionary.get());
+    }
+
+    //Builds a dictionary from sample files
+    if (argc >= 4 && std::string("-train") == argv[1]) {
+        return runTrainDictionary(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
+
+    //'-' streams standard input to standard output through the block pipeline, whatever the algorithm
+    bool streaming = (argc == 3 && std::string("-d") == argv[1] && std::string("-") == argv[2]) ||
+        (argc == 4 && std::string("-") == argv[3] && (std::string("-c") == argv[1] || std::string("-d") == argv[1]));
+    if (streaming) {
+        statsReport.out = &std::cerr;
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        if (std::string("-d") == argv[1]) {
+            return runStreamDecode();
+        }
+        std::string algorithm = argv[2], param, chain, blockParam;
+        size_t paramIndex = algorithm.find(':');
+        if (paramIndex != std::string::npos) {
+            param = algorithm.substr(paramIndex + 1);
+            algorithm.resize(paramIndex);
+        }
+        try {
+            containerChain(algorithm, param, chain, blockParam);
+        }
+        catch(std::invalid_argument const &error) {
+            std::cerr << error.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return runStreamCompress(chain, blockParam, staged);
+    }
+
+    //A container names its own codec chain, so it decodes without an algorithm
+    if (argc == 3 && std::string("-d") == argv[1]) {
+        return runContainerDecode(argv[2]);
+    }
+    //Decodes only the blocks of a container covering a byte range
+    if (argc == 4 && std::string("-range") == argv[1]) {
+        unsigned long long start = 0, length = 0;
+        char comma = 0;
+        std::stringstream rangeStream(argv[2]);
+        rangeStream >> start >> comma >> length;
+        if (!rangeStream || comma != ',') {
+            printCompressionInstructions();
+            return EXIT_FAILURE;
+        }
+        return runContainerDecode(argv[3], false, start, length);
+    }
 
-    if (argc != 4) {
+    //Full-text index of a file, and searches in it
+    if (argc == 3 && std::string("-index") == argv[1]) {
+        return runBuildIndex(argv[2]);
+    }
+    if (argc == 4 && std::string("-search") == argv[1]) {
+        //An empty pattern would match at every offset
+        if (argv[2][0] == '\0') {
+            printCompressionInstructions();
+            return EXIT_FAILURE;
+        }
+        return runSearch(argv[2], argv[3]);
+    }
+
+    //New data at the end of a file already compressed into a container
+    if (argc == 4 && std::string("-append") == argv[1]) {
+        return runContainerAppend(argv[2], argv[3]);
+    }
+
+    //Many files or directories at once, each into its own container
+    if (argc >= 4 && std::string("-batch") == argv[1]) {
+        std::string algorithm = argv[2], param;
+        size_t paramIndex = algorithm.find(':');
+        if (paramIndex != std::string::npos) {
+            param = algorithm.substr(paramIndex + 1);
+            algorithm.resize(paramIndex);
+        }
+        return runBatchCompress(algorithm, param, std::vector<std::string>(argv + 3, argv + argc));
+    }
+
+    //Many files into one container, content shared between them stored once
+    if (argc >= 5 && std::string("-archive") == argv[1]) {
+        std::string algorithm = argv[2], param;
+        size_t paramIndex = algorithm.find(':');
+        if (paramIndex != std::string::npos) {
+            param = algorithm.substr(paramIndex + 1);
+            algorithm.resize(paramIndex);
+        }
+        return runDedupArchive(algorithm, param, argv[3], std::vector<std::string>(argv + 4, argv + argc));
+    }
+    if ((argc == 3 || argc == 4) && std::string("-extract") == argv[1]) {
+        std::string archiveName = argv[2];
+        std::string outputDirectory = argc == 4 ? std::string(argv[3]) :
+            archiveName.substr(0, archiveName.find_last_of('.')) + "_extracted";
+        return runDedupExtract(archiveName, outputDirectory);
+    }
+
+    if (argc < 4 || argc > 5) {
         printCompressionInstructions();
         return EXIT_FAILURE;
     }
 
-    /*Gets the input file*/
-    std::ifstream inputFile(argv[3], std::ios_base::binary);
-    if(!inputFile.is_open()){
+    /*Checks the input file; paths that read it as a stream open their own ReadAheadStream, the rest map it*/
+    if(!std::ifstream(argv[3], std::ios_base::binary).is_open()){
         std::cout << "Could not open the specified file.";
         printCompressionInstructions();
         return EXIT_FAILURE;
@@ -89,8 +901,15 @@ int main (int argc, char* argv[]) {
     //Create new file name with extension
     size_t lastIndex = newFileName.find_last_of(".");
     std::string exactFileName = newFileName.substr(0, lastIndex);
-    //Sets a char pointer variable for algorithm choice
-    char* algorithmChoice = argv[2];
+    //Sets a char pointer variable for algorithm choice, split from an optional ":parameter"
+    std::string algorithmName = argv[2];
+    std::string algorithmParam;
+    size_t paramIndex = algorithmName.find(':');
+    if (paramIndex != std::string::npos) {
+        algorithmParam = algorithmName.substr(paramIndex + 1);
+        algorithmName.resize(paramIndex);
+    }
+    const char* algorithmChoice = algorithmName.c_str();
 
     /*Determines the user's intention for the input file*/
     if (globals::allowedFileTypes.find(savedExtension) != globals::allowedFileTypes.end()) { //If file type is allowed      
@@ -107,37 +926,64 @@ int main (int argc, char* argv[]) {
                         char choice = 'y';
                         std::cin >> choice;
                         if(choice == 'n') break; 
-                        //Quanitzes a bmp image before running RLE
-                        quantizeBMP(argv[3]); //Data quanitzed, then passed to RLE
-                        std::string inpp = "./Test Files/QuantizedImage.bmp";
-                        std::string outpp = (exactFileName + "_RLEcompr." + savedExtension);
-                        bmpEncode(inpp, outpp);
+                        //Quanitzes a bmp image in memory, then passes it to RLE
+                        try {
+                            SourceImage image(argv[3]);
+                            PixelBuffer quantized = quantizeImage(image.view());
+                            std::vector<unsigned char> header = bmpHeaderFor(quantized.view());
+                            std::stringstream encoded;
+                            bmpEncodeView(header, quantized.view(), encoded);
+                            WriteBehindStream outputFile(exactFileName + "_RLEcompr." + savedExtension, std::ios_base::binary);
+                            //Images the runs would not shrink are stored as the quantized BMP
+                            if (uint64_t(encoded.tellp()) < bmpReadLE32(header.data() + 2)) {
+                                outputFile << encoded.rdbuf();
+                            } else {
+                                std::stringstream bmp;
+                                writeBMP(bmp, quantized.view());
+                                std::string bmpBytes = bmp.str();
+                                writeStoredFile((const unsigned char*)bmpBytes.data(), bmpBytes.size(), outputFile);
+                            }
+                        }
+                        catch(std::runtime_error const &error) {
+                            std::cout << "Could not quantize the image: " << error.what() << std::endl;
+                            return EXIT_FAILURE;
+                        }
                         break;
                     } else if(savedExtension == "txt") {
                         //Ask user to check file size before doing BWT, to cut down time/memory constraints
-                        char bwtAnswer;                        
+                        char bwtAnswer = 0;
                         while(bwtAnswer != 'y' && bwtAnswer != 'n'){
                             std::cout << "\nDo you want to use BWT on this file?" <<
                             " (Only recommended for smaller < 5Kb text files) [y/n]: ";
-                            std::cin >> bwtAnswer;
+                            //No answer left to read (e.g. input from a closed pipe) ends the prompt
+                            if (!(std::cin >> bwtAnswer)) {
+                                std::cout << std::endl << "No answer given." << std::endl;
+                                return EXIT_FAILURE;
+                            }
                         }
 
                         if(bwtAnswer == 'y') {
                             /* BWTransform RLE */
                             std::cout << "This will now use BW-Transformation before RLE." << std::endl;
 
-                            //Creates string to hold BWT data
-                            std::string BWTString = forwardBWT(inputFile);
-                            
-                            //Creates a string stream for RLE encoding of BWT data
-                            std::stringstream BWTStringStream;
-                            BWTStringStream << BWTString;                            
-                            
+                            //Creates string to hold BWT data, straight from the mapped file
+                            MappedFile input(argv[3]);
+                            std::string BWTString = forwardBWT(input.data(), input.size());
+
+                            //RLE encodes the BWT data straight from memory, giving up once it is no smaller than the text
+                            std::vector<unsigned char> encodedBWT;
+                            bool shrunk = input.size() == 0 || runLengthEncodeBlock((const unsigned char*)BWTString.data(),
+                                BWTString.size(), encodedBWT, input.size() - 1);
+
                             //Creates final output file
                             std::ofstream outputFileBWTRLE(exactFileName + "_BWT_RLEcompr." + savedExtension, std::ios_base::binary);
 
-                            //Output BWT->RLE file
-                            runLengthEncode(BWTStringStream, outputFileBWTRLE);
+                            //Output BWT->RLE file, or the text stored as is
+                            if (shrunk) {
+                                outputFileBWTRLE.write((const char*)encodedBWT.data(), encodedBWT.size());
+                            } else {
+                                writeStoredFile(input.data(), input.size(), outputFileBWTRLE);
+                            }
                             
                             outputFileBWTRLE.close();                   
                         }
@@ -145,38 +991,92 @@ int main (int argc, char* argv[]) {
                         //DEBUG: Outputs RLE only on text file for testing - set to 1 to create RLE only file
                         bool flag = 0;
                         if (flag || bwtAnswer == 'n') {
-                            std::ifstream inputFileRLE(argv[3], std::ios_base::binary);
+                            MappedFile inputRLE(argv[3]);
+                            inputRLE.adviseSequential();
                             std::ofstream outputFileRLEOnly(exactFileName + "_RLEOnly." + savedExtension, std::ios_base::binary);
-                            runLengthEncode(inputFileRLE, outputFileRLEOnly);
-                            inputFileRLE.close();
+                            runLengthEncodeOrStore(inputRLE.data(), inputRLE.size(), outputFileRLEOnly);
                             outputFileRLEOnly.close();
                         }
 
                         break;
                     } else { 
-                        std::ofstream outputFile(exactFileName + "_RLEcompr." + savedExtension, std::ios_base::binary); 
+                        WriteBehindStream outputFile(exactFileName + "_RLEcompr." + savedExtension, std::ios_base::binary); 
                         //Let user know about RLE drawbacks
                         std::cout << "RLE may result in a larger file size for this type." << std::endl;
 
-                        runLengthEncode(inputFile, outputFile);
+                        MappedFile input(argv[3]);
+                        input.adviseSequential();
+                        runLengthEncodeOrStore(input.data(), input.size(), outputFile);
                         break;
                     }
                 }
                 /* Lempel-Ziv */
                 case switchHash("LZ"): {
                     //Open new file for LZCompressed output
-                    std::ofstream outputFile(exactFileName + "_LZcompressed." + savedExtension, std::ios_base::binary);        
-                    lzCompress(inputFile, outputFile); 
+                    WriteBehindStream outputFile(exactFileName + "_LZcompressed." + savedExtension, std::ios_base::binary);        
+                    MappedFile input(argv[3]);
+                    input.adviseSequential();
+                    lzCompressOrStore(input.data(), input.size(), outputFile);
+                    break;
+                }
+                /* Lempel-Ziv over independent chunks, on every core */
+                case switchHash("PLZ"): {
+                    size_t chunkSize = algorithmParam.empty() ? defaultLZChunkSize : parseByteSize(algorithmParam);
+                    WriteBehindStream outputFile(exactFileName + "_PLZcompr." + savedExtension, std::ios_base::binary);
+                    try {
+                        ThreadPool pool;
+                        parallelLZFile(argv[3], outputFile, true, pool, chunkSize);
+                    }
+                    catch(std::exception const &error) {
+                        std::cout << "Could not compress the file: " << error.what() << std::endl;
+                        return EXIT_FAILURE;
+                    }
+                    break;
+                }
+                /* Tiled image */
+                case switchHash("TILE"): {
+                    //Tiles are compressed in parallel on a thread pool
+                    try {
+                        ThreadPool pool;
+                        SourceImage image(argv[3]);
+                        tiledEncode(image.view(), exactFileName + "_TILEcompr." + savedExtension, pool);
+                    }
+                    catch(std::runtime_error const &error) {
+                        std::cout << "Could not tile the image: " << error.what() << std::endl;
+                        return EXIT_FAILURE;
+                    }
                     break;
                 }
+                /* DEFLATE, written as gzip */
+                case switchHash("DEFLATE"): {
+                    int level = 6;
+                    if (!algorithmParam.empty()) {
+                        char *end = nullptr;
+                        long parsed = std::strtol(algorithmParam.c_str(), &end, 10);
+                        if (*end != '\0' || parsed < 0 || parsed > 9) {
+                            std::cout << "The DEFLATE level must be a number from 0 to 9, not " << algorithmParam << std::endl;
+                            return EXIT_FAILURE;
+                        }
+                        level = int(parsed);
+                    }
+                    ReadAheadStream inputFile(argv[3], std::ios_base::binary);
+                    WriteBehindStream outputFile(exactFileName + "_DEFLATEcompr." + savedExtension, std::ios_base::binary);
+                    gzipCompress(inputFile, outputFile, level);
+                    break;
+                }
+                /* Any other stage or chain of stages, e.g. BWT,MTF,RLE,HUFF */
                 default: {
-                    printCompressionInstructions();
-                    return EXIT_FAILURE;
+                    return runContainerCompress(algorithmName, algorithmParam, argv[3], savedExtension,
+                        exactFileName + "_" + pipelineFileTag(algorithmName) + "compr.arb", staged);
                 }
             }            
         } 
         /* Decompression Algorithms */
         else if(std::string("-d") == argv[1] ) {
+            //Containers are decoded by the chain stored in them, whatever AlgX is
+            if (isContainer(argv[3])) {
+                return runContainerDecode(argv[3]);
+            }
             switch ( switchHash(algorithmChoice) ){
                 /* RLE */
                 case switchHash("RLE"): {
@@ -184,25 +1084,59 @@ int main (int argc, char* argv[]) {
                         //RLE BMP compression
                         std::string inpp = argv[3];
                         std::string outpp = (inpp + "_RLEdecompressed." + savedExtension);
-                        bmpDecode(inpp, outpp);
+                        try {
+                            if (isStoredFile(inpp)) {
+                                std::ofstream outputFile(outpp, std::ios_base::binary);
+                                copyStoredFile(inpp, outputFile);
+                            } else {
+                                bmpDecode(inpp, outpp);
+                            }
+                        }
+                        catch(std::runtime_error const &error) {
+                            std::cout << "Could not decode the BMP file: " << error.what() << std::endl;
+                            return EXIT_FAILURE;
+                        }
                         break;
                    } else if(savedExtension == "txt"){
+                        //Only files written with BWT get the inverse BWT; RLE-only ones hold the text itself
+                        const std::string rleOnlySuffix = "_RLEOnly";
+                        bool rleOnly = exactFileName.size() >= rleOnlySuffix.size() &&
+                            exactFileName.compare(exactFileName.size() - rleOnlySuffix.size(), rleOnlySuffix.size(), rleOnlySuffix) == 0;
+                        std::ofstream outinvertedBWTinvertedRLE(exactFileName + (rleOnly ? "_RLEdecompressed." :
+                            "_RLEdecomp_BWTinvert.") + savedExtension, std::ios_base::binary);
+                        //Text the runs would not shrink was stored as is
+                        if (isStoredFile(argv[3])) {
+                            copyStoredFile(argv[3], outinvertedBWTinvertedRLE);
+                            break;
+                        }
 
                         //Undo RLE first
+                        ReadAheadStream inputFile(argv[3], std::ios_base::binary);
                         std::string decodedRLE = runLengthDecode(inputFile); //Undoes RLE
+                        if (rleOnly) {
+                            printStringToFile(decodedRLE, outinvertedBWTinvertedRLE);
+                            break;
+                        }
 
-                        //Creates string stream in lieu of input file stream
-                        std::stringstream inputBWTinvertedRLE;
-                        inputBWTinvertedRLE << decodedRLE;
-
-                        //Undo BWT next
-                        std::ofstream outinvertedBWTinvertedRLE(exactFileName + "_RLEdecomp_BWTinvert." + savedExtension, std::ios_base::binary);
-                        inverseBWT(inputBWTinvertedRLE, outinvertedBWTinvertedRLE);
+                        //Undo BWT next, straight from the decoded string
+                        try {
+                            printStringToFile(invertFunc(decodedRLE), outinvertedBWTinvertedRLE);
+                        }
+                        catch(std::runtime_error const &error) {
+                            std::cout << "Could not invert the BWT (" << error.what() << "); a file compressed " <<
+                                "without BWT ends in _RLEOnly" << std::endl;
+                            return EXIT_FAILURE;
+                        }
                         outinvertedBWTinvertedRLE.close();
 
                         break;                    
                     } else {
-                        std::ofstream outputFile(exactFileName + "_RLEdecompressed." + savedExtension, std::ios_base::binary);        
+                        WriteBehindStream outputFile(exactFileName + "_RLEdecompressed." + savedExtension, std::ios_base::binary);        
+                        if (isStoredFile(argv[3])) {
+                            copyStoredFile(argv[3], outputFile);
+                            break;
+                        }
+                        ReadAheadStream inputFile(argv[3], std::ios_base::binary);
                         std::string decodedData = runLengthDecode(inputFile);
 
                         printStringToFile(decodedData, outputFile);
@@ -212,10 +1146,65 @@ int main (int argc, char* argv[]) {
                 /* Lempel-Ziv */
                 case switchHash("LZ"):{
                     //Open new file for LZDecompressed output
-                    std::ofstream outputFile(exactFileName + "_LZdecompressed." + savedExtension, std::ios_base::binary);        
+                    WriteBehindStream outputFile(exactFileName + "_LZdecompressed." + savedExtension, std::ios_base::binary);        
+                    if (isStoredFile(argv[3])) {
+                        copyStoredFile(argv[3], outputFile);
+                        break;
+                    }
+                    ReadAheadStream inputFile(argv[3], std::ios_base::binary);
                     lzDecompress(inputFile, outputFile); 
                     break;
                 }
+                /* Chunked Lempel-Ziv */
+                case switchHash("PLZ"): {
+                    WriteBehindStream outputFile(exactFileName + "_PLZdecompressed." + savedExtension, std::ios_base::binary);
+                    try {
+                        ThreadPool pool;
+                        parallelLZFile(argv[3], outputFile, false, pool);
+                    }
+                    catch(std::exception const &error) {
+                        std::cout << "Could not decompress the file: " << error.what() << std::endl;
+                        return EXIT_FAILURE;
+                    }
+                    break;
+                }
+                /* Tiled image */
+                case switchHash("TILE"): {
+                    //Region to decode as x,y,width,height; defaults to the whole image
+                    uint32_t region[4] = {0, 0, UINT32_MAX, UINT32_MAX};
+                    if (argc == 5) {
+                        std::stringstream regionStream(argv[4]);
+                        char comma;
+                        regionStream >> region[0] >> comma >> region[1] >> comma >> region[2] >> comma >> region[3];
+                        if (!regionStream) {
+                            printCompressionInstructions();
+                            return EXIT_FAILURE;
+                        }
+                    }
+                    try {
+                        ThreadPool pool;
+                        PixelBuffer image = tiledDecodeRegion(argv[3], region[0], region[1], region[2], region[3], pool);
+                        writeBMP(exactFileName + "_TILEdecompressed.bmp", image.view());
+                    }
+                    catch(std::runtime_error const &error) {
+                        std::cout << "Could not decode the tiled image: " << error.what() << std::endl;
+                        return EXIT_FAILURE;
+                    }
+                    break;
+                }
+                /* DEFLATE, read as gzip */
+                case switchHash("DEFLATE"): {
+                    ReadAheadStream inputFile(argv[3], std::ios_base::binary);
+                    WriteBehindStream outputFile(exactFileName + "_DEFLATEdecompressed." + savedExtension, std::ios_base::binary);
+                    try {
+                        gzipDecompress(inputFile, outputFile);
+                    }
+                    catch(std::runtime_error const &error) {
+                        std::cout << "Could not inflate the file: " << error.what() << std::endl;
+                        return EXIT_FAILURE;
+                    }
+                    break;
+                }
                 default: {
                     printCompressionInstructions();
                     return EXIT_FAILURE;
@@ -227,17 +1216,25 @@ int main (int argc, char* argv[]) {
             switch ( switchHash(algorithmChoice) ){
                 /* BWT Transformation */
                 case switchHash("BWT"): {
-                    std::ofstream outputFile(exactFileName + "_BWTransformed." + savedExtension, std::ios_base::binary);        
+                    WriteBehindStream outputFile(exactFileName + "_BWTransformed." + savedExtension, std::ios_base::binary);        
 
-                    std::string BWTString = forwardBWT(inputFile);
+                    MappedFile input(argv[3]);
+                    std::string BWTString = forwardBWT(input.data(), input.size());
 
                     printStringToFile(BWTString, outputFile);
                     break;
                 }
                 /* Inverse BW-Transformation */
                 case switchHash("inBWT"): {
-                    std::ofstream outputFile(exactFileName + "_InverseBWTransform." + savedExtension, std::ios_base::binary);        
-                    inverseBWT(inputFile, outputFile);
+                    WriteBehindStream outputFile(exactFileName + "_InverseBWTransform." + savedExtension, std::ios_base::binary);        
+                    try {
+                        MappedFile input(argv[3]);
+                        printStringToFile(inverseBWT(input.data(), input.size()), outputFile);
+                    }
+                    catch(std::runtime_error const &error) {
+                        std::cout << "Could not invert the BWT: " << error.what() << std::endl;
+                        return EXIT_FAILURE;
+                    }
                     break;
                 }
                 default: {
@@ -271,6 +1268,20 @@ int main (int argc, char* argv[]) {
             ".png, .bmp" << std::endl;
             return EXIT_FAILURE;
         }
+    } else if (std::string("-c") == argv[1]) {
+        //Other file types go through the block pipeline, with the algorithm as a chain
+        std::string chain, blockParam;
+        try {
+            containerChain(algorithmName, algorithmParam, chain, blockParam);
+        }
+        catch(std::invalid_argument const &error) {
+            std::cout << error.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return runContainerCompress(chain, blockParam, argv[3], savedExtension,
+            exactFileName + "_" + pipelineFileTag(algorithmName) + "compr.arb", staged);
+    } else if (std::string("-d") == argv[1] && isContainer(argv[3])) {
+        return runContainerDecode(argv[3]);
     } else {
         printCompressionInstructions();
         return EXIT_FAILURE;
@@ -0,0 +1,313 @@
+/*
+ArbLibrary:
+Implements ArbLibrary.hpp on top of the container and codec pipeline. This
+is the only translation unit of the library that includes the codec headers.
+Memory buffers are read and written through fixed-size stream buffers, so
+the container code runs unchanged and never copies the caller's input.
+*/
+
+#include <cstring>
+#include <string>
+#include <new>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <stdexcept>
+#include "ArbLibrary.hpp"
+#include "Container.hpp"
+#include "AutoCodec.hpp"
+
+/*
+* Memory Read Buffer
+* A seekable stream buffer over caller memory, read in place
+*/
+class MemoryReadBuffer : public std::streambuf {
+public:
+    MemoryReadBuffer(const void *data, size_t size) {
+        char *begin = const_cast<char *>(static_cast<const char *>(data));
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode) override {
+        off_type base = direction == std::ios_base::beg ? 0 :
+            direction == std::ios_base::end ? off_type(egptr() - eback()) : off_type(gptr() - eback());
+        return seekpos(pos_type(base + offset), std::ios_base::in);
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode) override {
+        off_type offset = off_type(position);
+        if (offset < 0 || offset > off_type(egptr() - eback())) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), eback() + offset, egptr());
+        return position;
+    }
+};
+
+/*
+* Memory Write Buffer
+* A stream buffer writing into caller memory; writing past the end fails
+* the stream and is remembered
+*/
+class MemoryWriteBuffer : public std::streambuf {
+public:
+    MemoryWriteBuffer(void *data, size_t capacity) : full(false) {
+        char *begin = static_cast<char *>(data);
+        setp(begin, begin + capacity);
+    }
+
+    size_t written() const { return size_t(pptr() - pbase()); }
+    bool overflowed() const { return full; }
+
+protected:
+    int_type overflow(int_type) override {
+        full = true;
+        return traits_type::eof();
+    }
+
+private:
+    bool full;
+};
+
+/*
+* Status Of
+* Runs a call and turns the exception it throws, if any, into a status
+*/
+template <class Call>
+ArbStatus statusOf(ArbStatus failure, Call call) {
+    try {
+        call();
+        return ARB_OK;
+    }
+    catch (std::bad_alloc const &) {
+        return ARB_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::invalid_argument const &) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    catch (std::exception const &) {
+        return failure;
+    }
+    catch (...) {
+        return ARB_ERROR_INTERNAL;
+    }
+}
+
+struct ArbCompressor::State {
+    ArbStatus status = ARB_OK;
+    ContainerHeader header;           //Chain and block size of every compressed buffer
+    std::unique_ptr<ThreadPool> pool;
+    ContainerCodecs compressCodecs;
+    ContainerCodecs decompressCodecs;
+};
+
+ArbCompressor::ArbCompressor(const ArbOptions &options) : state(new State()) {
+    state->status = statusOf(ARB_ERROR_INTERNAL, [&] {
+        state->header.chain = options.chain != nullptr ? options.chain : "AUTO";
+        state->header.blockSize = options.blockSize != 0 ? options.blockSize : uint32_t(defaultBlockSize);
+        state->pool.reset(options.threads != 0 ? new ThreadPool(options.threads) : new ThreadPool());
+        state->compressCodecs.prepare(state->header.chain, state->pool->size() * 2);
+    });
+}
+
+ArbCompressor::~ArbCompressor() {
+}
+
+ArbStatus ArbCompressor::status() const {
+    return state->status;
+}
+
+size_t ArbCompressor::compressBound(size_t srcLen) const {
+    return size_t(containerBound(srcLen, state->header));
+}
+
+ArbStatus ArbCompressor::compress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t &dstLen) {
+    dstLen = 0;
+    if (state->status != ARB_OK) {
+        return state->status;
+    }
+    if ((src == nullptr && srcLen != 0) || (dst == nullptr && dstCap != 0)) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    MemoryReadBuffer input(src, srcLen);
+    MemoryWriteBuffer output(dst, dstCap);
+    std::istream is(&input);
+    std::ostream os(&output);
+    ArbStatus result = compress(is, os, srcLen);
+    if (output.overflowed()) {
+        return ARB_ERROR_BUFFER_TOO_SMALL;
+    }
+    if (result == ARB_OK) {
+        dstLen = output.written();
+    }
+    return result;
+}
+
+ArbStatus ArbCompressor::compress(std::istream &is, std::ostream &os, uint64_t size) {
+    if (state->status != ARB_OK) {
+        return state->status;
+    }
+    return statusOf(ARB_ERROR_INTERNAL, [&] {
+        ContainerHeader header = state->header;
+        header.originalSize = size;
+        containerCompress(is, os, header, *state->pool, state->compressCodecs);
+    });
+}
+
+ArbStatus ArbCompressor::decompress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t &dstLen) {
+    dstLen = 0;
+    if (state->status != ARB_OK) {
+        return state->status;
+    }
+    if ((src == nullptr && srcLen != 0) || (dst == nullptr && dstCap != 0)) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    MemoryReadBuffer input(src, srcLen);
+    MemoryWriteBuffer output(dst, dstCap);
+    std::istream is(&input);
+    std::ostream os(&output);
+
+    //The size is checked up front so a small buffer fails before any decoding
+    uint64_t size = 0;
+    ArbStatus result = arb_decompressed_size(src, srcLen, &size);
+    if (result != ARB_OK) {
+        return result;
+    }
+    if (size != containerUnknownSize && size > dstCap) {
+        dstLen = size_t(size);
+        return ARB_ERROR_BUFFER_TOO_SMALL;
+    }
+    result = decompress(is, os);
+    if (output.overflowed()) {
+        return ARB_ERROR_BUFFER_TOO_SMALL;
+    }
+    if (result == ARB_OK) {
+        dstLen = output.written();
+    }
+    return result;
+}
+
+ArbStatus ArbCompressor::decompress(std::istream &is, std::ostream &os) {
+    if (state->status != ARB_OK) {
+        return state->status;
+    }
+    return statusOf(ARB_ERROR_CORRUPT_DATA, [&] {
+        ContainerHeader header = readContainer(is);
+        containerDecompress(is, os, header, *state->pool, state->decompressCodecs);
+    });
+}
+
+ArbOptions arbDefaultOptions() {
+    ArbOptions options;
+    options.chain = "AUTO";
+    options.blockSize = 0;
+    options.threads = 1;
+    return options;
+}
+
+/* C interface */
+
+struct ArbContext {
+    explicit ArbContext(const ArbOptions &options) : compressor(options) {}
+    ArbCompressor compressor;
+};
+
+extern "C" {
+
+void arb_default_options(ArbOptions *options) {
+    if (options != nullptr) {
+        *options = arbDefaultOptions();
+    }
+}
+
+size_t arb_compress_bound(size_t srcLen, const ArbOptions *options) {
+    ContainerHeader header;
+    header.chain = options != nullptr && options->chain != nullptr ? options->chain : "AUTO";
+    header.blockSize = options != nullptr && options->blockSize != 0 ? options->blockSize : uint32_t(defaultBlockSize);
+    return size_t(containerBound(srcLen, header));
+}
+
+ArbStatus arb_decompressed_size(const void *src, size_t srcLen, uint64_t *size) {
+    if ((src == nullptr && srcLen != 0) || size == nullptr) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    MemoryReadBuffer input(src, srcLen);
+    std::istream is(&input);
+    return statusOf(ARB_ERROR_CORRUPT_DATA, [&] {
+        *size = readContainerHeader(is).originalSize;
+    });
+}
+
+ArbStatus arb_compress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t *dstLen,
+        const ArbOptions *options) {
+    if (dstLen == nullptr) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    ArbStatus result = ARB_OK;
+    ArbStatus setup = statusOf(ARB_ERROR_INTERNAL, [&] {
+        ArbCompressor compressor(options != nullptr ? *options : arbDefaultOptions());
+        result = compressor.compress(src, srcLen, dst, dstCap, *dstLen);
+    });
+    return setup != ARB_OK ? setup : result;
+}
+
+ArbStatus arb_decompress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t *dstLen) {
+    if (dstLen == nullptr) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    ArbStatus result = ARB_OK;
+    ArbStatus setup = statusOf(ARB_ERROR_INTERNAL, [&] {
+        ArbCompressor compressor(arbDefaultOptions());
+        result = compressor.decompress(src, srcLen, dst, dstCap, *dstLen);
+    });
+    return setup != ARB_OK ? setup : result;
+}
+
+ArbContext *arb_context_create(const ArbOptions *options) {
+    try {
+        ArbContext *context = new ArbContext(options != nullptr ? *options : arbDefaultOptions());
+        if (context->compressor.status() != ARB_OK) {
+            delete context;
+            return nullptr;
+        }
+        return context;
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void arb_context_free(ArbContext *context) {
+    delete context;
+}
+
+ArbStatus arb_context_compress(ArbContext *context, const void *src, size_t srcLen,
+        void *dst, size_t dstCap, size_t *dstLen) {
+    if (context == nullptr || dstLen == nullptr) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    return context->compressor.compress(src, srcLen, dst, dstCap, *dstLen);
+}
+
+ArbStatus arb_context_decompress(ArbContext *context, const void *src, size_t srcLen,
+        void *dst, size_t dstCap, size_t *dstLen) {
+    if (context == nullptr || dstLen == nullptr) {
+        return ARB_ERROR_INVALID_ARGUMENT;
+    }
+    return context->compressor.decompress(src, srcLen, dst, dstCap, *dstLen);
+}
+
+const char *arb_status_string(ArbStatus status) {
+    switch (status) {
+        case ARB_OK: return "ok";
+        case ARB_ERROR_BUFFER_TOO_SMALL: return "destination buffer too small";
+        case ARB_ERROR_INVALID_ARGUMENT: return "invalid argument";
+        case ARB_ERROR_CORRUPT_DATA: return "corrupt or truncated data";
+        case ARB_ERROR_OUT_OF_MEMORY: return "out of memory";
+        case ARB_ERROR_INTERNAL: return "internal error";
+    }
+    return "unknown status";
+}
+
+}
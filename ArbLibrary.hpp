@@ -0,0 +1,116 @@
+#ifndef ARB_LIBRARY_HPP
+#define ARB_LIBRARY_HPP
+
+/*
+ArbLibrary:
+The codecs as a library, for programs that compress in-process instead of
+running the CLI per file. Output is the .arb container the CLI writes, so
+either side can decode the other's files. Nothing prints or exits; every
+call returns an ArbStatus. This header does not pull in the codec headers,
+so it can be included anywhere; ArbLibrary.cpp is the one translation unit
+that does. Build it with, e.g.:
+    g++ -std=c++11 -O2 -pthread -fPIC -fvisibility=hidden -shared ArbLibrary.cpp -o libarb.so
+    g++ -std=c++11 -O2 -pthread -c ArbLibrary.cpp && ar rcs libarb.a ArbLibrary.o
+----------------------------------------------------------
+C:   arb_compress / arb_decompress with caller-provided buffers, sized with
+     arb_compress_bound / arb_decompressed_size; an ArbContext keeps the
+     codec stages, buffers and threads between calls.
+C++: ArbCompressor does the same, plus stream overloads.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define ARB_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define ARB_API __attribute__((visibility("default")))
+#else
+#define ARB_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum ArbStatus {
+    ARB_OK = 0,
+    ARB_ERROR_BUFFER_TOO_SMALL = -1,  //dst cannot hold the result; nothing useful was written
+    ARB_ERROR_INVALID_ARGUMENT = -2,  //Null pointer, unknown codec or bad block size
+    ARB_ERROR_CORRUPT_DATA = -3,      //Not a container, truncated or failed a checksum
+    ARB_ERROR_OUT_OF_MEMORY = -4,
+    ARB_ERROR_INTERNAL = -5
+} ArbStatus;
+
+typedef struct ArbOptions {
+    const char *chain;    //Codec chain, e.g. "BWT,MTF,RLE,HUFF" or "AUTO"
+    uint32_t blockSize;   //Bytes per block, 0 for the default (1 MiB)
+    unsigned threads;     //Threads encoding blocks, 0 for one per hardware thread
+} ArbOptions;
+
+typedef struct ArbContext ArbContext;
+
+//AUTO chain, default block size, one thread
+ARB_API void arb_default_options(ArbOptions *options);
+
+//Largest output arb_compress can produce for srcLen bytes with these options (NULL for defaults)
+ARB_API size_t arb_compress_bound(size_t srcLen, const ArbOptions *options);
+
+//Original size recorded in a compressed buffer, UINT64_MAX if it was compressed from a stream of unknown length
+ARB_API ArbStatus arb_decompressed_size(const void *src, size_t srcLen, uint64_t *size);
+
+//One-shot calls; options may be NULL for the defaults
+ARB_API ArbStatus arb_compress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t *dstLen,
+    const ArbOptions *options);
+ARB_API ArbStatus arb_decompress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t *dstLen);
+
+//Reusable contexts; one context must not be used by two threads at once
+ARB_API ArbContext *arb_context_create(const ArbOptions *options);
+ARB_API void arb_context_free(ArbContext *context);
+ARB_API ArbStatus arb_context_compress(ArbContext *context, const void *src, size_t srcLen,
+    void *dst, size_t dstCap, size_t *dstLen);
+ARB_API ArbStatus arb_context_decompress(ArbContext *context, const void *src, size_t srcLen,
+    void *dst, size_t dstCap, size_t *dstLen);
+
+ARB_API const char *arb_status_string(ArbStatus status);
+
+#ifdef __cplusplus
+}
+
+#include <iosfwd>
+#include <memory>
+
+ARB_API ArbOptions arbDefaultOptions();
+
+/*
+* ArbCompressor
+* A reusable compression context: the codec stages, block buffers and
+* thread pool are created once and kept for every later call
+*/
+class ARB_API ArbCompressor {
+public:
+    explicit ArbCompressor(const ArbOptions &options = arbDefaultOptions());
+    ~ArbCompressor();
+
+    ArbCompressor(const ArbCompressor &) = delete;
+    ArbCompressor &operator=(const ArbCompressor &) = delete;
+
+    //ARB_ERROR_INVALID_ARGUMENT if the options name an unknown codec
+    ArbStatus status() const;
+    size_t compressBound(size_t srcLen) const;
+
+    ArbStatus compress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t &dstLen);
+    ArbStatus decompress(const void *src, size_t srcLen, void *dst, size_t dstCap, size_t &dstLen);
+
+    //Whole streams; decompression needs a seekable input
+    ArbStatus compress(std::istream &is, std::ostream &os, uint64_t size);
+    ArbStatus decompress(std::istream &is, std::ostream &os);
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+#endif //__cplusplus
+
+#endif //ARB_LIBRARY_HPP
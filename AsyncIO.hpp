@@ -0,0 +1,339 @@
+#ifndef ASYNC_IO_HPP
+#define ASYNC_IO_HPP
+
+/*
+AsyncIO:
+File streams whose disk work happens on a background thread. ReadAheadStream
+reads the file in large blocks, aligned to the block size, up to 'depth'
+blocks ahead of the reader; WriteBehindStream hands every full block to a
+thread that writes it while the caller fills the next one. Buffers travel
+between the two threads through SpscQueues and are reused, so memory stays
+at depth blocks per stream. Both are ordinary iostreams, so codecs that read
+a byte at a time get large reads underneath without changes.
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <streambuf>
+#include "SpscQueue.hpp"
+
+const size_t asyncBlockSize = 1 << 20;
+const size_t asyncDepth = 4;
+
+//One buffer on its way between the caller and the I/O thread
+struct AsyncBlock {
+    std::vector<char> data;
+    size_t size = 0;
+    bool end = false;    //Last block of the file, or a read error
+    bool failed = false;
+};
+
+/*
+* Read Ahead Buffer
+* Stream buffer fed by a thread reading the blocks that follow the current one
+*/
+class ReadAheadBuffer : public std::streambuf {
+public:
+    ReadAheadBuffer(const std::string &fileName, size_t blockSize_p = asyncBlockSize, size_t depth = asyncDepth)
+        : file(fileName, std::ios_base::binary), blockSize(blockSize_p), filled(depth), empty(depth),
+          stopping(false), blockStart(0), nextStart(0), skip(0) {
+        if (!file.is_open()) {
+            return;
+        }
+        file.seekg(0, std::ios_base::end);
+        length = uint64_t(file.tellg());
+        for (size_t i = 0; i < empty.capacity(); i++) {
+            AsyncBlock block;
+            block.data.resize(blockSize);
+            empty.tryPush(block);
+        }
+        start(0);
+    }
+
+    ~ReadAheadBuffer() {
+        stop();
+    }
+
+    bool isOpen() const { return file.is_open(); }
+    uint64_t fileSize() const { return length; }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        if (!reader.joinable() || current.end) {
+            return traits_type::eof();
+        }
+        //Hands the used buffer back before taking the next one
+        if (current.data.size() == blockSize) {
+            empty.tryPush(current);
+        }
+        if (!filled.pop(current, stopping)) {
+            return traits_type::eof();
+        }
+        blockStart = nextStart;
+        nextStart += current.size;
+        if (current.failed) {
+            setg(nullptr, nullptr, nullptr);
+            return traits_type::eof();
+        }
+        char *base = current.data.data();
+        size_t offset = std::min<uint64_t>(skip, current.size);
+        skip -= offset;
+        setg(base, base + offset, base + current.size);
+        return gptr() < egptr() ? traits_type::to_int_type(*gptr()) : underflow();
+    }
+
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode) override {
+        uint64_t position = blockStart + uint64_t(gptr() - eback()) + skip;
+        if (direction == std::ios_base::beg) {
+            position = uint64_t(offset);
+        } else if (direction == std::ios_base::end) {
+            position = length + offset;
+        } else {
+            if (offset == 0) {
+                return pos_type(off_type(position));
+            }
+            position += offset;
+        }
+        return seekpos(pos_type(off_type(position)), std::ios_base::in);
+    }
+
+    pos_type seekpos(pos_type target, std::ios_base::openmode) override {
+        if (!file.is_open() || off_type(target) < 0) {
+            return pos_type(off_type(-1));
+        }
+        uint64_t position = uint64_t(off_type(target));
+        //Inside the block already held, only the read pointer moves
+        if (eback() != nullptr && position >= blockStart && position < blockStart + uint64_t(egptr() - eback())) {
+            setg(eback(), eback() + (position - blockStart), egptr());
+            skip = 0;
+            return target;
+        }
+        stop();
+        if (current.data.size() == blockSize) {
+            empty.tryPush(current);
+        }
+        current = AsyncBlock();
+        setg(nullptr, nullptr, nullptr);
+        start(position - position % blockSize);
+        skip = position % blockSize;
+        return target;
+    }
+
+private:
+    //Starts the read-ahead thread at an offset that is a multiple of the block size
+    void start(uint64_t offset) {
+        stopping = false;
+        blockStart = nextStart = offset;
+        file.clear();
+        file.seekg(std::streamoff(offset));
+        reader = std::thread([this] {
+            AsyncBlock block;
+            while (empty.pop(block, stopping)) {
+                file.read(block.data.data(), std::streamsize(blockSize));
+                block.size = size_t(file.gcount());
+                block.failed = file.bad();
+                block.end = block.size < blockSize || block.failed;
+                if (!filled.push(block, stopping) || block.end) {
+                    return;
+                }
+            }
+        });
+    }
+
+    //Stops the thread and returns every block it read ahead to the empty queue
+    void stop() {
+        if (!reader.joinable()) {
+            return;
+        }
+        stopping = true;
+        reader.join();
+        AsyncBlock block;
+        while (filled.tryPop(block)) {
+            empty.tryPush(block);
+        }
+    }
+
+    std::ifstream file;
+    uint64_t length = 0;
+    size_t blockSize;
+    SpscQueue<AsyncBlock> filled;   //Reader thread to caller
+    SpscQueue<AsyncBlock> empty;    //Caller to reader thread
+    std::atomic<bool> stopping;
+    std::thread reader;
+    AsyncBlock current;
+    uint64_t blockStart;            //File offset of the block in the get area
+    uint64_t nextStart;
+    uint64_t skip;                  //Bytes to pass over in the next block after a seek
+};
+
+/*
+* Write Behind Buffer
+* Stream buffer whose full blocks are written by a background thread
+*/
+class WriteBehindBuffer : public std::streambuf {
+public:
+    WriteBehindBuffer(const std::string &fileName, size_t blockSize_p = asyncBlockSize, size_t depth = asyncDepth)
+        : file(fileName, std::ios_base::binary | std::ios_base::trunc), blockSize(blockSize_p),
+          full(depth), empty(depth), stopping(false), failed(false), handedOff(0), written(0) {
+        if (!file.is_open()) {
+            return;
+        }
+        for (size_t i = 0; i + 1 < empty.capacity(); i++) {
+            AsyncBlock block;
+            block.data.resize(blockSize);
+            empty.tryPush(block);
+        }
+        current.data.resize(blockSize);
+        setp(current.data.data(), current.data.data() + blockSize);
+        writer = std::thread([this] {
+            AsyncBlock block;
+            while (full.pop(block, stopping)) {
+                if (!failed && !file.write(block.data.data(), std::streamsize(block.size))) {
+                    failed = true;
+                }
+                written += block.size;
+                bool end = block.end;
+                empty.tryPush(block);
+                if (end) {
+                    file.flush();
+                    failed = failed || !file;
+                    return;
+                }
+            }
+        });
+    }
+
+    ~WriteBehindBuffer() {
+        close();
+    }
+
+    bool isOpen() const { return file.is_open(); }
+
+    //Writes what is left and waits for the thread; false if any write failed
+    bool close() {
+        if (!writer.joinable()) {
+            return !failed;
+        }
+        handOff(true);
+        writer.join();
+        return !failed;
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!writer.joinable() || !handOff(false)) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    //Waits until everything handed off so far is on disk
+    int sync() override {
+        if (!writer.joinable()) {
+            return failed ? -1 : 0;
+        }
+        if (pptr() > pbase() && !handOff(false)) {
+            return -1;
+        }
+        while (written < handedOff && !failed) {
+            std::this_thread::yield();
+        }
+        return failed ? -1 : 0;
+    }
+
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode) override {
+        //Only reports the position; the file is written strictly in order
+        if (offset != 0 || direction != std::ios_base::cur) {
+            return pos_type(off_type(-1));
+        }
+        return pos_type(off_type(handedOff + uint64_t(pptr() - pbase())));
+    }
+
+private:
+    //Queues the put area for the writer thread and takes an empty buffer for the next one
+    bool handOff(bool end) {
+        current.size = size_t(pptr() - pbase());
+        current.end = end;
+        handedOff += current.size;
+        if (!full.push(current, stopping)) {
+            return false;
+        }
+        if (end) {
+            setp(nullptr, nullptr);
+            return !failed;
+        }
+        if (!empty.pop(current, stopping)) {
+            return false;
+        }
+        setp(current.data.data(), current.data.data() + blockSize);
+        return !failed;
+    }
+
+    std::ofstream file;
+    size_t blockSize;
+    SpscQueue<AsyncBlock> full;     //Caller to writer thread
+    SpscQueue<AsyncBlock> empty;    //Writer thread to caller
+    std::atomic<bool> stopping;
+    std::atomic<bool> failed;
+    std::thread writer;
+    AsyncBlock current;
+    uint64_t handedOff;             //Bytes given to the writer thread
+    std::atomic<uint64_t> written;  //Bytes it has written
+};
+
+//An input file stream reading ahead on a background thread
+class ReadAheadStream : public std::istream {
+public:
+    explicit ReadAheadStream(const std::string &fileName, std::ios_base::openmode = std::ios_base::binary)
+        : std::istream(nullptr), buffer(fileName) {
+        init(&buffer);
+        if (!buffer.isOpen()) {
+            setstate(std::ios_base::failbit);
+        }
+    }
+
+    bool is_open() const { return buffer.isOpen(); }
+    uint64_t fileSize() const { return buffer.fileSize(); }
+    void close() {}
+
+private:
+    ReadAheadBuffer buffer;
+};
+
+//An output file stream writing behind on a background thread
+class WriteBehindStream : public std::ostream {
+public:
+    explicit WriteBehindStream(const std::string &fileName, std::ios_base::openmode = std::ios_base::binary)
+        : std::ostream(nullptr), buffer(fileName) {
+        init(&buffer);
+        if (!buffer.isOpen()) {
+            setstate(std::ios_base::failbit);
+        }
+    }
+
+    bool is_open() const { return buffer.isOpen(); }
+
+    void close() {
+        if (!buffer.close()) {
+            setstate(std::ios_base::badbit);
+        }
+    }
+
+private:
+    WriteBehindBuffer buffer;
+};
+
+#endif //ASYNC_IO_HPP
@@ -0,0 +1,118 @@
+#ifndef AUTO_CODEC_HPP
+#define AUTO_CODEC_HPP
+
+/*
+AutoCodec:
+The "AUTO" pipeline stage. Each block is sampled (see BlockStats.hpp) and
+encoded with the chain expected to win for it, or stored raw; if the chosen
+chain still fails to shrink the block, the block is stored raw instead.
+----------------------------------------------------------
+Block layout: u8 tag (index into autoChains), then the encoded block, or the
+raw bytes for tag 0
+*/
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include "Codec_Pipeline.hpp"
+#include "BlockStats.hpp"
+#include "DeltaFilter.hpp"
+
+//Chains AUTO chooses from; the index is the tag byte, so only append to this list
+const char *const autoChains[] = {
+    "",             //0: stored raw
+    "HUFF",         //1: skewed bytes without repeats
+    "DEFLATE",      //2: repeated strings in binary data
+    "BWT,MTF,HUFF", //3: repeated strings in text
+    "RLE,HUFF",     //4: long runs of one byte
+    "DELTA,DEFLATE",//5: numeric records (samples, counters, pixels)
+};
+const size_t autoChainCount = sizeof(autoChains) / sizeof(autoChains[0]);
+
+/*
+* Choose Auto Chain
+* Picks a tag from the statistics of a block; 'numeric' tells whether a
+* delta filter found a stride that lowers its entropy
+*/
+unsigned char chooseAutoChain(const BlockStats &stats, bool numeric) {
+    if (stats.sampled == 0) {
+        return 0;
+    }
+    //RLE spends about 3 bytes per run, so it needs long runs to pay off
+    if (stats.averageRun >= 8) {
+        return 4;
+    }
+    //Differences break up exact repeats, so blocks made mostly of them stay with DEFLATE alone
+    if (numeric && stats.textFraction < 0.9 && stats.matchFraction < 0.5) {
+        return 5;
+    }
+    if (stats.matchFraction >= 0.1) {
+        return stats.textFraction >= 0.9 ? 3 : 2;
+    }
+    if (stats.entropy < 7.2) {
+        return 1;
+    }
+    return 0;
+}
+
+class AutoCodec : public Codec {
+public:
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        size_t start = out.size();
+        unsigned char tag = chooseAutoChain(sampleBlockStats(data, size), chooseDeltaParams(data, size).width != 0);
+        //BWT takes blocks under 2 GiB only
+        if (tag == 3 && size >= bwtEntryPointFlag) {
+            tag = 2;
+        }
+        out.push_back(tag);
+        if (tag != 0) {
+            //Fall back to storing the block when the chain does not shrink it
+            if (!pipeline(tag).encodeBlock(data, size, out, size - 1)) {
+                out.resize(start);
+                tag = 0;
+                out.push_back(tag);
+            }
+        }
+        if (tag == 0) {
+            out.insert(out.end(), data, data + size);
+        }
+    }
+
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        decodeWithin(data, size, out, SIZE_MAX);
+    }
+
+    void decodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        if (size == 0 || data[0] >= autoChainCount) {
+            throw std::runtime_error("invalid AUTO block tag");
+        }
+        if (data[0] == 0) {
+            if (size - 1 > limit) {
+                throw std::runtime_error("AUTO block decodes past the block size");
+            }
+            out.insert(out.end(), data + 1, data + size);
+        } else {
+            pipeline(data[0]).decodeBlock(data + 1, size - 1, out, limit);
+        }
+    }
+
+private:
+    //Pipelines are built on first use and reused for later blocks
+    CodecPipeline &pipeline(unsigned char tag) {
+        if (pipelines.empty()) {
+            pipelines.resize(autoChainCount);
+        }
+        if (!pipelines[tag]) {
+            pipelines[tag].reset(new CodecPipeline(autoChains[tag]));
+        }
+        return *pipelines[tag];
+    }
+
+    std::vector<std::unique_ptr<CodecPipeline>> pipelines;
+};
+
+//Makes "AUTO" available to every chain
+const bool autoCodecRegistered = (registerCodec("AUTO", makeCodecOf<AutoCodec>), true);
+
+#endif //AUTO_CODEC_HPP
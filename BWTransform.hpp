@@ -9,6 +9,11 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <cstring>
+#include <iterator>
+#include "StageStats.hpp"
 
 //Prints the data passed
 void printData(const std::string &stringParam) {
@@ -24,84 +29,312 @@ void rotate(std::string &toRotate) {
     toRotate[0] = t;
 }
 
-//Forward BWT- BW Transformation to data
-std::string forwardBWT(std::istream &is) {
-    std::string returnString;
+/****************Block BWT Functions*********************/
 
-    //Gets input data string
-    char ch;
-    std::string data;
-    while(is.get(ch)) {
-        data.push_back(ch);
-    }
-    //std::cout << std::endl << "Input text: " << data << std::endl;
+/*
+* Refine Rotation Order
+* Prefix doubling: given the rotations sorted and ranked by their first
+* character, each pass sorts by twice as many leading characters with
+* counting sorts, so a block costs O(n log n) instead of a rotation table
+*/
+void refineRotationOrder(std::vector<uint32_t> &order, std::vector<uint32_t> &classes, size_t classCount) {
+    size_t size = order.size();
+    std::vector<uint32_t> nextOrder(size), nextClasses(size);
+    std::vector<uint32_t> count(std::max<size_t>(256, size), 0);
+    for (size_t length = 1; length < size && classCount < size; length <<= 1) {
+        //Rotations sorted by their second half are the first halves shifted back
+        for (size_t i = 0; i < size; i++) {
+            nextOrder[i] = uint32_t((order[i] + size - length) % size);
+        }
+        std::fill(count.begin(), count.begin() + classCount, 0);
+        for (size_t i = 0; i < size; i++) count[classes[nextOrder[i]]]++;
+        for (size_t c = 1; c < classCount; c++) count[c] += count[c - 1];
+        for (size_t i = size; i-- > 0;) order[--count[classes[nextOrder[i]]]] = nextOrder[i];
 
-    for (char ch : data) {
-        if (ch == START || ch == END) {
-            std::cout << "Input data cannot contain '^' or '|' chars." << std::endl;
+        classCount = 1;
+        nextClasses[order[0]] = 0;
+        for (size_t i = 1; i < size; i++) {
+            uint32_t current = order[i], previous = order[i - 1];
+            if (classes[current] != classes[previous] ||
+                classes[(current + length) % size] != classes[(previous + length) % size]) {
+                classCount++;
+            }
+            nextClasses[current] = uint32_t(classCount - 1);
         }
+        classes.swap(nextClasses);
     }
+}
 
-    //Create string to modify
-    std::string temp;
-    temp.push_back(START);
-    temp.append(data);
-    temp.push_back(END);
+/*
+* Sort Rotations
+* Returns the start of every cyclic rotation of the block in sorted order
+*/
+std::vector<uint32_t> sortRotations(const unsigned char *data, size_t size) {
+    std::vector<uint32_t> order(size), classes(size);
+    if (size == 0) {
+        return order;
+    }
 
-    //Create a table for rotations
-    std::vector<std::string> table;
-    for (size_t i = 0; i < temp.length(); i++) {
-        table.push_back(temp);
-        rotate(temp); //Rotation
+    //First pass: sort by the first character
+    size_t count[256] = {0};
+    for (size_t i = 0; i < size; i++) count[data[i]]++;
+    for (size_t c = 1; c < 256; c++) count[c] += count[c - 1];
+    for (size_t i = size; i-- > 0;) order[--count[data[i]]] = uint32_t(i);
+    size_t classCount = 1;
+    classes[order[0]] = 0;
+    for (size_t i = 1; i < size; i++) {
+        if (data[order[i]] != data[order[i - 1]]) classCount++;
+        classes[order[i]] = uint32_t(classCount - 1);
     }
-    //Sort the data
-    std::sort(table.begin(), table.end());
- 
-    std::string out;
-    for (auto &temp : table) {
-        returnString.push_back( temp[temp.length() - 1] );
+    refineRotationOrder(order, classes, classCount);
+    return order;
+}
+
+/*
+* Sort Suffixes
+* Returns the start of every suffix of the block in sorted order, as the
+* rotations of the block followed by an end marker below every byte; the
+* first entry is the empty suffix, at 'size'
+*/
+std::vector<uint32_t> sortSuffixes(const unsigned char *data, size_t size) {
+    std::vector<uint32_t> order(size + 1), classes(size + 1);
+    size_t count[256] = {0};
+    for (size_t i = 0; i < size; i++) count[data[i]]++;
+    size_t total = 1;
+    for (size_t c = 0; c < 256; c++) {
+        size_t occurrences = count[c];
+        count[c] = total;
+        total += occurrences;
     }
-    
-    return returnString;
+    order[0] = uint32_t(size);
+    classes[size] = 0;
+    for (size_t i = 0; i < size; i++) order[count[data[i]]++] = uint32_t(i);
+    size_t classCount = 1;
+    for (size_t i = 1; i <= size; i++) {
+        if (i == 1 || data[order[i]] != data[order[i - 1]]) classCount++;
+        classes[order[i]] = uint32_t(classCount - 1);
+    }
+    //Every rotation holds the marker once, so sorted rotations are sorted suffixes
+    refineRotationOrder(order, classes, classCount);
+    return order;
 }
 
-/****************Inverse BWT Functions*********************/
+//A place to start an inverse BWT walk: the row of the rotation starting at a text position
+struct BWTEntryPoint {
+    uint32_t position;
+    uint32_t row;
+};
 
-//Inverse BWT function, takes BWTransformed data and decodes it
-std::string invertFunc(const std::string &bwtData) {
+//An entry point per 128 KiB, up to 15: sixteen walks are enough to keep the memory busy
+const size_t bwtEntrySpacing = 128 * 1024;
+const size_t bwtMaxEntryPoints = 15;
 
-    //std::cout << std::endl << "BWT'd text: " << bwtData;
-    int dataLength = bwtData.length();
+//Entry points forwardBWTBlock samples for a block; they split it into equal parts
+size_t bwtEntryPointCount(size_t size) {
+    return std::min(bwtMaxEntryPoints, size / bwtEntrySpacing);
+}
 
-    //'Decodes' the BWT data by traversing the table and sorting
-    std::vector<std::string> table(dataLength);
-    for (int i = 0; i < dataLength; i++) {
-        for (int j = 0; j < dataLength; j++) {
-            table[j] = bwtData[j] + table[j];
+/*
+* Forward BWT Block
+* BWT of one block without sentinel characters; writes the last column to
+* 'out' and returns the row holding the original block (primary index).
+* Rows of evenly spaced positions are added to entryPoints, if given, so the
+* inverse can walk several parts of the block at once.
+*/
+uint32_t forwardBWTBlock(const unsigned char *data, size_t size, unsigned char *out,
+        std::vector<BWTEntryPoint> *entryPoints = nullptr) {
+    StageScope scope("forwardBWTBlock", size);
+    scope.addBytesOut(size);
+    std::vector<uint32_t> order = sortRotations(data, size);
+    size_t spacing = 0;
+    if (entryPoints != nullptr) {
+        entryPoints->clear();
+        size_t count = bwtEntryPointCount(size);
+        spacing = count == 0 ? 0 : size / (count + 1);
+        entryPoints->resize(count);
+    }
+    uint32_t primary = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint32_t position = order[i];
+        if (position == 0) {
+            primary = uint32_t(i);
+            out[i] = data[size - 1];
+        } else {
+            out[i] = data[position - 1];
+            if (spacing != 0 && position % spacing == 0 && position / spacing <= entryPoints->size()) {
+                (*entryPoints)[position / spacing - 1] = BWTEntryPoint{position, uint32_t(i)};
+            }
         }
-        std::sort(table.begin(), table.end());
     }
-    for (auto &row : table) {
-        //Takes the 'tagging' chars away from the string
-        if (row[row.length() - 1] == END) {
-            return row.substr(1, row.length() - 2);
+    return primary;
+}
+
+/*
+* Walk LF Chains
+* Walks every chain back from its start position to the previous chain's,
+* over packed LF entries (row above the low 8 bits, last-column byte in
+* them), a few chains at a time so their cache misses overlap instead of
+* following one another
+*/
+template <class Entry>
+void walkLFChains(const std::vector<Entry> &lastToFirst, const std::vector<BWTEntryPoint> &starts,
+        unsigned char *out) {
+    const size_t interleave = 8;
+    for (size_t group = 0; group < starts.size(); group += interleave) {
+        size_t count = std::min(interleave, starts.size() - group);
+        Entry rows[interleave];
+        size_t positions[interleave], ends[interleave];
+        size_t shortest = SIZE_MAX;
+        for (size_t k = 0; k < count; k++) {
+            rows[k] = starts[group + k].row;
+            positions[k] = starts[group + k].position;
+            ends[k] = group + k == 0 ? 0 : starts[group + k - 1].position;
+            shortest = std::min(shortest, positions[k] - ends[k]);
+        }
+        //Every chain of the group steps together while all have bytes left
+        for (size_t step = 0; step < shortest; step++) {
+            for (size_t k = 0; k < count; k++) {
+                Entry entry = lastToFirst[rows[k]];
+                out[--positions[k]] = (unsigned char)entry;
+                rows[k] = entry >> 8;
+            }
+        }
+        for (size_t k = 0; k < count; k++) {
+            while (positions[k] > ends[k]) {
+                Entry entry = lastToFirst[rows[k]];
+                out[--positions[k]] = (unsigned char)entry;
+                rows[k] = entry >> 8;
+            }
         }
     }
-    return NULL;
 }
 
-void inverseBWT(std::istream &is, std::ostream &os) {
+template <class Entry>
+void inverseBWTChains(const unsigned char *bwt, size_t size, const std::vector<BWTEntryPoint> &starts,
+        unsigned char *out) {
+    size_t firstRow[256] = {0};
+    for (size_t i = 0; i < size; i++) firstRow[bwt[i]]++;
+    size_t total = 0;
+    for (int c = 0; c < 256; c++) {
+        size_t occurrences = firstRow[c];
+        firstRow[c] = total;
+        total += occurrences;
+    }
+    std::vector<Entry> lastToFirst(size);
+    for (size_t i = 0; i < size; i++) {
+        lastToFirst[i] = (Entry(firstRow[bwt[i]]++) << 8) | bwt[i];
+    }
+    walkLFChains(lastToFirst, starts, out);
+}
+
+/*
+* Inverse BWT Block
+* Rebuilds a block from its last column and primary index by walking the
+* LF mapping (last to first column) backwards from the primary row, and from
+* every entry point, each walk ending where the previous one started
+*/
+void inverseBWTBlock(const unsigned char *bwt, size_t size, uint32_t primary, unsigned char *out,
+        const std::vector<BWTEntryPoint> &entryPoints = std::vector<BWTEntryPoint>()) {
+    StageScope scope("inverseBWTBlock", size);
+    scope.addBytesOut(size);
+    if (size == 0) {
+        return;
+    }
+    if (primary >= size) {
+        throw std::runtime_error("invalid BWT primary index");
+    }
+    //The primary row starts the walk back from the end of the block
+    std::vector<BWTEntryPoint> starts(entryPoints);
+    starts.push_back(BWTEntryPoint{uint32_t(size), primary});
+    for (size_t k = 0; k + 1 < starts.size(); k++) {
+        if (starts[k].position == 0 || starts[k].position >= starts[k + 1].position || starts[k].row >= size) {
+            throw std::runtime_error("invalid BWT entry points");
+        }
+    }
+    //Rows and bytes share one word, so each step is one random access
+    if (size < (size_t(1) << 24)) {
+        inverseBWTChains<uint32_t>(bwt, size, starts, out);
+    } else {
+        inverseBWTChains<uint64_t>(bwt, size, starts, out);
+    }
+}
+
+/****************Whole Input BWT Functions*********************/
+
+/*
+* Forward BWT
+* BW Transformation of the data framed by START and END, straight from
+* memory (e.g. a mapped file). The rotations are sorted by index with
+* sortRotations, so the only copy is the framed input.
+*/
+std::string forwardBWT(const unsigned char *data, size_t size) {
+    StageScope scope("forwardBWT", size);
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == START || data[i] == END) {
+            std::cout << "Input data cannot contain '^' or '|' chars." << std::endl;
+            break;
+        }
+    }
+
+    //Frame the data with the start and end markers
+    std::vector<unsigned char> temp(size + 2);
+    temp[0] = START;
+    if (size != 0) {
+        std::memcpy(temp.data() + 1, data, size);
+    }
+    temp[size + 1] = END;
+
+    //Last character of every rotation, in sorted order
+    std::vector<uint32_t> order = sortRotations(temp.data(), temp.size());
+    std::string returnString(temp.size(), '\0');
+    for (size_t i = 0; i < temp.size(); i++) {
+        returnString[i] = char(temp[(order[i] + temp.size() - 1) % temp.size()]);
+    }
+    scope.addBytesOut(returnString.size());
+    return returnString;
+}
+
+//Forward BWT- BW Transformation to data
+std::string forwardBWT(std::istream &is) {
     //Gets input data string
-    char ch;
-    std::string r;
-    while(is.get(ch)) {
-        r.push_back(ch);
+    std::string data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    return forwardBWT(reinterpret_cast<const unsigned char *>(data.data()), data.size());
+}
+
+/*
+* Inverse BWT
+* Undoes forwardBWT from memory. The framed data is the row starting with
+* START, which comes right after the rows starting with smaller bytes.
+*/
+std::string inverseBWT(const unsigned char *bwt, size_t size) {
+    StageScope scope("inverseBWT", size);
+    uint32_t primary = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (bwt[i] < START) {
+            primary++;
+        }
+    }
+    std::vector<unsigned char> framed(size);
+    inverseBWTBlock(bwt, size, primary, framed.data());
+    //Takes the 'tagging' chars away from the string
+    if (size < 2 || framed[0] != START || framed[size - 1] != END) {
+        throw std::runtime_error("invalid BWT data");
     }
+    scope.addBytesOut(size - 2);
+    return std::string(framed.begin() + 1, framed.end() - 1);
+}
+
+//Inverse BWT function, takes BWTransformed data and decodes it
+std::string invertFunc(const std::string &bwtData) {
+    return inverseBWT(reinterpret_cast<const unsigned char *>(bwtData.data()), bwtData.size());
+}
+
+void inverseBWT(std::istream &is, std::ostream &os) {
+    //Gets input data string
+    std::string r((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
     
     //Gets the inverted BWT data
-    std::string inversedBWTString = invertFunc(r);
-    //std::cout << std::endl << "Inverted BWT text: " << inversedBWTString << std::endl << std::endl;
-    os << inversedBWTString;
+    os << invertFunc(r);
 }
 
 #endif //BW_TRANSFORM_HPP
\ No newline at end of file
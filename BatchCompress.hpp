@@ -0,0 +1,336 @@
+#ifndef BATCH_COMPRESS_HPP
+#define BATCH_COMPRESS_HPP
+
+/*
+BatchCompress:
+Compresses many files in one process, each into its own container, with all
+of them sharing one work-stealing thread pool. Files of at least a block are
+compressed one per task, their blocks spread over the pool as usual; smaller
+files are grouped into tasks of about a block's worth of bytes, so thousands
+of tiny files cost a few hundred tasks rather than thousands, and each group
+sets its codec stages up once. Largest work is queued first so the long
+files do not start last.
+----------------------------------------------------------
+listBatchFiles:  paths -> regular files, walking directories
+containerChain:  an algorithm and its parameter -> the chain and block size it runs as
+batchCompress:   compresses every file and records its result
+printBatchReport: one line per file plus totals and throughput
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <future>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include "Container.hpp"
+#include "AsyncIO.hpp"
+#include "ThreadPool.hpp"
+#include "ParallelLZ.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+//One input of a batch and what became of it
+struct BatchFile {
+    std::string name;
+    std::string outputName;
+    uint64_t size = 0;
+    uint64_t compressedSize = 0;
+    double seconds = 0;
+    bool skipped = false;   //Not compressed, but not an error either (e.g. already a container)
+    std::string error;      //Why the file failed or was skipped
+};
+
+/*
+* Add Batch Path
+* Appends the file, or every file below the directory, in name order
+*/
+void addBatchPath(const std::string &path, std::vector<BatchFile> &files) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        BatchFile missing;
+        missing.name = path;
+        missing.error = "not found";
+        files.push_back(missing);
+        return;
+    }
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
+        std::vector<std::string> entries;
+        WIN32_FIND_DATAA entry;
+        HANDLE search = FindFirstFileA((path + "\\*").c_str(), &entry);
+        if (search != INVALID_HANDLE_VALUE) {
+            do {
+                std::string entryName = entry.cFileName;
+                if (entryName != "." && entryName != "..") {
+                    entries.push_back(path + "\\" + entryName);
+                }
+            } while (FindNextFileA(search, &entry));
+            FindClose(search);
+        }
+        std::sort(entries.begin(), entries.end());
+        for (auto &entryPath : entries) {
+            addBatchPath(entryPath, files);
+        }
+        return;
+    }
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data);
+    BatchFile file;
+    file.name = path;
+    file.size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    files.push_back(file);
+#else
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        BatchFile missing;
+        missing.name = path;
+        missing.error = "not found";
+        files.push_back(missing);
+        return;
+    }
+    if (S_ISDIR(status.st_mode)) {
+        std::vector<std::string> entries;
+        if (DIR *directory = opendir(path.c_str())) {
+            while (dirent *entry = readdir(directory)) {
+                std::string entryName = entry->d_name;
+                if (entryName != "." && entryName != "..") {
+                    entries.push_back(path + (path.back() == '/' ? "" : "/") + entryName);
+                }
+            }
+            closedir(directory);
+        }
+        std::sort(entries.begin(), entries.end());
+        for (auto &entryPath : entries) {
+            addBatchPath(entryPath, files);
+        }
+        return;
+    }
+    //Devices, sockets and pipes are left alone
+    if (!S_ISREG(status.st_mode)) {
+        return;
+    }
+    BatchFile file;
+    file.name = path;
+    file.size = uint64_t(status.st_size);
+    files.push_back(file);
+#endif
+}
+
+/*
+* List Batch Files
+* Every regular file named by the paths, directories walked recursively;
+* paths that do not exist are listed with an error
+*/
+std::vector<BatchFile> listBatchFiles(const std::vector<std::string> &paths) {
+    std::vector<BatchFile> files;
+    for (auto &path : paths) {
+        addBatchPath(path, files);
+    }
+    return files;
+}
+
+/*
+* Split Batch Name
+* File name without its extension, and the extension; a dot in a directory
+* name does not count
+*/
+void splitBatchName(const std::string &name, std::string &stem, std::string &extension) {
+    size_t slash = name.find_last_of("/\\");
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        stem = name;
+        extension.clear();
+    } else {
+        stem = name.substr(0, dot);
+        extension = name.substr(dot + 1);
+    }
+}
+
+/*
+* Container Chain
+* The chain and block size an algorithm runs as through the container. The
+* parameter is the block size, except for the algorithms whose parameter
+* means something else on files: DEFLATE:level becomes the DEFLATE#level
+* stage, and PLZ:chunk becomes LZ in blocks of that size, each with its own
+* dictionary as every PLZ chunk has. Algorithms that only work on whole
+* files are refused.
+*/
+void containerChain(const std::string &algorithm, const std::string &param, std::string &chain,
+        std::string &blockParam) {
+    chain = algorithm;
+    blockParam = param;
+    if (algorithm == "DEFLATE" && !param.empty()) {
+        if (param.size() != 1 || param[0] < '0' || param[0] > '9') {
+            throw std::invalid_argument("DEFLATE level must be 0-9, not " + param);
+        }
+        chain = "DEFLATE#" + param;
+        blockParam.clear();
+    } else if (algorithm == "PLZ") {
+        chain = "LZ";
+        blockParam = param.empty() ? std::to_string(defaultLZChunkSize) : param;
+    } else if (algorithm == "TILE") {
+        throw std::invalid_argument("TILE only compresses BMP and PNG files, not streams or other file types");
+    }
+    for (auto &name : chainStageNames(chain)) {
+        if (codecRegistry().find(name) == codecRegistry().end() && name.compare(0, 3, "LZ#") != 0) {
+            throw std::invalid_argument(name + " cannot run through the container; use stages of " +
+                "BWT, MTF, RLE, LZ, HUFF, DEFLATE, LRM, DELTA, or DEFLATE:level or PLZ:chunk");
+        }
+    }
+}
+
+/*
+* Compress Batch Streams
+* Compresses one file into its container through the given stream types and
+* returns the container's size
+*/
+template <class Input, class Output>
+uint64_t compressBatchStreams(const BatchFile &file, const ContainerHeader &header, ThreadPool &pool,
+        ContainerCodecs &codecs) {
+    Input inputFile(file.name, std::ios_base::binary);
+    if (!inputFile.is_open()) {
+        throw std::runtime_error("could not open the file");
+    }
+    Output outputFile(file.outputName, std::ios_base::binary);
+    if (!outputFile.is_open()) {
+        throw std::runtime_error("could not create " + file.outputName);
+    }
+    containerCompress(inputFile, outputFile, header, pool, codecs);
+    uint64_t written = uint64_t(outputFile.tellp());
+    outputFile.close();
+    if (!outputFile) {
+        throw std::runtime_error("could not write " + file.outputName);
+    }
+    return written;
+}
+
+/*
+* Compress Batch File
+* Compresses one file, recording its size, time and any error instead of
+* throwing, so one bad file does not stop the batch
+*/
+void compressBatchFile(BatchFile &file, const ContainerHeader &base, ThreadPool &pool, ContainerCodecs &codecs) {
+    auto start = std::chrono::steady_clock::now();
+    try {
+        ContainerHeader header = base;
+        std::string stem;
+        splitBatchName(file.name, stem, header.extension);
+        header.originalSize = file.size;
+        //Files of one block are read and written directly; the I/O threads only pay off for longer ones
+        if (file.size > base.blockSize) {
+            file.compressedSize = compressBatchStreams<ReadAheadStream, WriteBehindStream>(file, header, pool, codecs);
+        } else {
+            file.compressedSize = compressBatchStreams<std::ifstream, std::ofstream>(file, header, pool, codecs);
+        }
+    }
+    catch (std::exception const &error) {
+        file.error = error.what();
+    }
+    file.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+* Batch Compress
+* Compresses every listed file into file.outputName with the header's chain
+* and block size. Files already carrying an error, and existing containers,
+* are skipped.
+*/
+void batchCompress(std::vector<BatchFile> &files, const ContainerHeader &base, ThreadPool &pool) {
+    checkContainerBlockSize(base);
+    std::vector<size_t> order;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!files[i].error.empty()) {
+            continue;
+        }
+        if (isContainer(files[i].name)) {
+            files[i].skipped = true;
+            files[i].error = "already a container";
+            continue;
+        }
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return files[a].size > files[b].size;
+    });
+
+    //Large files alone, small ones in groups of about one block
+    std::vector<std::vector<size_t>> units;
+    uint64_t groupBytes = 0;
+    bool grouping = false;
+    for (size_t i : order) {
+        if (files[i].size >= base.blockSize) {
+            units.push_back(std::vector<size_t>(1, i));
+            continue;
+        }
+        if (!grouping || groupBytes >= base.blockSize) {
+            units.push_back(std::vector<size_t>());
+            groupBytes = 0;
+            grouping = true;
+        }
+        units.back().push_back(i);
+        groupBytes += files[i].size;
+    }
+
+    std::vector<std::future<void>> pending;
+    for (auto &unit : units) {
+        pending.push_back(pool.submit([&files, &base, &pool, unit] {
+            ContainerCodecs codecs;
+            for (size_t i : unit) {
+                compressBatchFile(files[i], base, pool, codecs);
+            }
+        }));
+    }
+    //The caller runs queued tasks while it waits
+    for (auto &task : pending) {
+        pool.waitFor(task);
+    }
+    for (auto &task : pending) {
+        task.get();
+    }
+}
+
+/*
+* Print Batch Report
+* One line per file, then the totals over the files that were compressed
+* and the throughput over the whole run
+*/
+void printBatchReport(const std::vector<BatchFile> &files, double seconds, std::ostream &os) {
+    uint64_t totalIn = 0, totalOut = 0;
+    size_t compressed = 0, failed = 0;
+    for (auto &file : files) {
+        os << std::left << std::setw(40) << file.name << " " << std::right;
+        if (!file.error.empty()) {
+            os << (file.skipped ? "  skipped: " : "  failed: ") << file.error << std::endl;
+            failed += file.skipped ? 0 : 1;
+            continue;
+        }
+        compressed++;
+        totalIn += file.size;
+        totalOut += file.compressedSize;
+        os << std::setw(14) << file.size << " -> " << std::setw(12) << file.compressedSize << std::fixed <<
+            std::setprecision(1) << std::setw(8) << (file.size ? 100.0 * file.compressedSize / file.size : 0) <<
+            "%" << std::setprecision(2) << std::setw(11) << file.seconds * 1e3 << " ms" << std::endl;
+    }
+    os << std::endl << compressed << " files compressed, " << failed << " failed: " << totalIn << " -> " <<
+        totalOut << " bytes" << std::fixed << std::setprecision(1) << " (" <<
+        (totalIn ? 100.0 * totalOut / totalIn : 0) << "%) in " << std::setprecision(3) << seconds << " s, " <<
+        std::setprecision(2) << (seconds > 0 ? totalIn / seconds / 1e6 : 0) << " MB/s" << std::endl;
+}
+
+#endif //BATCH_COMPRESS_HPP
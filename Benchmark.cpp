@@ -0,0 +1,569 @@
+/*
+Benchmark:
+Runs every codec and pipeline over a corpus directory and generated data,
+verifies each round trip and reports compress and decompress throughput,
+ratio and peak memory, as a table and as JSON.
+Build with "g++ -std=c++11 -O2 -pthread Benchmark.cpp -o bench"; add
+-DARB_TRACK_ALLOCATIONS to also report allocations, bytes allocated and peak
+heap per codec and per stage (see StageStats.hpp).
+----------------------------------------------------------
+Usage: bench [corpus directory] [-r repeats] [-j json file] [-c codec]...
+    The corpus defaults to "Test Files/", repeats to 3 and the JSON file to
+    "bench_results.json". Each -c adds a codec by name ('legacy LZ', 'PLZ',
+    'gzip' or any pipeline chain such as 'BWT,MTF,HUFF', which 'staged ' in
+    front runs with a thread per stage, or 'archive ' in front through a dedup
+    archive as -archive does); without -c every built-in codec runs.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
+#include "RLE_Algorithms.hpp"
+#include "LZ_Algorithms.hpp"
+#include "ParallelLZ.hpp"
+#include "Deflate_Algo.hpp"
+#include "Container.hpp"
+#include "AutoCodec.hpp"
+#include "DedupArchive.hpp"
+#include "MappedFile.hpp"
+
+typedef std::vector<unsigned char> Bytes;
+
+//A named input, read from the corpus or generated
+struct BenchInput {
+    std::string name;
+    Bytes data;
+};
+
+//A codec as the benchmark sees it: whole input in, whole output out
+struct BenchCodec {
+    std::string name;
+    std::function<void(const Bytes &, Bytes &)> compress;
+    std::function<void(const Bytes &, Bytes &)> decompress;
+};
+
+struct BenchResult {
+    std::string input;
+    std::string codec;
+    size_t inputSize = 0;
+    size_t compressedSize = 0;
+    double compressSeconds = 0;   //Best of the repeats
+    double decompressSeconds = 0;
+    double peakMegabytes = 0;     //Resident memory high-water mark of the runs
+    uint64_t allocations = 0;     //Per round trip, with ARB_TRACK_ALLOCATIONS
+    uint64_t allocatedBytes = 0;
+    uint64_t peakHeapBytes = 0;   //Live heap high-water mark above the start
+    std::vector<StageSnapshot> stages;
+    bool verified = false;
+    std::string error;
+};
+
+/* Peak memory */
+
+//Resets the resident-memory high-water mark where the system allows it
+void resetPeakMemory() {
+#if defined(__linux__)
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+#endif
+}
+
+//Resident-memory high-water mark in MB, 0 where it is not available
+double peakMemoryMegabytes() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atof(line.c_str() + 6) / 1024.0;
+        }
+    }
+#endif
+#if !defined(_WIN32)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+        return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+        return usage.ru_maxrss / 1024.0;
+#endif
+    }
+#endif
+    return 0;
+}
+
+/* Inputs */
+
+/*
+* Read Corpus
+* Every regular file directly inside the directory, in name order
+*/
+std::vector<BenchInput> readCorpus(const std::string &directory) {
+    std::vector<BenchInput> inputs;
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE search = FindFirstFileA((directory + "\\*").c_str(), &entry);
+    if (search == INVALID_HANDLE_VALUE) {
+        std::cout << "Could not open the corpus directory " << directory << std::endl;
+        return inputs;
+    }
+    do {
+        if (!(entry.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE))) {
+            names.push_back(entry.cFileName);
+        }
+    } while (FindNextFileA(search, &entry));
+    FindClose(search);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        std::cout << "Could not open the corpus directory " << directory << std::endl;
+        return inputs;
+    }
+    while (dirent *entry = readdir(dir)) {
+        std::string path = directory + "/" + entry->d_name;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+#endif
+    std::sort(names.begin(), names.end());
+
+    for (auto &name : names) {
+        MappedFile file(directory + "/" + name);
+        inputs.push_back(BenchInput{name, Bytes(file.data(), file.data() + file.size())});
+    }
+    return inputs;
+}
+
+/*
+* Synthetic Inputs
+* Data with known character: incompressible, trivially compressible, text
+* and a smooth image, 1 MiB each
+*/
+std::vector<BenchInput> syntheticInputs() {
+    const size_t size = 1 << 20;
+    std::vector<BenchInput> inputs;
+
+    //Xorshift, so every run benchmarks the same bytes
+    Bytes random(size);
+    uint32_t state = 2463534242u;
+    for (auto &byte : random) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = (unsigned char)state;
+    }
+    inputs.push_back(BenchInput{"synthetic random", random});
+
+    inputs.push_back(BenchInput{"synthetic zeros", Bytes(size, 0)});
+
+    const char *words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "compression",
+        "algorithm", "block", "stream", "image", "of", "and", "a", "to", "in", "data", "is"};
+    std::string text;
+    for (size_t i = 0; text.size() < size; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        text += words[state % 20];
+        text += (i % 12 == 11) ? ".\n" : " ";
+    }
+    text.resize(size);
+    inputs.push_back(BenchInput{"synthetic text", Bytes(text.begin(), text.end())});
+
+    //24 bpp pixels of a diagonal gradient
+    const size_t width = 512;
+    Bytes gradient;
+    gradient.reserve(size);
+    for (size_t y = 0; gradient.size() + width * 3 <= size; y++) {
+        for (size_t x = 0; x < width; x++) {
+            gradient.push_back((unsigned char)(x / 2));
+            gradient.push_back((unsigned char)(y / 2));
+            gradient.push_back((unsigned char)((x + y) / 4));
+        }
+    }
+    inputs.push_back(BenchInput{"synthetic gradient", gradient});
+    return inputs;
+}
+
+/* Codecs */
+
+/*
+* Chain Codec
+* A pipeline chain run through the container, in memory, with blocks in
+* parallel or (staged) with a thread per stage
+*/
+BenchCodec chainCodec(const std::string &chain, ThreadPool &pool, bool staged = false) {
+    BenchCodec codec;
+    codec.name = staged ? "staged " + chain : chain;
+    codec.compress = [chain, staged, &pool](const Bytes &in, Bytes &out) {
+        ContainerHeader header;
+        header.chain = chain;
+        header.blockSize = uint32_t(defaultBlockSize);
+        header.originalSize = in.size();
+        std::stringstream input(std::string(in.begin(), in.end()));
+        std::stringstream output;
+        if (staged) {
+            containerCompressStaged(input, output, header);
+        } else {
+            containerCompress(input, output, header, pool);
+        }
+        std::string result = output.str();
+        out.assign(result.begin(), result.end());
+    };
+    codec.decompress = [&pool](const Bytes &in, Bytes &out) {
+        std::stringstream input(std::string(in.begin(), in.end()));
+        std::stringstream output;
+        containerDecompress(input, output, readContainer(input), pool);
+        std::string result = output.str();
+        out.assign(result.begin(), result.end());
+    };
+    return codec;
+}
+
+/*
+* Archive Codec
+* The input as the one file of a dedup archive, with the algorithm and its
+* parameter mapped by containerChain as -archive maps them, so DEFLATE:9 is
+* level 9 and not 9-byte blocks. Archives read files, so the input goes
+* through a temporary file and comes back through an extracted one. An
+* archive more than 1% plus 4 KiB larger than its input fails the run: a
+* stored block costs 33 bytes of framing, so that holds for blocks of 4 KiB
+* and up, while a parameter taken for a tiny block size breaks it.
+*/
+BenchCodec archiveCodec(const std::string &algorithmArgument, ThreadPool &pool) {
+    std::string algorithm = algorithmArgument, param, chain, blockParam;
+    size_t paramIndex = algorithm.find(':');
+    if (paramIndex != std::string::npos) {
+        param = algorithm.substr(paramIndex + 1);
+        algorithm.resize(paramIndex);
+    }
+    containerChain(algorithm, param, chain, blockParam); //Throws std::invalid_argument for unknown stages
+    ContainerHeader header;
+    header.chain = chain;
+    size_t blockSize = blockParam.empty() ? defaultBlockSize : parseByteSize(blockParam);
+    if (blockSize == 0 || blockSize > 0xFFFFFFFFu) {
+        throw std::invalid_argument("invalid block size " + blockParam);
+    }
+    header.blockSize = uint32_t(blockSize);
+
+    const std::string inputName = "bench_archive.tmp", outputDirectory = "bench_archive_extracted";
+    BenchCodec codec;
+    codec.name = "archive " + algorithmArgument;
+    codec.compress = [header, inputName, &pool](const Bytes &in, Bytes &out) {
+        std::ofstream inputFile(inputName, std::ios::binary | std::ios::trunc);
+        inputFile.write(reinterpret_cast<const char *>(in.data()), std::streamsize(in.size()));
+        inputFile.close();
+        if (!inputFile) {
+            throw std::runtime_error("could not write " + inputName);
+        }
+        std::vector<BatchFile> files = listBatchFiles({inputName});
+        std::stringstream output;
+        dedupArchiveCompress(files, output, header, pool);
+        std::remove(inputName.c_str());
+        if (!files[0].error.empty()) {
+            throw std::runtime_error(files[0].error);
+        }
+        std::string result = output.str();
+        out.assign(result.begin(), result.end());
+        if (out.size() > in.size() + in.size() / 100 + 4096) {
+            throw std::runtime_error("archive is " + std::to_string(out.size() - in.size()) +
+                " bytes larger than its input");
+        }
+    };
+    codec.decompress = [outputDirectory](const Bytes &in, Bytes &out) {
+        std::stringstream input(std::string(in.begin(), in.end()));
+        std::vector<std::string> written = dedupArchiveExtract(input, outputDirectory);
+        if (written.size() != 1) {
+            throw std::runtime_error("archive holds " + std::to_string(written.size()) + " files, not 1");
+        }
+        std::ifstream extracted(written[0], std::ios::binary);
+        out.assign(std::istreambuf_iterator<char>(extracted), std::istreambuf_iterator<char>());
+        extracted.close();
+        std::remove(written[0].c_str());
+        std::remove(outputDirectory.c_str());
+    };
+    return codec;
+}
+
+//Codecs run when none are named
+std::vector<std::string> defaultCodecNames() {
+    return {"legacy LZ", "PLZ", "gzip", "RLE", "LZ", "HUFF", "DEFLATE", "LZ,HUFF",
+        "BWT,MTF,HUFF", "BWT,MTF,RLE,HUFF", "staged BWT,MTF,RLE,HUFF", "AUTO", "archive DEFLATE:9"};
+}
+
+BenchCodec makeBenchCodec(const std::string &name, ThreadPool &pool) {
+    BenchCodec codec;
+    codec.name = name;
+    if (name == "legacy LZ") {
+        //The original stream interface, as the CLI runs it
+        codec.compress = [](const Bytes &in, Bytes &out) {
+            std::stringstream input(std::string(in.begin(), in.end()));
+            std::stringstream output;
+            lzCompress(input, output);
+            std::string result = output.str();
+            out.assign(result.begin(), result.end());
+        };
+        codec.decompress = [](const Bytes &in, Bytes &out) {
+            std::stringstream input(std::string(in.begin(), in.end()));
+            std::stringstream output;
+            lzDecompress(input, output);
+            std::string result = output.str();
+            out.assign(result.begin(), result.end());
+        };
+    } else if (name == "PLZ") {
+        codec.compress = [&pool](const Bytes &in, Bytes &out) {
+            std::stringstream output;
+            parallelLZCompress(in.data(), in.size(), output, pool);
+            std::string result = output.str();
+            out.assign(result.begin(), result.end());
+        };
+        codec.decompress = [&pool](const Bytes &in, Bytes &out) {
+            std::stringstream output;
+            parallelLZDecompress(in.data(), in.size(), output, pool);
+            std::string result = output.str();
+            out.assign(result.begin(), result.end());
+        };
+    } else if (name == "gzip") {
+        codec.compress = [](const Bytes &in, Bytes &out) {
+            gzipCompress(in.data(), in.size(), out);
+        };
+        codec.decompress = [](const Bytes &in, Bytes &out) {
+            gzipDecompress(in.data(), in.size(), out);
+        };
+    } else if (name.compare(0, 8, "archive ") == 0) {
+        codec = archiveCodec(name.substr(8), pool);
+    } else if (name.compare(0, 7, "staged ") == 0) {
+        CodecPipeline check(name.substr(7)); //Throws std::invalid_argument for unknown stages
+        codec = chainCodec(name.substr(7), pool, true);
+    } else {
+        CodecPipeline check(name);
+        codec = chainCodec(name, pool);
+    }
+    return codec;
+}
+
+/* Running */
+
+/*
+* Run Benchmark
+* Compresses and decompresses the input 'repeats' times, keeping the best
+* times, and checks that every round trip gives the input back
+*/
+BenchResult runBenchmark(const BenchInput &input, const BenchCodec &codec, int repeats) {
+    typedef std::chrono::steady_clock Clock;
+    BenchResult result;
+    result.input = input.name;
+    result.codec = codec.name;
+    result.inputSize = input.data.size();
+    result.verified = true;
+
+    resetPeakMemory();
+#if defined(ARB_TRACK_ALLOCATIONS)
+    resetStageStats();
+    resetHeapPeak();
+    const uint64_t allocationsBefore = heapTotals.allocations, bytesBefore = heapTotals.bytes;
+    const int64_t liveBefore = heapTotals.live;
+#endif
+    try {
+        for (int r = 0; r < repeats; r++) {
+            Bytes compressed, decompressed;
+            Clock::time_point start = Clock::now();
+            codec.compress(input.data, compressed);
+            Clock::time_point middle = Clock::now();
+            codec.decompress(compressed, decompressed);
+            Clock::time_point end = Clock::now();
+
+            double compressSeconds = std::chrono::duration<double>(middle - start).count();
+            double decompressSeconds = std::chrono::duration<double>(end - middle).count();
+            if (r == 0 || compressSeconds < result.compressSeconds) result.compressSeconds = compressSeconds;
+            if (r == 0 || decompressSeconds < result.decompressSeconds) result.decompressSeconds = decompressSeconds;
+            result.compressedSize = compressed.size();
+            if (decompressed != input.data) {
+                result.verified = false;
+                result.error = "round trip mismatch";
+                break;
+            }
+        }
+    }
+    catch (std::exception const &error) {
+        result.verified = false;
+        result.error = error.what();
+    }
+    result.peakMegabytes = peakMemoryMegabytes();
+#if defined(ARB_TRACK_ALLOCATIONS)
+    result.allocations = (heapTotals.allocations - allocationsBefore) / repeats;
+    result.allocatedBytes = (heapTotals.bytes - bytesBefore) / repeats;
+    result.peakHeapBytes = uint64_t(std::max<int64_t>(heapTotals.peak - liveBefore, 0));
+    result.stages = stageStatsSnapshot();
+#endif
+    return result;
+}
+
+double megabytesPerSecond(size_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+double compressionRatio(const BenchResult &result) {
+    return result.compressedSize ? double(result.inputSize) / result.compressedSize : 0;
+}
+
+void printTable(const std::vector<BenchResult> &results) {
+    std::cout << std::left << std::setw(32) << "input" << std::setw(26) << "codec" << std::right <<
+        std::setw(11) << "size" << std::setw(12) << "compressed" << std::setw(9) << "ratio" <<
+        std::setw(10) << "comp MB/s" << std::setw(10) << "dec MB/s" << std::setw(9) << "peak MB";
+#if defined(ARB_TRACK_ALLOCATIONS)
+    std::cout << std::setw(11) << "allocs" << std::setw(9) << "heap MB";
+#endif
+    std::cout << "  check" << std::endl;
+    for (auto &r : results) {
+        std::cout << std::left << std::setw(32) << r.input.substr(0, 31) << std::setw(26) << r.codec.substr(0, 25) <<
+            std::right << std::fixed << std::setprecision(2) <<
+            std::setw(11) << r.inputSize << std::setw(12) << r.compressedSize <<
+            std::setw(9) << compressionRatio(r) <<
+            std::setw(10) << megabytesPerSecond(r.inputSize, r.compressSeconds) <<
+            std::setw(10) << megabytesPerSecond(r.inputSize, r.decompressSeconds) <<
+            std::setw(9) << r.peakMegabytes;
+#if defined(ARB_TRACK_ALLOCATIONS)
+        std::cout << std::setw(11) << r.allocations << std::setw(9) << r.peakHeapBytes / 1e6;
+#endif
+        std::cout << "  " << (r.verified ? "ok" : "FAIL " + r.error) << std::endl;
+    }
+}
+
+std::string jsonString(const std::string &text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void writeJson(const std::vector<BenchResult> &results, int repeats, std::ostream &os) {
+    os << "{\n  \"repeats\": " << repeats << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        os << (i ? "," : "") << "\n    {\"input\": " << jsonString(r.input) << ", \"codec\": " << jsonString(r.codec) <<
+            ", \"size\": " << r.inputSize << ", \"compressed\": " << r.compressedSize <<
+            ", \"ratio\": " << compressionRatio(r) <<
+            ", \"compress_mb_s\": " << megabytesPerSecond(r.inputSize, r.compressSeconds) <<
+            ", \"decompress_mb_s\": " << megabytesPerSecond(r.inputSize, r.decompressSeconds) <<
+            ", \"peak_mb\": " << r.peakMegabytes <<
+            ", \"verified\": " << (r.verified ? "true" : "false") <<
+            ", \"error\": " << jsonString(r.error);
+#if defined(ARB_TRACK_ALLOCATIONS)
+        os << ", \"allocations\": " << r.allocations << ", \"allocated_bytes\": " << r.allocatedBytes <<
+            ", \"peak_heap_bytes\": " << r.peakHeapBytes << ", \"stages\": ";
+        writeStageStatsJson(r.stages, os, "    ");
+#endif
+        os << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+void printBenchInstructions() {
+    std::cout << "Usage: bench [corpus directory] [-r repeats] [-j json file] [-c codec]..." << std::endl <<
+        "    Codecs: 'legacy LZ', 'PLZ', 'gzip' or a pipeline chain such as 'BWT,MTF,HUFF'," << std::endl <<
+        "    optionally as 'staged BWT,MTF,HUFF' to run each stage on its own thread" << std::endl <<
+        "    or as 'archive DEFLATE:9' to go through a dedup archive as -archive does" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::string corpus = "Test Files";
+    std::string jsonFile = "bench_results.json";
+    int repeats = 3;
+    std::vector<std::string> codecNames;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "-r" || arg == "-j" || arg == "-c") && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (arg == "-r") repeats = std::max(1, std::atoi(value.c_str()));
+            else if (arg == "-j") jsonFile = value;
+            else codecNames.push_back(value);
+        } else if (arg[0] != '-') {
+            corpus = arg;
+        } else {
+            printBenchInstructions();
+            return EXIT_FAILURE;
+        }
+    }
+    if (codecNames.empty()) {
+        codecNames = defaultCodecNames();
+    }
+
+#if defined(ARB_TRACK_ALLOCATIONS)
+    stageStatsEnabled() = true;
+#endif
+
+    ThreadPool pool;
+    std::vector<BenchCodec> codecs;
+    try {
+        for (auto &name : codecNames) {
+            codecs.push_back(makeBenchCodec(name, pool));
+        }
+    }
+    catch (std::invalid_argument const &error) {
+        std::cout << error.what() << std::endl;
+        printBenchInstructions();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<BenchInput> inputs = readCorpus(corpus);
+    std::vector<BenchInput> synthetic = syntheticInputs();
+    inputs.insert(inputs.end(), synthetic.begin(), synthetic.end());
+
+    std::vector<BenchResult> results;
+    bool allVerified = true;
+    for (auto &input : inputs) {
+        for (auto &codec : codecs) {
+            results.push_back(runBenchmark(input, codec, repeats));
+            allVerified = allVerified && results.back().verified;
+        }
+    }
+
+    printTable(results);
+    std::ofstream json(jsonFile);
+    writeJson(results, repeats, json);
+    if (!json) {
+        std::cout << "Could not write " << jsonFile << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << std::endl << "Results written to " << jsonFile << std::endl;
+    return allVerified ? EXIT_SUCCESS : EXIT_FAILURE;
+}
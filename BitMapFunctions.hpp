@@ -1,90 +1,298 @@
 #ifndef BITMAPFUNCTIONS_HPP
 #define BITMAPFUNCTIONS_HPP
 
-#include <stdio.h>
+/*
+BitMapFunctions:
+The BMP module shared by every image codec. Input files are memory-mapped and
+their headers validated once; pixels are then exposed as row views straight
+into the mapped file, so loading an image costs no pixel copies.
+Supports uncompressed 8 bpp (palette), 24 bpp and 32 bpp images stored either
+bottom-up (positive height) or top-down (negative height).
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include "MappedFile.hpp"
 
-const int bytesPerPixel = 4; /// red, green, blue
 const int fileHeaderSize = 14;
 const int infoHeaderSize = 40;
 
-void generateBitmapImage(unsigned char *image, int height, int width, int pitch, const char* imageFileName);
-unsigned char* createBitmapFileHeader(int height, int width, int pitch, int paddingSize);
-unsigned char* createBitmapInfoHeader(int height, int width);
+/*
+* ImageView
+* Read-only window over decoded pixel rows. Row 0 is always the top of the
+* image; for bottom-up files the stride is negative. Pixels are in BMP channel
+* order: palette index (1 byte), BGR (3 bytes) or BGRA (4 bytes).
+*/
+struct ImageView {
+    const unsigned char *base = nullptr; //Top row of the image
+    long long stride = 0; //Bytes from one row to the next
+    int width = 0;
+    int height = 0;
+    int bytesPerPixel = 0;
+    const unsigned char *palette = nullptr; //BGRA entries, 8 bpp only
+    int paletteSize = 0;
+
+    const unsigned char *row(int y) const {
+        return base + stride * y;
+    }
+};
+
+/*
+* PixelBuffer
+* Owned, top-down pixel storage for images that are produced in memory
+* (quantized output, decoded PNGs, decoded tiles).
+*/
+struct PixelBuffer {
+    int width = 0;
+    int height = 0;
+    int bytesPerPixel = 0;
+    std::vector<unsigned char> pixels;
+    std::vector<unsigned char> palette; //BGRA entries, 8 bpp only
+
+    PixelBuffer() {}
+    PixelBuffer(int width_p, int height_p, int bytesPerPixel_p)
+        : width(width_p), height(height_p), bytesPerPixel(bytesPerPixel_p),
+          pixels(static_cast<size_t>(width_p) * height_p * bytesPerPixel_p) {}
+
+    unsigned char *row(int y) {
+        return pixels.data() + static_cast<size_t>(y) * width * bytesPerPixel;
+    }
+
+    ImageView view() const {
+        ImageView v;
+        v.base = pixels.data();
+        v.stride = static_cast<long long>(width) * bytesPerPixel;
+        v.width = width;
+        v.height = height;
+        v.bytesPerPixel = bytesPerPixel;
+        if (!palette.empty()) {
+            v.palette = palette.data();
+            v.paletteSize = static_cast<int>(palette.size() / 4);
+        }
+        return v;
+    }
+};
+
+//Parsed and validated BMP headers
+struct BmpInfo {
+    uint32_t dataOffset = 0; //Start of the pixel array
+    uint32_t headerSize = 0; //Size of the info header
+    int width = 0;
+    int height = 0; //Always positive, see topDown
+    int bitsPerPixel = 0;
+    bool topDown = false;
+    uint32_t rowSize = 0; //Bytes per stored row, including padding
+    uint32_t paletteOffset = 0;
+    int paletteSize = 0;
+};
+
+//Little-endian reads that do not depend on host alignment or byte order
+uint32_t bmpReadLE32(const unsigned char *p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
 
-void generateBitmapImage(unsigned char *image, int height, int width, int pitch, const char* imageFileName) {
+uint16_t bmpReadLE16(const unsigned char *p) {
+    return uint16_t(p[0] | (p[1] << 8));
+}
 
-    pitch = width * bytesPerPixel;
-    unsigned char padding[3] = { 0, 0, 0 };
-    int paddingSize = (4 - (/*width*bytesPerPixel*/ pitch) % 4) % 4;
+void bmpWriteLE32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)(value);
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
 
-    unsigned char* fileHeader = createBitmapFileHeader(height, width, pitch, paddingSize);
-    unsigned char* infoHeader = createBitmapInfoHeader(height, width);
+/*
+* Parse BMP Header
+* Validates the file and info headers of an in-memory BMP, throws on
+* anything this module cannot read without conversion. Pass checkPixelData as
+* false when only the headers are in memory.
+*/
+BmpInfo parseBmpHeader(const unsigned char *data, size_t size, bool checkPixelData = true) {
+    if (size < size_t(fileHeaderSize + infoHeaderSize) || data[0] != 'B' || data[1] != 'M') {
+        throw std::runtime_error("not a BMP file");
+    }
 
-    FILE* imageFile = fopen(imageFileName, "wb");
+    BmpInfo info;
+    info.dataOffset = bmpReadLE32(data + 10);
+    info.headerSize = bmpReadLE32(data + 14);
+    int32_t width = static_cast<int32_t>(bmpReadLE32(data + 18));
+    int32_t height = static_cast<int32_t>(bmpReadLE32(data + 22));
+    uint16_t planes = bmpReadLE16(data + 26);
+    info.bitsPerPixel = bmpReadLE16(data + 28);
+    uint32_t compression = bmpReadLE32(data + 30);
+    uint32_t colorsUsed = bmpReadLE32(data + 46);
 
-    fwrite(fileHeader, 1, fileHeaderSize, imageFile);
-    fwrite(infoHeader, 1, infoHeaderSize, imageFile);
+    if (info.headerSize < uint32_t(infoHeaderSize) || fileHeaderSize + uint64_t(info.headerSize) > size) {
+        throw std::runtime_error("unsupported BMP info header");
+    }
+    if (planes != 1 || width <= 0 || height == 0 || height == INT32_MIN) {
+        throw std::runtime_error("invalid BMP dimensions");
+    }
+    if (info.bitsPerPixel != 8 && info.bitsPerPixel != 24 && info.bitsPerPixel != 32) {
+        throw std::runtime_error("unsupported BMP bit depth");
+    }
+
+    //Only uncompressed data, or 32 bpp bitfields laid out as plain BGRA
+    if (compression == 3 && info.bitsPerPixel == 32) {
+        if (size < 66 || bmpReadLE32(data + 54) != 0x00FF0000u ||
+            bmpReadLE32(data + 58) != 0x0000FF00u || bmpReadLE32(data + 62) != 0x000000FFu) {
+            throw std::runtime_error("unsupported BMP channel masks");
+        }
+    } else if (compression != 0) {
+        throw std::runtime_error("compressed BMP files are not supported");
+    }
+
+    info.width = width;
+    info.topDown = height < 0;
+    info.height = info.topDown ? -height : height;
+    //Sizes are worked out in 64 bits and checked before anything is narrowed, so no width wraps them
+    uint64_t rowSize = ((uint64_t(width) * info.bitsPerPixel + 31) / 32) * 4;
+    if (rowSize > UINT32_MAX || rowSize > UINT64_MAX / uint64_t(info.height)) {
+        throw std::runtime_error("invalid BMP dimensions");
+    }
+    info.rowSize = static_cast<uint32_t>(rowSize);
 
-    int i;
-    for (i = height; i >= 0 ; i--) {
-        fwrite(image + (i * pitch /*width*bytesPerPixel*/), bytesPerPixel, width, imageFile);
-        fwrite(padding, 1, paddingSize, imageFile);
+    uint64_t pixelBytes = checkPixelData ? rowSize * uint64_t(info.height) : 0;
+    if (info.dataOffset > size || pixelBytes > size - info.dataOffset) {
+        throw std::runtime_error("BMP pixel data is truncated");
     }
 
-    fclose(imageFile);
-    //free(fileHeader);
-    //free(infoHeader);
+    if (info.bitsPerPixel == 8) {
+        info.paletteOffset = fileHeaderSize + info.headerSize;
+        info.paletteSize = (colorsUsed == 0 || colorsUsed > 256) ? 256 : static_cast<int>(colorsUsed);
+        if (info.paletteOffset + uint64_t(info.paletteSize) * 4 > info.dataOffset) {
+            throw std::runtime_error("BMP palette is truncated");
+        }
+    }
+    return info;
+}
+
+/*
+* BMP View
+* Builds a top-down row view over the pixel array of a parsed BMP
+*/
+ImageView bmpView(const unsigned char *data, const BmpInfo &info) {
+    ImageView view;
+    view.width = info.width;
+    view.height = info.height;
+    view.bytesPerPixel = info.bitsPerPixel / 8;
+    if (info.topDown) {
+        view.base = data + info.dataOffset;
+        view.stride = info.rowSize;
+    } else {
+        view.base = data + info.dataOffset + uint64_t(info.rowSize) * (info.height - 1);
+        view.stride = -static_cast<long long>(info.rowSize);
+    }
+    if (info.bitsPerPixel == 8) {
+        view.palette = data + info.paletteOffset;
+        view.paletteSize = info.paletteSize;
+    }
+    return view;
 }
 
-unsigned char* createBitmapFileHeader(int height, int width, int pitch, int paddingSize) {
-    int fileSize = fileHeaderSize + infoHeaderSize + (/*bytesPerPixel*width*/pitch + paddingSize) * height;
-
-    static unsigned char fileHeader[] = {
-        0,0, /// signature
-        0,0,0,0, /// image file size in bytes
-        0,0,0,0, /// reserved
-        0,0,0,0, /// start of pixel array
-    };
-
-    fileHeader[0] = (unsigned char)('B');
-    fileHeader[1] = (unsigned char)('M');
-    fileHeader[2] = (unsigned char)(fileSize);
-    fileHeader[3] = (unsigned char)(fileSize >> 8);
-    fileHeader[4] = (unsigned char)(fileSize >> 16);
-    fileHeader[5] = (unsigned char)(fileSize >> 24);
-    fileHeader[10] = (unsigned char)(fileHeaderSize + infoHeaderSize);
-
-    return fileHeader;
+/*
+* BmpImage
+* A memory-mapped BMP file with validated headers
+*/
+class BmpImage {
+public:
+    explicit BmpImage(const std::string &fileName) : file(fileName) {
+        bmpInfo = parseBmpHeader(file.data(), file.size());
+        imageView = bmpView(file.data(), bmpInfo);
+    }
+
+    const BmpInfo &info() const { return bmpInfo; }
+    const ImageView &view() const { return imageView; }
+
+    //Raw file bytes, including headers and palette
+    const unsigned char *data() const { return file.data(); }
+    size_t size() const { return file.size(); }
+
+private:
+    MappedFile file;
+    BmpInfo bmpInfo;
+    ImageView imageView;
+};
+
+/*
+* Pixel BGR
+* Reads one pixel of any supported layout as blue, green, red
+*/
+void pixelBGR(const ImageView &view, int x, int y, unsigned char bgr[3]) {
+    const unsigned char *p = view.row(y) + static_cast<size_t>(x) * view.bytesPerPixel;
+    if (view.bytesPerPixel == 1) {
+        int index = (*p < view.paletteSize) ? *p : 0;
+        p = view.palette + index * 4;
+    }
+    bgr[0] = p[0];
+    bgr[1] = p[1];
+    bgr[2] = p[2];
 }
 
-unsigned char* createBitmapInfoHeader(int height, int width) {
-    static unsigned char infoHeader[] = {
-        0,0,0,0, /// header size
-        0,0,0,0, /// image width
-        0,0,0,0, /// image height
-        0,0, /// number of color planes
-        0,0, /// bits per pixel
-        0,0,0,0, /// compression
-        0,0,0,0, /// image size
-        0,0,0,0, /// horizontal resolution
-        0,0,0,0, /// vertical resolution
-        0,0,0,0, /// colors in color table
-        0,0,0,0, /// important color count
-    };
-
-    infoHeader[0] = (unsigned char)(infoHeaderSize);
-    infoHeader[4] = (unsigned char)(width);
-    infoHeader[5] = (unsigned char)(width >> 8);
-    infoHeader[6] = (unsigned char)(width >> 16);
-    infoHeader[7] = (unsigned char)(width >> 24);
-    infoHeader[8] = (unsigned char)(height);
-    infoHeader[9] = (unsigned char)(height >> 8);
-    infoHeader[10] = (unsigned char)(height >> 16);
-    infoHeader[11] = (unsigned char)(height >> 24);
-    infoHeader[12] = (unsigned char)(1);
-    infoHeader[14] = (unsigned char)(bytesPerPixel * 8);
-
-    return infoHeader;
+/*
+* BMP Header For
+* File header, info header and palette of a standard bottom-up BMP that
+* holds the given view
+*/
+std::vector<unsigned char> bmpHeaderFor(const ImageView &view) {
+    int bitsPerPixel = view.bytesPerPixel * 8;
+    uint32_t rowSize = static_cast<uint32_t>(((uint64_t(view.width) * bitsPerPixel + 31) / 32) * 4);
+    uint32_t paletteBytes = (view.bytesPerPixel == 1) ? 256 * 4 : 0;
+    uint32_t dataOffset = fileHeaderSize + infoHeaderSize + paletteBytes;
+    uint32_t imageSize = rowSize * view.height;
+
+    std::vector<unsigned char> header(dataOffset, 0);
+    header[0] = 'B';
+    header[1] = 'M';
+    bmpWriteLE32(&header[2], dataOffset + imageSize); //File size
+    bmpWriteLE32(&header[10], dataOffset); //Start of pixel array
+    bmpWriteLE32(&header[14], infoHeaderSize);
+    bmpWriteLE32(&header[18], view.width);
+    bmpWriteLE32(&header[22], view.height); //Positive height, bottom-up
+    header[26] = 1; //Color planes
+    header[28] = (unsigned char)bitsPerPixel;
+    bmpWriteLE32(&header[34], imageSize);
+    bmpWriteLE32(&header[38], 2835); //72 DPI
+    bmpWriteLE32(&header[42], 2835);
+
+    unsigned char *palette = header.data() + fileHeaderSize + infoHeaderSize;
+    for (uint32_t i = 0; i < paletteBytes / 4; i++) {
+        if (int(i) < view.paletteSize) {
+            std::copy(view.palette + i * 4, view.palette + i * 4 + 4, palette + i * 4);
+        } else {
+            palette[i * 4] = palette[i * 4 + 1] = palette[i * 4 + 2] = (unsigned char)i; //Grayscale
+        }
+    }
+    return header;
+}
+
+/*
+* Write BMP
+* Writes any image view as a standard bottom-up BMP, one write per row
+*/
+void writeBMP(std::ostream &imageFile, const ImageView &view) {
+    std::vector<unsigned char> header = bmpHeaderFor(view);
+    imageFile.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+    const char padding[4] = {0, 0, 0, 0};
+    size_t rowBytes = static_cast<size_t>(view.width) * view.bytesPerPixel;
+    size_t rowSize = (rowBytes + 3) & ~size_t(3);
+    for (int y = view.height - 1; y >= 0; y--) {
+        imageFile.write(reinterpret_cast<const char *>(view.row(y)), rowBytes);
+        imageFile.write(padding, rowSize - rowBytes);
+    }
+}
+
+void writeBMP(const std::string &fileName, const ImageView &view) {
+    std::ofstream imageFile(fileName, std::ios::binary | std::ios::trunc);
+    if (!imageFile.is_open()) {
+        throw std::runtime_error("cannot open " + fileName + " for writing");
+    }
+    writeBMP(imageFile, view);
 }
 
-#endif //BITMAPFUNCTIONS_HPP
\ No newline at end of file
+#endif //BITMAPFUNCTIONS_HPP
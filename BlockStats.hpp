@@ -0,0 +1,120 @@
+#ifndef BLOCK_STATS_HPP
+#define BLOCK_STATS_HPP
+
+/*
+BlockStats:
+Cheap statistics of a block, taken from evenly spaced samples so the cost
+stays fixed however large the block is: byte histogram, order-0 entropy,
+average run length, how often 4-byte strings repeat (a stand-in for LZ
+matches) and how much of the block is printable text. Used to pick a codec
+without trial-compressing the block.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+const size_t statsSampleSegments = 16;
+const size_t statsSegmentSize = 4096;
+
+struct BlockStats {
+    uint32_t histogram[256];
+    size_t sampled = 0;         //Bytes the statistics were taken from
+    double entropy = 0;         //Order-0 entropy in bits per byte
+    double averageRun = 0;      //Mean length of runs of one byte
+    double matchFraction = 0;   //Positions whose next 4 bytes occurred before
+    double textFraction = 0;    //Printable ASCII and whitespace
+};
+
+/*
+* Byte Histogram
+* Adds the byte counts of data to counts. Four tables are filled in turn so
+* a run of equal bytes does not make every increment wait on the previous one.
+*/
+void byteHistogram(const unsigned char *data, size_t size, uint32_t counts[256]) {
+    std::vector<uint32_t> partial(4 * 256, 0);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        partial[data[i]]++;
+        partial[256 + data[i + 1]]++;
+        partial[512 + data[i + 2]]++;
+        partial[768 + data[i + 3]]++;
+    }
+    for (; i < size; i++) {
+        partial[data[i]]++;
+    }
+    for (int c = 0; c < 256; c++) {
+        counts[c] += partial[c] + partial[256 + c] + partial[512 + c] + partial[768 + c];
+    }
+}
+
+//Order-0 entropy of a histogram, in bits per byte
+double histogramEntropy(const uint32_t counts[256], size_t total) {
+    if (total == 0) {
+        return 0;
+    }
+    double entropy = 0;
+    for (int c = 0; c < 256; c++) {
+        if (counts[c] != 0) {
+            double p = double(counts[c]) / total;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+/*
+* Sample Block Stats
+* Blocks up to statsSampleSegments * statsSegmentSize bytes are read whole,
+* larger ones through that many evenly spaced segments
+*/
+BlockStats sampleBlockStats(const unsigned char *data, size_t size) {
+    BlockStats stats;
+    std::memset(stats.histogram, 0, sizeof(stats.histogram));
+    if (size == 0) {
+        return stats;
+    }
+
+    size_t segments = 1, segmentSize = size;
+    if (size > statsSampleSegments * statsSegmentSize) {
+        segments = statsSampleSegments;
+        segmentSize = statsSegmentSize;
+    }
+    size_t stride = segments > 1 ? (size - segmentSize) / (segments - 1) : 0;
+
+    //Last position of every hashed 4-byte string
+    const int hashBits = 14;
+    std::vector<const unsigned char *> lastSeen(size_t(1) << hashBits, nullptr);
+    size_t runs = 0, matches = 0, text = 0, positions = 0;
+
+    for (size_t s = 0; s < segments; s++) {
+        const unsigned char *segment = data + s * stride;
+        byteHistogram(segment, segmentSize, stats.histogram);
+        runs++;
+        for (size_t i = 0; i < segmentSize; i++) {
+            if (i > 0 && segment[i] != segment[i - 1]) runs++;
+            if (i + 4 <= segmentSize) {
+                uint32_t word;
+                std::memcpy(&word, segment + i, sizeof(word));
+                uint32_t hash = (word * 2654435761u) >> (32 - hashBits);
+                const unsigned char *candidate = lastSeen[hash];
+                if (candidate != nullptr && std::memcmp(candidate, segment + i, 4) == 0) matches++;
+                lastSeen[hash] = segment + i;
+                positions++;
+            }
+        }
+    }
+    stats.sampled = segments * segmentSize;
+    for (int c = 0; c < 256; c++) {
+        if ((c >= 0x20 && c < 0x7F) || c == '\n' || c == '\r' || c == '\t') text += stats.histogram[c];
+    }
+
+    stats.entropy = histogramEntropy(stats.histogram, stats.sampled);
+    stats.averageRun = double(stats.sampled) / runs;
+    stats.matchFraction = positions ? double(matches) / positions : 0;
+    stats.textFraction = double(text) / stats.sampled;
+    return stats;
+}
+
+#endif //BLOCK_STATS_HPP
@@ -0,0 +1,173 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+/*
+Checksum:
+Checksums used by the container formats. CRC-32 (IEEE 802.3) is the one used
+by gzip and PNG chunks, Adler-32 is the zlib stream trailer, and CRC32C
+(Castagnoli) checks the blocks of .arb containers. All can be computed
+incrementally by passing the previous value back in.
+----------------------------------------------------------
+Both CRCs are computed 8 bytes at a time with slicing-by-8 tables. CRC32C
+uses the SSE4.2 crc32 instruction instead when the processor has it: GCC and
+Clang builds check for it at run time, so the default build needs no -msse4.2.
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define ARB_CRC32C_HARDWARE
+#endif
+
+const uint32_t crc32Polynomial = 0xEDB88320u;    //IEEE, reflected
+const uint32_t crc32cPolynomial = 0x82F63B78u;   //Castagnoli, reflected
+
+/*
+* CRC Tables
+* Slicing-by-8 tables for a reflected polynomial: entries[0] is the usual
+* byte table, entries[k] advances a byte followed by k zero bytes. Kept in
+* function-local statics so they are built once, safely, even when several
+* threads ask for them first.
+*/
+struct CrcTables {
+    uint32_t entries[8][256];
+
+    explicit CrcTables(uint32_t polynomial) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? polynomial ^ (c >> 1) : c >> 1;
+            }
+            entries[0][n] = c;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = entries[k - 1][n];
+                entries[k][n] = (c >> 8) ^ entries[0][c & 0xFF];
+            }
+        }
+    }
+};
+
+const CrcTables &crc32Tables() {
+    static const CrcTables tables(crc32Polynomial);
+    return tables;
+}
+
+const CrcTables &crc32cTables() {
+    static const CrcTables tables(crc32cPolynomial);
+    return tables;
+}
+
+//Advances an inverted crc over data with slicing-by-8
+uint32_t crcSliceBy8(const CrcTables &tables, const unsigned char *data, size_t size, uint32_t crc) {
+    const uint32_t (*t)[256] = tables.entries;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t low = crc ^ (uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 |
+            uint32_t(data[3]) << 24);
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+            t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    for (; size > 0; data++, size--) {
+        crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+//CRC-32 of data, continuing from a previous crc (0 to start)
+uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0) {
+    return ~crcSliceBy8(crc32Tables(), data, size, ~crc);
+}
+
+#ifdef ARB_CRC32C_HARDWARE
+//Advances an inverted CRC32C over data with the SSE4.2 crc32 instruction
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const unsigned char *data, size_t size, uint32_t crc) {
+#if defined(__x86_64__)
+    uint64_t wide = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = uint32_t(wide);
+#endif
+    for (; size >= 4; data += 4, size -= 4) {
+        uint32_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; size > 0; data++, size--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+bool crc32cHardwareAvailable() {
+    static const bool available = __builtin_cpu_supports("sse4.2");
+    return available;
+}
+#endif
+
+//CRC32C of data, continuing from a previous crc (0 to start)
+uint32_t crc32c(const unsigned char *data, size_t size, uint32_t crc = 0) {
+#ifdef ARB_CRC32C_HARDWARE
+    if (crc32cHardwareAvailable()) {
+        return ~crc32cHardware(data, size, ~crc);
+    }
+#endif
+    return ~crcSliceBy8(crc32cTables(), data, size, ~crc);
+}
+
+//Product of two polynomials modulo a reflected CRC polynomial
+uint32_t crcMultiplyModulo(uint32_t a, uint32_t b, uint32_t polynomial) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+        if (a & bit) {
+            product ^= b;
+        }
+        b = (b & 1) ? polynomial ^ (b >> 1) : b >> 1;
+    }
+    return product;
+}
+
+/*
+* CRC32C Combine
+* CRC32C of two pieces of data back to back, from the CRC32C of each and the
+* size of the second, without reading the data again: the first CRC is
+* multiplied by x^(8 * secondSize), built up by squaring
+*/
+uint32_t crc32cCombine(uint32_t first, uint32_t second, uint64_t secondSize) {
+    uint32_t shift = 1u << 31;   //x^0; bit 31 - k holds x^k
+    uint32_t power = 1u << 23;   //x^8, one byte
+    for (; secondSize != 0; secondSize >>= 1) {
+        if (secondSize & 1) {
+            shift = crcMultiplyModulo(power, shift, crc32cPolynomial);
+        }
+        power = crcMultiplyModulo(power, power, crc32cPolynomial);
+    }
+    return crcMultiplyModulo(shift, first, crc32cPolynomial) ^ second;
+}
+
+//Adler-32 of data, continuing from a previous value (1 to start)
+uint32_t adler32(const unsigned char *data, size_t size, uint32_t adler = 1) {
+    const uint32_t base = 65521;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (size > 0) {
+        //5552 is the most bytes that can be summed before b could overflow
+        size_t run = size < 5552 ? size : 5552;
+        size -= run;
+        while (run--) {
+            a += *data++;
+            b += a;
+        }
+        a %= base;
+        b %= base;
+    }
+    return (b << 16) | a;
+}
+
+#endif //CHECKSUM_HPP
@@ -0,0 +1,508 @@
+#ifndef CODEC_PIPELINE_HPP
+#define CODEC_PIPELINE_HPP
+
+/*
+CodecPipeline:
+Every algorithm wrapped as a Codec stage that encodes and decodes one block
+held in memory, a registry that creates stages by name, and a pipeline that
+chains stages from a list such as "BWT,MTF,RLE,HUFF". Files go through the
+pipeline one block at a time (see Container.hpp); stages hand each other
+reused buffers, so no stage needs a whole-file string or an intermediate file.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include "BWTransform.hpp"
+#include "MTF_Transform.hpp"
+#include "RLE_Algorithms.hpp"
+#include "LZ_Algorithms.hpp"
+#include "Huff_Algo.hpp"
+#include "Deflate_Algo.hpp"
+#include "LongRangeMatch.hpp"
+#include "DeltaFilter.hpp"
+
+const size_t defaultBlockSize = 1 << 20;
+
+//Leading byte of a stored block: raw bytes, or the output of the block's codec chain
+const unsigned char storedBlockTag = 0;
+const unsigned char encodedBlockTag = 1;
+
+/*
+* Stored Files
+* The single-file outputs of the legacy paths (bare LZ codes, RLE runs, RLE
+* BMPs) have no header to hold a tag byte, so one that would not shrink its
+* input is written as storedFileMagic followed by the input instead. None of
+* those formats can start with it: LZ starts with a code below 256, RLE runs
+* with a digit, and an RLE BMP with its header length.
+*/
+const char storedFileMagic[4] = {'A', 'R', 'B', 'S'};
+
+void writeStoredFile(const unsigned char *data, size_t size, std::ostream &os) {
+    os.write(storedFileMagic, sizeof(storedFileMagic));
+    os.write(reinterpret_cast<const char *>(data), std::streamsize(size));
+}
+
+bool isStoredFile(const std::string &fileName) {
+    std::ifstream is(fileName, std::ios::binary);
+    char magic[4];
+    return is.read(magic, sizeof(magic)) && std::equal(magic, magic + 4, storedFileMagic);
+}
+
+//Writes the input a stored file holds
+void copyStoredFile(const std::string &fileName, std::ostream &os) {
+    std::ifstream is(fileName, std::ios::binary);
+    is.seekg(sizeof(storedFileMagic));
+    if (is.peek() != std::ifstream::traits_type::eof()) {
+        os << is.rdbuf();
+    }
+    if (!is || !os) {
+        throw std::runtime_error("could not copy the stored file");
+    }
+}
+
+/*
+* LZ Compress Or Store
+* Writes the LZ codes of a whole file, or stores it once the codes grow to
+* its size
+*/
+void lzCompressOrStore(const unsigned char *data, size_t size, std::ostream &os) {
+    std::vector<unsigned char> codes;
+    if (size == 0 || lzCompressBlock(data, size, codes, size - 1)) {
+        os.write(reinterpret_cast<const char *>(codes.data()), std::streamsize(codes.size()));
+    } else {
+        writeStoredFile(data, size, os);
+    }
+}
+
+/*
+* Run Length Encode Or Store
+* Writes the runs of a whole file, or stores it once the runs grow to its size
+*/
+void runLengthEncodeOrStore(const unsigned char *data, size_t size, std::ostream &os) {
+    std::vector<unsigned char> runs;
+    if (size == 0 || runLengthEncodeBlock(data, size, runs, size - 1)) {
+        os.write(reinterpret_cast<const char *>(runs.data()), std::streamsize(runs.size()));
+    } else {
+        writeStoredFile(data, size, os);
+    }
+}
+
+/*
+* Codec
+* One stage of a pipeline. encode and decode append their result to 'out'
+* and throw std::runtime_error on data they cannot decode.
+*/
+class Codec {
+public:
+    virtual ~Codec() {}
+    virtual void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) = 0;
+    virtual void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) = 0;
+
+    /*
+    * Encode Within
+    * Like encode, but returns false if the output passes limit bytes. Stages
+    * that can tell early stop there, leaving partial output in 'out'.
+    */
+    virtual bool encodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) {
+        size_t start = out.size();
+        encode(data, size, out);
+        return out.size() - start <= limit;
+    }
+
+    /*
+    * Decode Within
+    * Like decode, but throws once the output passes limit bytes. Stages
+    * whose output can grow far past their input check as they go, so
+    * corrupt data cannot make them allocate more than that.
+    */
+    virtual void decodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) {
+        size_t start = out.size();
+        decode(data, size, out);
+        if (out.size() - start > limit) {
+            throw std::runtime_error("block decodes past the block size");
+        }
+    }
+};
+
+/* Built-in stages */
+
+//BWT of the block, stored as the primary index followed by the last column.
+//Blocks of 128 KiB or more set the primary index's top bit and put a count
+//and the rows of their entry points in between (the positions split the
+//block evenly, so they are not stored), letting decoding walk several parts
+//of the block at once. Blocks of 2 GiB or more, whose primary index could
+//have the top bit set, are refused.
+const uint32_t bwtEntryPointFlag = 0x80000000u;
+
+class BWTCodec : public Codec {
+public:
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        if (size >= bwtEntryPointFlag) {
+            throw std::invalid_argument("BWT blocks must be smaller than 2 GiB");
+        }
+        size_t outPos = out.size();
+        size_t count = bwtEntryPointCount(size);
+        size_t pointsSize = count == 0 ? 0 : 1 + count * sizeof(uint32_t);
+        out.resize(outPos + sizeof(uint32_t) + pointsSize + size);
+        unsigned char *header = out.data() + outPos;
+        uint32_t primary = forwardBWTBlock(data, size, header + sizeof(uint32_t) + pointsSize,
+            count != 0 ? &entryPoints : nullptr);
+        if (count != 0) {
+            primary |= bwtEntryPointFlag;
+            header[sizeof(uint32_t)] = (unsigned char)count;
+            for (size_t k = 0; k < count; k++) {
+                std::memcpy(header + sizeof(uint32_t) + 1 + k * sizeof(uint32_t), &entryPoints[k].row, sizeof(uint32_t));
+            }
+        }
+        std::memcpy(header, &primary, sizeof(uint32_t));
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        if (size < sizeof(uint32_t)) {
+            throw std::runtime_error("BWT block is truncated");
+        }
+        uint32_t primary;
+        std::memcpy(&primary, data, sizeof(uint32_t));
+        size_t headerSize = sizeof(uint32_t);
+        entryPoints.clear();
+        if (primary & bwtEntryPointFlag) {
+            primary &= ~bwtEntryPointFlag;
+            if (size < headerSize + 1 || size < headerSize + 1 + data[headerSize] * sizeof(uint32_t)) {
+                throw std::runtime_error("BWT block is truncated");
+            }
+            size_t count = data[headerSize];
+            size_t spacing = (size - headerSize - 1 - count * sizeof(uint32_t)) / (count + 1);
+            entryPoints.resize(count);
+            for (size_t k = 0; k < count; k++) {
+                entryPoints[k].position = uint32_t((k + 1) * spacing);
+                std::memcpy(&entryPoints[k].row, data + headerSize + 1 + k * sizeof(uint32_t), sizeof(uint32_t));
+            }
+            headerSize += 1 + count * sizeof(uint32_t);
+        }
+        size_t outPos = out.size();
+        out.resize(outPos + size - headerSize);
+        inverseBWTBlock(data + headerSize, size - headerSize, primary, out.data() + outPos, entryPoints);
+    }
+
+private:
+    std::vector<BWTEntryPoint> entryPoints;
+};
+
+class MTFCodec : public Codec {
+public:
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        mtfEncode(data, size, out);
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        mtfDecode(data, size, out);
+    }
+};
+
+class RLECodec : public Codec {
+public:
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        runLengthEncodeBlock(data, size, out);
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        runLengthDecodeBlock(data, size, out);
+    }
+    void decodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        runLengthDecodeBlock(data, size, out, limit);
+    }
+    bool encodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        return runLengthEncodeBlock(data, size, out, limit);
+    }
+};
+
+//LZW, optionally starting every block from a preset dictionary
+class LZCodec : public Codec {
+public:
+    explicit LZCodec(std::shared_ptr<const LZDictionary> preset_p = nullptr) : preset(preset_p) {}
+
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        lzCompressBlock(data, size, out, SIZE_MAX, preset.get());
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        lzDecompressBlock(data, size, out, SIZE_MAX, preset.get());
+    }
+    void decodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        lzDecompressBlock(data, size, out, limit, preset.get());
+    }
+    bool encodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        return lzCompressBlock(data, size, out, limit, preset.get());
+    }
+
+private:
+    std::shared_ptr<const LZDictionary> preset;
+};
+
+class HuffCodec : public Codec {
+public:
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        huffEncodeBlock(data, size, out);
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        huffDecodeBlock(data, size, out);
+    }
+    void decodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        huffDecodeBlock(data, size, out, limit);
+    }
+    bool encodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        return huffEncodeBlock(data, size, out, limit);
+    }
+};
+
+//Raw DEFLATE, lazy matching at level 6 unless another level is given
+class DeflateCodec : public Codec {
+public:
+    explicit DeflateCodec(int level_p = 6) : level(level_p) {}
+
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        deflateCompress(data, size, out, level);
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        inflateDecompress(data, size, out);
+    }
+    void decodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        inflateDecompress(data, size, out, limit);
+    }
+
+private:
+    int level;
+};
+
+//Long range matches replaced by references, ahead of a codec with a short reach
+class LRMCodec : public Codec {
+public:
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        lrmEncode(data, size, out);
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        lrmDecode(data, size, out);
+    }
+    void decodeWithin(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit) override {
+        lrmDecode(data, size, out, limit);
+    }
+};
+
+class DeltaCodec : public Codec {
+public:
+    void encode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        deltaEncode(data, size, out);
+    }
+    void decode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) override {
+        deltaDecode(data, size, out);
+    }
+};
+
+/* Registry */
+
+typedef std::function<std::unique_ptr<Codec>()> CodecFactory;
+
+template <class CodecType>
+std::unique_ptr<Codec> makeCodecOf() {
+    return std::unique_ptr<Codec>(new CodecType());
+}
+
+//Stage names and the factories that create them
+std::map<std::string, CodecFactory> &codecRegistry() {
+    static std::map<std::string, CodecFactory> registry = [] {
+        std::map<std::string, CodecFactory> stages {
+            {"BWT", makeCodecOf<BWTCodec>},
+            {"MTF", makeCodecOf<MTFCodec>},
+            {"RLE", makeCodecOf<RLECodec>},
+            {"LZ", makeCodecOf<LZCodec>},
+            {"HUFF", makeCodecOf<HuffCodec>},
+            {"DEFLATE", makeCodecOf<DeflateCodec>},
+            {"LRM", makeCodecOf<LRMCodec>},
+            {"DELTA", makeCodecOf<DeltaCodec>},
+        };
+        //DEFLATE at a chosen level, e.g. "DEFLATE#9"; every level decodes alike
+        for (int level = 0; level <= 9; level++) {
+            stages["DEFLATE#" + std::to_string(level)] = [level] {
+                return std::unique_ptr<Codec>(new DeflateCodec(level));
+            };
+        }
+        return stages;
+    }();
+    return registry;
+}
+
+//Adds or replaces a stage; new stages are usable in chains right away
+void registerCodec(const std::string &name, CodecFactory factory) {
+    codecRegistry()[name] = factory;
+}
+
+std::unique_ptr<Codec> makeCodec(const std::string &name) {
+    auto found = codecRegistry().find(name);
+    if (found == codecRegistry().end()) {
+        if (name.compare(0, 3, "LZ#") == 0) {
+            throw std::invalid_argument("needs LZ dictionary " + name.substr(3) + ", load it with --dict=file");
+        }
+        throw std::invalid_argument("unknown codec " + name);
+    }
+    return found->second();
+}
+
+/*
+* Register LZ Dictionary
+* Adds the stage "LZ#<id>", LZ preloaded with the dictionary. The id ends up
+* in the chain a container records, naming the dictionary it needs to decode.
+*/
+std::string registerLZDictionary(std::shared_ptr<const LZDictionary> preset) {
+    std::stringstream name;
+    name << "LZ#" << std::hex << std::setw(8) << std::setfill('0') << preset->id;
+    registerCodec(name.str(), [preset] { return std::unique_ptr<Codec>(new LZCodec(preset)); });
+    return name.str();
+}
+
+//Reads a dictionary file
+std::shared_ptr<const LZDictionary> readLZDictionaryFile(const std::string &fileName) {
+    std::ifstream is(fileName, std::ios::binary);
+    if (!is.is_open()) {
+        throw std::runtime_error("cannot open " + fileName);
+    }
+    return std::make_shared<LZDictionary>(readLZDictionary(is));
+}
+
+//Reads a dictionary file and registers it, returning the stage name
+std::string loadLZDictionary(const std::string &fileName) {
+    return registerLZDictionary(readLZDictionaryFile(fileName));
+}
+
+/*
+* Parse Byte Size
+* Reads sizes such as "4096", "256K" or "4M"; 0 if the text is not a size
+*/
+size_t parseByteSize(const std::string &text) {
+    char *end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return 0;
+    }
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k") value <<= 10;
+    else if (suffix == "M" || suffix == "m") value <<= 20;
+    else if (suffix == "G" || suffix == "g") value <<= 30;
+    else if (!suffix.empty()) return 0;
+    return size_t(value);
+}
+
+/*
+* CodecPipeline
+* A chain of stages run in order to encode and in reverse to decode
+*/
+//Stage names of a chain, e.g. "BWT,MTF,HUFF" -> BWT, MTF, HUFF
+std::vector<std::string> chainStageNames(const std::string &chain) {
+    std::vector<std::string> names;
+    std::stringstream chainStream(chain);
+    std::string name;
+    while (std::getline(chainStream, name, ',')) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+class CodecPipeline {
+public:
+    explicit CodecPipeline(const std::string &chain_p) : chainName(chain_p) {
+        for (auto &name : chainStageNames(chain_p)) {
+            stages.push_back(makeCodec(name));
+        }
+        if (stages.empty()) {
+            throw std::invalid_argument("empty codec chain");
+        }
+    }
+
+    const std::string &chain() const { return chainName; }
+
+    /*
+    * Encode Block
+    * Encodes one block through every stage, appending the result to 'out'.
+    * Gives up and returns false once the final output passes limit bytes, or
+    * an intermediate stage's output passes twice that, since later stages
+    * cannot be expected to win that much back.
+    */
+    bool encodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+            size_t limit = SIZE_MAX) {
+        for (size_t i = 0; i < stages.size(); i++) {
+            bool last = i + 1 == stages.size();
+            std::vector<unsigned char> &target = last ? out : scratch[i % 2];
+            if (!last) target.clear();
+            size_t stageLimit = last || limit > SIZE_MAX / 2 ? limit : limit * 2;
+            if (!stages[i]->encodeWithin(data, size, target, stageLimit)) {
+                return false;
+            }
+            data = target.data();
+            size = target.size();
+        }
+        return true;
+    }
+
+    /*
+    * Encode Or Store
+    * Writes a tag byte and the encoded block, or the raw block if encoding
+    * would not make it smaller
+    */
+    void encodeOrStore(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+        size_t start = out.size();
+        out.push_back(encodedBlockTag);
+        if (size == 0 || !encodeBlock(data, size, out, size - 1)) {
+            out.resize(start);
+            out.push_back(storedBlockTag);
+            out.insert(out.end(), data, data + size);
+        }
+    }
+
+    //Decodes a block written by encodeOrStore, of at most limit bytes
+    void decodeStored(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+            size_t limit = SIZE_MAX) {
+        if (size == 0 || data[0] > encodedBlockTag) {
+            throw std::runtime_error("invalid block tag");
+        }
+        if (data[0] == storedBlockTag) {
+            if (size - 1 > limit) {
+                throw std::runtime_error("stored block is larger than the block size");
+            }
+            out.insert(out.end(), data + 1, data + size);
+        } else {
+            decodeBlock(data + 1, size - 1, out, limit);
+        }
+    }
+
+    /*
+    * Decode Block
+    * Decodes one block through every stage in reverse, appending to 'out'.
+    * Throws once the block passes limit bytes, or an intermediate stage's
+    * output twice that, the most encodeBlock lets through.
+    */
+    void decodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+            size_t limit = SIZE_MAX) {
+        for (size_t i = stages.size(); i-- > 0;) {
+            bool last = i == 0;
+            std::vector<unsigned char> &target = last ? out : scratch[i % 2];
+            if (!last) target.clear();
+            size_t stageLimit = last || limit > SIZE_MAX / 2 ? limit : limit * 2;
+            stages[i]->decodeWithin(data, size, target, stageLimit);
+            data = target.data();
+            size = target.size();
+        }
+    }
+
+private:
+    std::string chainName;
+    std::vector<std::unique_ptr<Codec>> stages;
+    std::vector<unsigned char> scratch[2]; //Reused between stages and blocks
+};
+
+#endif //CODEC_PIPELINE_HPP
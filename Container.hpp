@@ -0,0 +1,776 @@
+#ifndef CONTAINER_HPP
+#define CONTAINER_HPP
+
+/*
+Container:
+The self-describing file format written by codec pipelines. The header names
+the codec chain and its parameters and keeps the original size and
+extension, so "-d" needs no algorithm. Every block is framed with its sizes
+and a CRC32C of its raw bytes, checked as soon as the block is decoded, and
+the trailer holds the CRC32C of all the data, checked against the blocks by
+every reader; a trailing block index lets readers decode blocks in parallel or decode only
+the blocks covering a byte range. Data can be appended to a container as
+more blocks without touching those already written.
+----------------------------------------------------------
+File layout (all integers in host byte order, like the LZ codes):
+    header:  "ARBC", version, u16 chain length + chain (e.g. "BWT,MTF,RLE,HUFF"),
+             u32 block size, u64 original size, u16 extension length + extension
+    blocks:  per block, u32 raw size, u32 stored size, u32 CRC32C of the raw
+             bytes, then the stored bytes: a tag byte followed by the encoded
+             block, or by the raw block when encoding would not shrink it
+    index:   per block, u64 offset of its frame, u32 raw size, u32 stored size,
+             u32 CRC32C
+    trailer: u64 offset of the index, u32 block count, u32 CRC32C of all raw
+             bytes, "ARBI"
+Version 2 containers, which checksum blocks with CRC-32 and have no CRC in
+the trailer, are still read and appended to as version 2.
+The original size is all ones when the input was a stream of unknown length.
+A stored size is never 0 (there is always the tag byte), while what follows
+the last block starts with the offset of the first block (the first index
+entry), or with no blocks the same offset as the trailer's index offset;
+that offset is just past the header, so its high word reads as a stored size
+of 0, and a reader going strictly forward, e.g. from a pipe, knows where the
+blocks end without seeking to the trailer.
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include "Codec_Pipeline.hpp"
+#include "SpscQueue.hpp"
+#include "Checksum.hpp"
+#include "ThreadPool.hpp"
+
+const char containerMagic[4] = {'A', 'R', 'B', 'C'};
+const char containerIndexMagic[4] = {'A', 'R', 'B', 'I'};
+const uint32_t containerVersion = 3;
+const uint32_t containerCrc32Version = 2;   //Blocks checked with CRC-32, no whole-data checksum
+const size_t containerFrameSize = 3 * sizeof(uint32_t);
+const size_t containerIndexEntrySize = sizeof(uint64_t) + 3 * sizeof(uint32_t);
+//Original size of a container written from a stream whose length was not known up front
+const uint64_t containerUnknownSize = UINT64_MAX;
+//Raw bytes of the blocks in flight in one batch, so large blocks are not multiplied by the slot count
+const uint64_t containerBatchBytes = uint64_t(256) << 20;
+const size_t containerReadChunk = 1 << 20;
+
+//One block as recorded in the index
+struct ContainerBlock {
+    uint64_t offset = 0; //Offset of the block's frame from the start of the container
+    uint32_t rawSize = 0;
+    uint32_t encodedSize = 0;
+    uint32_t checksum = 0; //CRC32C of the raw bytes (CRC-32 in version 2)
+};
+
+//Header and block index of a container
+struct ContainerHeader {
+    uint32_t version = containerVersion;
+    std::string chain;
+    uint32_t blockSize = 0;
+    uint64_t originalSize = 0;
+    std::string extension;
+    std::vector<ContainerBlock> blocks;
+    std::vector<uint64_t> rawOffsets; //Raw start of every block, then the total size
+    uint32_t dataChecksum = 0;        //CRC32C of all the raw bytes, from the trailer (version 3)
+
+    uint64_t rawSize() const { return rawOffsets.empty() ? 0 : rawOffsets.back(); }
+};
+
+template <class T>
+void writeContainerField(std::ostream &os, T value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+T readContainerField(std::istream &is) {
+    T value;
+    if (!is.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+        throw std::runtime_error("container is truncated");
+    }
+    return value;
+}
+
+std::string readContainerString(std::istream &is) {
+    std::string text(readContainerField<uint16_t>(is), '\0');
+    if (!is.read(&text[0], text.size())) {
+        throw std::runtime_error("container is truncated");
+    }
+    return text;
+}
+
+//Bytes the trailer of a container takes
+uint64_t containerTrailerSize(uint32_t version) {
+    return sizeof(uint64_t) + sizeof(uint32_t) + (version == containerCrc32Version ? 0 : sizeof(uint32_t)) +
+        sizeof(containerIndexMagic);
+}
+
+//Checksum of a block's raw bytes in a container of the given version
+uint32_t containerChecksum(uint32_t version, const unsigned char *data, size_t size) {
+    return version == containerCrc32Version ? crc32(data, size) : crc32c(data, size);
+}
+
+//Bytes the header of a container takes
+uint64_t containerHeaderSize(const ContainerHeader &header) {
+    return sizeof(containerMagic) + sizeof(uint32_t) + 2 * sizeof(uint16_t) + header.chain.size() +
+        sizeof(uint32_t) + sizeof(uint64_t) + header.extension.size();
+}
+
+/*
+* Container Writer
+* Writes the header, then blocks as they are handed over, then the index.
+* Only ever writes forward, so the output does not need to be seekable.
+*/
+class ContainerWriter {
+public:
+    ContainerWriter(std::ostream &os_p, const ContainerHeader &header)
+        : os(os_p), version(header.version), written(0), dataChecksum(0) {
+        if (header.chain.size() > UINT16_MAX || header.extension.size() > UINT16_MAX) {
+            throw std::invalid_argument("codec chain or extension is too long");
+        }
+        os.write(containerMagic, sizeof(containerMagic));
+        writeContainerField<uint32_t>(os, version);
+        writeContainerField<uint16_t>(os, uint16_t(header.chain.size()));
+        os.write(header.chain.data(), header.chain.size());
+        writeContainerField<uint32_t>(os, header.blockSize);
+        writeContainerField<uint64_t>(os, header.originalSize);
+        writeContainerField<uint16_t>(os, uint16_t(header.extension.size()));
+        os.write(header.extension.data(), header.extension.size());
+        written = containerHeaderSize(header);
+    }
+
+    //Continues a container read with readContainer whose blocks end at 'end', where os is positioned
+    ContainerWriter(std::ostream &os_p, const ContainerHeader &existing, uint64_t end)
+        : os(os_p), version(existing.version), written(end), dataChecksum(existing.dataChecksum),
+          blocks(existing.blocks) {}
+
+    const std::vector<ContainerBlock> &indexBlocks() const { return blocks; }
+
+    void writeBlock(uint32_t rawSize, uint32_t checksum, const std::vector<unsigned char> &encoded) {
+        ContainerBlock block;
+        block.offset = written;
+        block.rawSize = rawSize;
+        block.encodedSize = uint32_t(encoded.size());
+        block.checksum = checksum;
+        writeContainerField<uint32_t>(os, block.rawSize);
+        writeContainerField<uint32_t>(os, block.encodedSize);
+        writeContainerField<uint32_t>(os, block.checksum);
+        os.write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+        if (!os) {
+            throw std::runtime_error("failed writing the container");
+        }
+        written += containerFrameSize + encoded.size();
+        dataChecksum = crc32cCombine(dataChecksum, checksum, rawSize);
+        blocks.push_back(block);
+    }
+
+    //Writes the block index and trailer
+    void finish() {
+        uint64_t indexOffset = written;
+        for (auto &block : blocks) {
+            writeContainerField<uint64_t>(os, block.offset);
+            writeContainerField<uint32_t>(os, block.rawSize);
+            writeContainerField<uint32_t>(os, block.encodedSize);
+            writeContainerField<uint32_t>(os, block.checksum);
+        }
+        writeContainerField<uint64_t>(os, indexOffset);
+        writeContainerField<uint32_t>(os, uint32_t(blocks.size()));
+        if (version != containerCrc32Version) {
+            writeContainerField<uint32_t>(os, dataChecksum);
+        }
+        os.write(containerIndexMagic, sizeof(containerIndexMagic));
+        if (!os) {
+            throw std::runtime_error("failed writing the container");
+        }
+    }
+
+private:
+    std::ostream &os;
+    uint32_t version;
+    uint64_t written;
+    uint32_t dataChecksum;
+    std::vector<ContainerBlock> blocks;
+};
+
+/*
+* Container Bound
+* Largest container a chain can write for rawSize bytes: blocks that do not
+* shrink are stored, so each block costs at most its raw size plus framing
+*/
+uint64_t containerBound(uint64_t rawSize, const ContainerHeader &header) {
+    uint64_t blockCount = header.blockSize == 0 ? 0 : (rawSize + header.blockSize - 1) / header.blockSize;
+    return containerHeaderSize(header) + rawSize + blockCount * (containerFrameSize + 1 + containerIndexEntrySize) +
+        containerTrailerSize(header.version);
+}
+
+/*
+* Container Codecs
+* Pipelines and buffers for one batch of blocks. Callers that compress or
+* decompress many inputs keep one and pass it to every call, so the stages
+* and buffers are set up once.
+*/
+struct ContainerCodecs {
+    std::vector<std::unique_ptr<CodecPipeline>> pipelines;
+    std::vector<std::vector<unsigned char>> input, output;
+    std::vector<uint32_t> checksums;
+
+    //Makes sure there are 'count' pipelines for 'chain'
+    void prepare(const std::string &chain, size_t count) {
+        if (pipelines.size() != count || (count != 0 && pipelines[0]->chain() != chain)) {
+            pipelines.clear();
+            for (size_t i = 0; i < count; i++) {
+                pipelines.emplace_back(new CodecPipeline(chain));
+            }
+        }
+        input.resize(count);
+        output.resize(count);
+        checksums.resize(count);
+    }
+};
+
+/*
+* Check Container Block Size
+* Refuses a block size of zero, and blocks of 2 GiB or more for chains with
+* BWT, whose primary index has its top bit taken by the entry point flag
+*/
+void checkContainerBlockSize(const ContainerHeader &header) {
+    if (header.blockSize == 0) {
+        throw std::invalid_argument("block size must not be zero");
+    }
+    for (auto &name : chainStageNames(header.chain)) {
+        if (name == "BWT" && header.blockSize >= bwtEntryPointFlag) {
+            throw std::invalid_argument("BWT blocks must be smaller than 2 GiB");
+        }
+    }
+}
+
+//True while a batch of 'count' blocks holding 'bytes' raw bytes can take one more block of 'next' bytes
+bool containerBatchHasRoom(size_t count, uint64_t bytes, uint64_t next) {
+    return count == 0 || bytes + next <= containerBatchBytes;
+}
+
+/*
+* Read Block Input
+* Reads up to blockSize bytes into block, growing it a chunk at a time, so
+* a short input only takes the memory it needs whatever the block size
+*/
+void readBlockInput(std::istream &is, std::vector<unsigned char> &block, size_t blockSize) {
+    block.clear();
+    while (block.size() < blockSize) {
+        size_t start = block.size();
+        size_t wanted = std::min(containerReadChunk, blockSize - start);
+        block.resize(start + wanted);
+        is.read(reinterpret_cast<char *>(block.data() + start), wanted);
+        block.resize(start + size_t(is.gcount()));
+        if (size_t(is.gcount()) < wanted) {
+            break;
+        }
+    }
+}
+
+/*
+* Container Encode Blocks
+* Cuts the input into blocks of header.blockSize bytes, encodes a batch of
+* them in parallel (each slot with its own pipeline) and hands them to the
+* writer in order. A batch holds up to two blocks per thread, fewer when
+* that would pass containerBatchBytes.
+*/
+void containerEncodeBlocks(std::istream &is, ContainerWriter &writer, const ContainerHeader &header, ThreadPool &pool,
+        ContainerCodecs &codecs) {
+    size_t batchSize = pool.size() * 2;
+    codecs.prepare(header.chain, batchSize);
+    std::vector<std::unique_ptr<CodecPipeline>> &pipelines = codecs.pipelines;
+    std::vector<std::vector<unsigned char>> &raw = codecs.input, &encoded = codecs.output;
+    std::vector<uint32_t> &checksums = codecs.checksums;
+
+    bool ended = false;
+    while (!ended) {
+        size_t count = 0;
+        uint64_t batchBytes = 0;
+        while (count < batchSize && containerBatchHasRoom(count, batchBytes, header.blockSize)) {
+            //The end is found before a slot is filled
+            if (is.peek() == std::char_traits<char>::eof()) {
+                ended = true;
+                break;
+            }
+            readBlockInput(is, raw[count], header.blockSize);
+            batchBytes += raw[count].size();
+            count++;
+        }
+
+        pool.parallelFor(count, [&](size_t i) {
+            encoded[i].clear();
+            pipelines[i]->encodeOrStore(raw[i].data(), raw[i].size(), encoded[i]);
+            checksums[i] = containerChecksum(header.version, raw[i].data(), raw[i].size());
+        });
+        for (size_t i = 0; i < count; i++) {
+            writer.writeBlock(uint32_t(raw[i].size()), checksums[i], encoded[i]);
+        }
+    }
+}
+
+/*
+* Container Compress
+* Writes the header, every block of the input and the index
+*/
+void containerCompress(std::istream &is, std::ostream &os, const ContainerHeader &header, ThreadPool &pool,
+        ContainerCodecs &codecs) {
+    checkContainerBlockSize(header);
+    ContainerWriter writer(os, header);
+    containerEncodeBlocks(is, writer, header, pool, codecs);
+    writer.finish();
+}
+
+void containerCompress(std::istream &is, std::ostream &os, const ContainerHeader &header, ThreadPool &pool) {
+    ContainerCodecs codecs;
+    containerCompress(is, os, header, pool, codecs);
+}
+
+//A block on its way through containerCompressStaged
+struct StagedBlock {
+    std::vector<unsigned char> raw;
+    std::vector<unsigned char> data;   //Output of the last stage that ran
+    uint32_t checksum = 0;
+    bool stored = false;               //A stage passed its limit, so the block is stored raw
+    bool end = false;                  //Marks the end of the input
+};
+
+/*
+* Container Compress Staged
+* Same output as containerCompress, but every stage of the chain runs on its
+* own thread: the reader, each codec and the writer (the calling thread)
+* hand blocks on through bounded SPSC queues, so block n+1 is in the first
+* stage while block n is in the last one. Throughput approaches that of the
+* slowest stage, and at most about (stages + 1) * (queueDepth + 1) blocks are
+* in memory at once.
+*/
+void containerCompressStaged(std::istream &is, std::ostream &os, const ContainerHeader &header,
+        size_t queueDepth = 2) {
+    checkContainerBlockSize(header);
+    std::vector<std::unique_ptr<Codec>> stages;
+    for (auto &name : chainStageNames(header.chain)) {
+        stages.push_back(makeCodec(name));
+    }
+    if (stages.empty()) {
+        throw std::invalid_argument("empty codec chain");
+    }
+    ContainerWriter writer(os, header);
+
+    //queues[0] feeds the first stage, queues[stages.size()] the writer
+    std::vector<std::unique_ptr<SpscQueue<StagedBlock>>> queues;
+    for (size_t i = 0; i <= stages.size(); i++) {
+        queues.emplace_back(new SpscQueue<StagedBlock>(queueDepth));
+    }
+    std::atomic<bool> abort(false);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    const auto fail = [&] {
+        std::lock_guard<std::mutex> lock(failureMutex);
+        if (!failure) {
+            failure = std::current_exception();
+        }
+        abort = true;
+    };
+
+    std::vector<std::thread> threads;
+    threads.emplace_back([&] {
+        try {
+            for (bool ended = false; !ended;) {
+                StagedBlock block;
+                ended = block.end = is.peek() == std::char_traits<char>::eof();
+                if (!ended) {
+                    readBlockInput(is, block.raw, header.blockSize);
+                }
+                block.checksum = containerChecksum(header.version, block.raw.data(), block.raw.size());
+                if (!queues[0]->push(block, abort)) {
+                    return;
+                }
+            }
+        }
+        catch (...) {
+            fail();
+        }
+    });
+    for (size_t i = 0; i < stages.size(); i++) {
+        threads.emplace_back([&, i] {
+            try {
+                //Same limits as CodecPipeline::encodeOrStore
+                bool last = i + 1 == stages.size();
+                std::vector<unsigned char> target;
+                StagedBlock block;
+                while (queues[i]->pop(block, abort)) {
+                    if (!block.end && !block.stored) {
+                        size_t limit = block.raw.size() - 1;
+                        const std::vector<unsigned char> &input = i == 0 ? block.raw : block.data;
+                        target.clear();
+                        block.stored = !stages[i]->encodeWithin(input.data(), input.size(), target,
+                            last ? limit : limit * 2);
+                        block.data.swap(target);
+                    }
+                    bool end = block.end;
+                    if (!queues[i + 1]->push(block, abort) || end) {
+                        return;
+                    }
+                }
+            }
+            catch (...) {
+                fail();
+            }
+        });
+    }
+
+    try {
+        std::vector<unsigned char> stored;
+        StagedBlock block;
+        while (queues.back()->pop(block, abort) && !block.end) {
+            stored.clear();
+            if (block.stored) {
+                stored.push_back(storedBlockTag);
+                stored.insert(stored.end(), block.raw.begin(), block.raw.end());
+            } else {
+                stored.push_back(encodedBlockTag);
+                stored.insert(stored.end(), block.data.begin(), block.data.end());
+            }
+            writer.writeBlock(uint32_t(block.raw.size()), block.checksum, stored);
+        }
+    }
+    catch (...) {
+        fail();
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+    writer.finish();
+}
+
+/*
+* Read Container Header
+* Reads the header at the current position, leaving the blocks untouched
+*/
+ContainerHeader readContainerHeader(std::istream &is) {
+    char magic[4];
+    if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, containerMagic)) {
+        throw std::runtime_error("not an ARB container");
+    }
+    ContainerHeader header;
+    header.version = readContainerField<uint32_t>(is);
+    if (header.version != containerVersion && header.version != containerCrc32Version) {
+        throw std::runtime_error("unsupported container version");
+    }
+    header.chain = readContainerString(is);
+    header.blockSize = readContainerField<uint32_t>(is);
+    header.originalSize = readContainerField<uint64_t>(is);
+    header.extension = readContainerString(is);
+    if (header.chain.empty() || header.blockSize == 0) {
+        throw std::runtime_error("corrupted container header");
+    }
+    return header;
+}
+
+/*
+* Read Container
+* Reads the header and the trailing block index of a seekable container
+*/
+ContainerHeader readContainer(std::istream &is) {
+    ContainerHeader header = readContainerHeader(is);
+    uint64_t headerEnd = uint64_t(is.tellg());
+
+    is.seekg(0, std::ios::end);
+    uint64_t fileSize = uint64_t(is.tellg());
+    uint64_t trailerSize = containerTrailerSize(header.version);
+    if (fileSize < headerEnd + trailerSize) {
+        throw std::runtime_error("container is truncated");
+    }
+    is.seekg(fileSize - trailerSize);
+    uint64_t indexOffset = readContainerField<uint64_t>(is);
+    uint32_t blockCount = readContainerField<uint32_t>(is);
+    if (header.version != containerCrc32Version) {
+        header.dataChecksum = readContainerField<uint32_t>(is);
+    }
+    char magic[4];
+    if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, containerIndexMagic) ||
+        indexOffset < headerEnd || indexOffset + uint64_t(blockCount) * containerIndexEntrySize + trailerSize != fileSize) {
+        throw std::runtime_error("container block index is missing or corrupted");
+    }
+
+    is.seekg(indexOffset);
+    header.blocks.resize(blockCount);
+    header.rawOffsets.assign(1, 0);
+    uint64_t nextFrame = headerEnd;
+    uint32_t dataChecksum = 0;
+    for (auto &block : header.blocks) {
+        block.offset = readContainerField<uint64_t>(is);
+        block.rawSize = readContainerField<uint32_t>(is);
+        block.encodedSize = readContainerField<uint32_t>(is);
+        block.checksum = readContainerField<uint32_t>(is);
+        //Blocks are stored back to back, in order, and never stored larger than raw plus the tag byte
+        if (block.offset != nextFrame || block.rawSize > header.blockSize || block.encodedSize > block.rawSize + 1) {
+            throw std::runtime_error("container block index is corrupted");
+        }
+        nextFrame += containerFrameSize + block.encodedSize;
+        header.rawOffsets.push_back(header.rawOffsets.back() + block.rawSize);
+        dataChecksum = crc32cCombine(dataChecksum, block.checksum, block.rawSize);
+    }
+    if (nextFrame != indexOffset) {
+        throw std::runtime_error("container block index is corrupted");
+    }
+    //Blocks are checked against the index as they are decoded, so this covers all the data
+    if (header.version != containerCrc32Version && dataChecksum != header.dataChecksum) {
+        throw std::runtime_error("container data checksum does not match the block index");
+    }
+    return header;
+}
+
+/*
+* Read Container Block
+* Reads a block's frame and encoded bytes, checking the frame against the index
+*/
+void readContainerBlock(std::istream &is, const ContainerBlock &block, std::vector<unsigned char> &encoded) {
+    is.seekg(block.offset);
+    uint32_t rawSize = readContainerField<uint32_t>(is);
+    uint32_t encodedSize = readContainerField<uint32_t>(is);
+    uint32_t checksum = readContainerField<uint32_t>(is);
+    if (rawSize != block.rawSize || encodedSize != block.encodedSize || checksum != block.checksum) {
+        throw std::runtime_error("container block frame does not match the index");
+    }
+    encoded.resize(encodedSize);
+    if (!is.read(reinterpret_cast<char *>(encoded.data()), encodedSize)) {
+        throw std::runtime_error("container block is truncated");
+    }
+}
+
+/*
+* Decode Container Block
+* Decodes one block of a container of the given version and verifies its
+* size and checksum
+*/
+void decodeContainerBlock(CodecPipeline &pipeline, uint32_t version, const ContainerBlock &block,
+        const std::vector<unsigned char> &encoded, std::vector<unsigned char> &out) {
+    out.clear();
+    pipeline.decodeStored(encoded.data(), encoded.size(), out, block.rawSize);
+    if (out.size() != block.rawSize || containerChecksum(version, out.data(), out.size()) != block.checksum) {
+        throw std::runtime_error("container block checksum mismatch at offset " + std::to_string(block.offset));
+    }
+}
+
+/*
+* Container Decode Range
+* Writes bytes [start, start + length) of the original data, clamped to its
+* end. Only the blocks covering the range are read, and they are decoded a
+* batch at a time in parallel.
+*/
+void containerDecodeRange(std::istream &is, std::ostream &os, const ContainerHeader &header,
+        uint64_t start, uint64_t length, ThreadPool &pool, ContainerCodecs &codecs) {
+    uint64_t total = header.rawSize();
+    if (start > total) {
+        throw std::runtime_error("range starts past the end of the data");
+    }
+    uint64_t end = start + std::min(length, total - start);
+    if (end == start) {
+        return;
+    }
+
+    //Blocks [first, last) overlap the range
+    const std::vector<uint64_t> &offsets = header.rawOffsets;
+    size_t first = size_t(std::upper_bound(offsets.begin(), offsets.end(), start) - offsets.begin()) - 1;
+    size_t last = size_t(std::lower_bound(offsets.begin(), offsets.end(), end) - offsets.begin());
+
+    size_t batchSize = pool.size() * 2;
+    codecs.prepare(header.chain, batchSize);
+    std::vector<std::unique_ptr<CodecPipeline>> &pipelines = codecs.pipelines;
+    std::vector<std::vector<unsigned char>> &encoded = codecs.input, &decoded = codecs.output;
+
+    for (size_t batchStart = first, count = 0; batchStart < last; batchStart += count) {
+        uint64_t batchBytes = 0;
+        for (count = 0; batchStart + count < last && count < batchSize &&
+            containerBatchHasRoom(count, batchBytes, header.blocks[batchStart + count].rawSize); count++) {
+            batchBytes += header.blocks[batchStart + count].rawSize;
+        }
+        for (size_t i = 0; i < count; i++) {
+            readContainerBlock(is, header.blocks[batchStart + i], encoded[i]);
+        }
+        pool.parallelFor(count, [&](size_t i) {
+            decodeContainerBlock(*pipelines[i], header.version, header.blocks[batchStart + i], encoded[i], decoded[i]);
+        });
+        for (size_t i = 0; i < count; i++) {
+            size_t block = batchStart + i;
+            uint64_t from = std::max(start, offsets[block]) - offsets[block];
+            uint64_t to = std::min(end, offsets[block + 1]) - offsets[block];
+            os.write(reinterpret_cast<const char *>(decoded[i].data() + from), to - from);
+        }
+    }
+    if (!os) {
+        throw std::runtime_error("failed writing the decoded data");
+    }
+}
+
+void containerDecodeRange(std::istream &is, std::ostream &os, const ContainerHeader &header,
+        uint64_t start, uint64_t length, ThreadPool &pool) {
+    ContainerCodecs codecs;
+    containerDecodeRange(is, os, header, start, length, pool, codecs);
+}
+
+/*
+* Container Decompress
+* Decodes the whole container
+*/
+void containerDecompress(std::istream &is, std::ostream &os, const ContainerHeader &header, ThreadPool &pool,
+        ContainerCodecs &codecs) {
+    if (header.originalSize != containerUnknownSize && header.rawSize() != header.originalSize) {
+        throw std::runtime_error("container blocks do not add up to the original size");
+    }
+    containerDecodeRange(is, os, header, 0, header.rawSize(), pool, codecs);
+}
+
+void containerDecompress(std::istream &is, std::ostream &os, const ContainerHeader &header, ThreadPool &pool) {
+    ContainerCodecs codecs;
+    containerDecompress(is, os, header, pool, codecs);
+}
+
+/*
+* Container Decompress Stream
+* Decodes a container read strictly forward, e.g. from a pipe. Frames are read
+* and decoded a batch at a time until the index starts, and the index and
+* trailer are then only checked against the frames that were read, so memory
+* stays at one batch of blocks (plus the index) whatever the length.
+*/
+void containerDecompressStream(std::istream &is, std::ostream &os, ThreadPool &pool, ContainerCodecs &codecs) {
+    ContainerHeader header = readContainerHeader(is);
+    size_t batchSize = pool.size() * 2;
+    codecs.prepare(header.chain, batchSize);
+    std::vector<std::unique_ptr<CodecPipeline>> &pipelines = codecs.pipelines;
+    std::vector<std::vector<unsigned char>> &encoded = codecs.input, &decoded = codecs.output;
+
+    std::vector<ContainerBlock> &blocks = header.blocks;
+    uint64_t offset = containerHeaderSize(header);
+    uint64_t total = 0;
+    uint32_t dataChecksum = 0;
+    uint32_t firstWord = 0; //Low word of the first index entry, or of the trailer's index offset
+    bool ended = false;
+    while (!ended) {
+        size_t count = 0;
+        uint64_t batchBytes = 0;
+        while (count < batchSize && containerBatchHasRoom(count, batchBytes, header.blockSize)) {
+            ContainerBlock block;
+            block.offset = offset;
+            block.rawSize = readContainerField<uint32_t>(is);
+            block.encodedSize = readContainerField<uint32_t>(is);
+            if (block.encodedSize == 0) {
+                firstWord = block.rawSize;
+                ended = true;
+                break;
+            }
+            block.checksum = readContainerField<uint32_t>(is);
+            if (block.rawSize > header.blockSize || block.encodedSize > block.rawSize + 1) {
+                throw std::runtime_error("container block is larger than the block size");
+            }
+            encoded[count].resize(block.encodedSize);
+            if (!is.read(reinterpret_cast<char *>(encoded[count].data()), block.encodedSize)) {
+                throw std::runtime_error("container block is truncated");
+            }
+            offset += containerFrameSize + block.encodedSize;
+            dataChecksum = crc32cCombine(dataChecksum, block.checksum, block.rawSize);
+            blocks.push_back(block);
+            batchBytes += block.rawSize;
+            count++;
+        }
+        size_t batchStart = blocks.size() - count;
+        pool.parallelFor(count, [&](size_t i) {
+            decodeContainerBlock(*pipelines[i], header.version, blocks[batchStart + i], encoded[i], decoded[i]);
+        });
+        for (size_t i = 0; i < count; i++) {
+            os.write(reinterpret_cast<const char *>(decoded[i].data()), decoded[i].size());
+            total += decoded[i].size();
+        }
+        if (!os) {
+            throw std::runtime_error("failed writing the decoded data");
+        }
+    }
+
+    //The index has to list exactly the frames that were read
+    for (size_t i = 0; i < blocks.size(); i++) {
+        uint64_t entryOffset = i == 0 ? firstWord : readContainerField<uint64_t>(is);
+        uint32_t rawSize = readContainerField<uint32_t>(is);
+        uint32_t encodedSize = readContainerField<uint32_t>(is);
+        uint32_t checksum = readContainerField<uint32_t>(is);
+        if (entryOffset != blocks[i].offset || rawSize != blocks[i].rawSize ||
+            encodedSize != blocks[i].encodedSize || checksum != blocks[i].checksum) {
+            throw std::runtime_error("container block index does not match the blocks");
+        }
+    }
+    uint64_t indexOffset = blocks.empty() ? firstWord : readContainerField<uint64_t>(is);
+    uint32_t blockCount = readContainerField<uint32_t>(is);
+    if (header.version != containerCrc32Version && readContainerField<uint32_t>(is) != dataChecksum) {
+        throw std::runtime_error("container data checksum does not match the blocks");
+    }
+    char magic[4];
+    if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, containerIndexMagic) ||
+        indexOffset != offset || blockCount != blocks.size()) {
+        throw std::runtime_error("container block index is missing or corrupted");
+    }
+    if (header.originalSize != containerUnknownSize && total != header.originalSize) {
+        throw std::runtime_error("container blocks do not add up to the original size");
+    }
+}
+
+/*
+* Container Append
+* Encodes the input as further blocks of an existing container, opened for
+* reading and writing. The blocks already there are neither read nor
+* rewritten: the new ones go where the index was, followed by an index of
+* all of them, and a known original size in the header is updated in place.
+* The container keeps its version, so version 2 blocks stay CRC-32.
+* An append that fails part way leaves the container without a valid index.
+* Returns the number of bytes appended.
+*/
+uint64_t containerAppend(std::iostream &container, std::istream &is, ThreadPool &pool, ContainerCodecs &codecs) {
+    container.seekg(0);
+    ContainerHeader header = readContainer(container);
+    if (header.originalSize != containerUnknownSize && header.originalSize != header.rawSize()) {
+        throw std::runtime_error("container blocks do not add up to the original size");
+    }
+    uint64_t indexOffset = header.blocks.empty() ? containerHeaderSize(header) :
+        header.blocks.back().offset + containerFrameSize + header.blocks.back().encodedSize;
+
+    //Nothing is written until there is at least one new byte
+    if (is.peek() == std::char_traits<char>::eof()) {
+        return 0;
+    }
+    container.seekp(std::streamoff(indexOffset));
+    ContainerWriter writer(container, header, indexOffset);
+    containerEncodeBlocks(is, writer, header, pool, codecs);
+    writer.finish();
+
+    uint64_t appended = 0;
+    for (size_t i = header.blocks.size(); i < writer.indexBlocks().size(); i++) {
+        appended += writer.indexBlocks()[i].rawSize;
+    }
+    if (header.originalSize != containerUnknownSize) {
+        container.seekp(std::streamoff(containerHeaderSize(header) - sizeof(uint16_t) - header.extension.size() -
+            sizeof(uint64_t)));
+        writeContainerField<uint64_t>(container, header.originalSize + appended);
+    }
+    if (!container.flush()) {
+        throw std::runtime_error("failed writing the container");
+    }
+    return appended;
+}
+
+//True if the file starts with the container magic
+bool isContainer(const std::string &fileName) {
+    std::ifstream is(fileName, std::ios::binary);
+    char magic[4];
+    return is.read(magic, sizeof(magic)) && std::equal(magic, magic + 4, containerMagic);
+}
+
+#endif //CONTAINER_HPP
@@ -0,0 +1,510 @@
+#ifndef DEDUP_ARCHIVE_HPP
+#define DEDUP_ARCHIVE_HPP
+
+/*
+DedupArchive:
+Many files in one container, with content shared between them stored once.
+Every file is cut into chunks at content-defined boundaries (FastCDC: a Gear
+rolling hash, with a stricter mask before the average chunk size and a
+looser one after it), so an insertion only moves the boundaries near it.
+Each chunk's fingerprint goes into a hash table; a chunk seen before in the
+archive becomes a reference, and only new chunks go on to the codec chain.
+Fingerprints are two independent 64-bit hashes plus the length, which is
+safe against accidental collisions but not against crafted ones.
+----------------------------------------------------------
+The container's raw data is the new chunks back to back, then the manifest:
+    per file: u16 name length + name, u64 size, u32 piece count, and per
+              piece the u64 raw offset and u32 length of its bytes
+    trailer:  u64 raw offset of the manifest, u32 file count, "ARBM"
+Adjacent pieces are merged, so a file without repeats is a single piece.
+Extraction reads the manifest and the pieces through range reads of the
+container, keeping recently decoded blocks.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <streambuf>
+#include <istream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include "Container.hpp"
+#include "MappedFile.hpp"
+#include "BatchCompress.hpp"
+#include "StageStats.hpp"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+const char dedupManifestMagic[4] = {'A', 'R', 'B', 'M'};
+const size_t dedupTrailerSize = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(dedupManifestMagic);
+const size_t cdcMinSize = 2 * 1024;
+const size_t cdcAverageSize = 8 * 1024;
+const size_t cdcMaxSize = 64 * 1024;
+//FastCDC masks for 8 KiB chunks: 15 bits below the average size, 11 above
+const uint64_t cdcMaskSmall = 0x0000d9f003530000ull;
+const uint64_t cdcMaskLarge = 0x0000d90003530000ull;
+
+//Random value per byte for the Gear hash, the same in every run
+struct GearTable {
+    uint64_t entries[256];
+
+    GearTable() {
+        uint64_t state = 0x9E3779B97F4A7C15ull;
+        for (auto &entry : entries) {
+            //splitmix64
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            entry = z ^ (z >> 31);
+        }
+    }
+};
+
+const uint64_t *gearTable() {
+    static const GearTable table;
+    return table.entries;
+}
+
+/*
+* CDC Chunk Length
+* Length of the chunk starting at data: the first Gear hash cut point past
+* the minimum size, or the maximum size, or whatever is left
+*/
+size_t cdcChunkLength(const unsigned char *data, size_t size) {
+    if (size <= cdcMinSize) {
+        return size;
+    }
+    const uint64_t *gear = gearTable();
+    size_t end = std::min(size, cdcMaxSize);
+    size_t normal = std::min(end, cdcAverageSize);
+    uint64_t hash = 0;
+    size_t i = cdcMinSize;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & cdcMaskSmall)) {
+            return i + 1;
+        }
+    }
+    for (; i < end; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & cdcMaskLarge)) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+//Identity of a chunk's content
+struct ChunkFingerprint {
+    uint64_t first;
+    uint64_t second;
+    uint32_t length;
+
+    bool operator==(const ChunkFingerprint &other) const {
+        return first == other.first && second == other.second && length == other.length;
+    }
+};
+
+struct ChunkFingerprintHash {
+    size_t operator()(const ChunkFingerprint &fingerprint) const {
+        return size_t(fingerprint.first);
+    }
+};
+
+//64-bit hash of data taking eight bytes a step, seeded so two seeds give independent hashes
+uint64_t chunkHash(const unsigned char *data, size_t size, uint64_t seed) {
+    const uint64_t multiplier = 0x9FB21C651E98DF25ull;
+    uint64_t hash = seed ^ (size * multiplier);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ (word * multiplier)) * 0xC2B2AE3D27D4EB4Full;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, size - i);
+    hash = (hash ^ (tail * multiplier)) * 0xC2B2AE3D27D4EB4Full;
+    hash ^= hash >> 32;
+    hash *= 0x165667B19E3779F9ull;
+    return hash ^ (hash >> 29);
+}
+
+ChunkFingerprint chunkFingerprint(const unsigned char *data, size_t size) {
+    return ChunkFingerprint{chunkHash(data, size, 0x243F6A8885A308D3ull), chunkHash(data, size, 0x13198A2E03707344ull),
+        uint32_t(size)};
+}
+
+//A run of a file's bytes in the archive's raw data
+struct DedupPiece {
+    uint64_t offset;
+    uint32_t length;
+};
+
+struct DedupEntry {
+    std::string name;
+    uint64_t size = 0;
+    std::vector<DedupPiece> pieces;
+};
+
+//What deduplication found
+struct DedupTotals {
+    uint64_t inputBytes = 0;
+    uint64_t uniqueBytes = 0;
+    uint64_t chunks = 0;
+    uint64_t repeatedChunks = 0;
+};
+
+/*
+* Dedup Buffer
+* Stream buffer whose bytes are the new chunks of the files in order, then the
+* manifest. Chunks are handed out straight from the mapped file, one mapping
+* open at a time. A file that cannot be read is marked in its BatchFile and
+* left out.
+*/
+class DedupBuffer : public std::streambuf {
+public:
+    explicit DedupBuffer(std::vector<BatchFile> &files_p)
+        : files(files_p), nextFile(0), filePosition(0), rawOffset(0), finished(false) {}
+
+    const DedupTotals &totals() const { return dedupTotals; }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        while (!finished) {
+            if (input.data() != nullptr && filePosition < input.size()) {
+                const unsigned char *chunk = input.data() + filePosition;
+                size_t length = cdcChunkLength(chunk, input.size() - filePosition);
+                filePosition += length;
+                if (addChunk(chunk, length)) {
+                    char *begin = const_cast<char *>(reinterpret_cast<const char *>(chunk));
+                    setg(begin, begin, begin + length);
+                    return traits_type::to_int_type(*gptr());
+                }
+                continue;
+            }
+            if (!openNextFile()) {
+                writeManifest();
+                finished = true;
+                setg(&manifest[0], &manifest[0], &manifest[0] + manifest.size());
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+        return traits_type::eof();
+    }
+
+private:
+    //Records the chunk in the current file's pieces; true if it is new and has to be stored
+    bool addChunk(const unsigned char *chunk, size_t length) {
+        StageScope scope("dedupChunk", length);
+        ChunkFingerprint fingerprint = chunkFingerprint(chunk, length);
+        auto found = seen.find(fingerprint);
+        bool repeated = found != seen.end();
+        uint64_t offset = repeated ? found->second : rawOffset;
+        if (!repeated) {
+            seen.emplace(fingerprint, rawOffset);
+            rawOffset += length;
+            dedupTotals.uniqueBytes += length;
+        }
+        dedupTotals.chunks++;
+        dedupTotals.repeatedChunks += repeated ? 1 : 0;
+
+        //Continues the previous piece when the bytes follow on
+        std::vector<DedupPiece> &pieces = entries.back().pieces;
+        if (!pieces.empty() && pieces.back().offset + pieces.back().length == offset &&
+            uint64_t(pieces.back().length) + length <= UINT32_MAX) {
+            pieces.back().length += uint32_t(length);
+        } else {
+            pieces.push_back(DedupPiece{offset, uint32_t(length)});
+        }
+        return !repeated;
+    }
+
+    //Maps the next readable file and starts its manifest entry; false when there are none left
+    bool openNextFile() {
+        input.close();
+        filePosition = 0;
+        while (nextFile < files.size()) {
+            BatchFile &file = files[nextFile++];
+            if (!file.error.empty()) {
+                continue;
+            }
+            try {
+                input.open(file.name);
+            }
+            catch (std::runtime_error const &error) {
+                file.error = error.what();
+                continue;
+            }
+            input.adviseSequential();
+            DedupEntry entry;
+            entry.name = file.name;
+            entry.size = input.size();
+            entries.push_back(entry);
+            dedupTotals.inputBytes += input.size();
+            return true;
+        }
+        return false;
+    }
+
+    template <class T>
+    void put(T value) {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        manifest.insert(manifest.end(), bytes, bytes + sizeof(T));
+    }
+
+    void writeManifest() {
+        uint64_t manifestOffset = rawOffset;
+        for (auto &entry : entries) {
+            put<uint16_t>(uint16_t(std::min<size_t>(entry.name.size(), UINT16_MAX)));
+            manifest.insert(manifest.end(), entry.name.begin(), entry.name.begin() + std::min<size_t>(entry.name.size(), UINT16_MAX));
+            put<uint64_t>(entry.size);
+            put<uint32_t>(uint32_t(entry.pieces.size()));
+            for (auto &piece : entry.pieces) {
+                put<uint64_t>(piece.offset);
+                put<uint32_t>(piece.length);
+            }
+        }
+        put<uint64_t>(manifestOffset);
+        put<uint32_t>(uint32_t(entries.size()));
+        manifest.insert(manifest.end(), dedupManifestMagic, dedupManifestMagic + sizeof(dedupManifestMagic));
+    }
+
+    std::vector<BatchFile> &files;
+    size_t nextFile;
+    MappedFile input;
+    size_t filePosition;
+    uint64_t rawOffset;          //Raw offset the next new chunk will have
+    std::unordered_map<ChunkFingerprint, uint64_t, ChunkFingerprintHash> seen;
+    std::vector<DedupEntry> entries;
+    std::vector<char> manifest;
+    bool finished;
+    DedupTotals dedupTotals;
+};
+
+/*
+* Dedup Archive Compress
+* Writes every readable file into one container with the header's chain and
+* block size, repeated chunks stored once
+*/
+DedupTotals dedupArchiveCompress(std::vector<BatchFile> &files, std::ostream &os, ContainerHeader header,
+        ThreadPool &pool) {
+    DedupBuffer buffer(files);
+    std::istream is(&buffer);
+    is.exceptions(std::ios::badbit);
+    header.originalSize = containerUnknownSize;
+    header.extension = "dedup";
+    containerCompress(is, os, header, pool);
+    return buffer.totals();
+}
+
+/*
+* Container Block Cache
+* Raw bytes of a seekable container by offset, keeping the most recently
+* decoded blocks, since neighbouring pieces usually share a block
+*/
+class ContainerBlockCache {
+public:
+    //Keeps about 64 MiB of decoded blocks, and never fewer than four
+    ContainerBlockCache(std::istream &is_p, const ContainerHeader &header_p)
+        : is(is_p), header(header_p), pipeline(header_p.chain),
+          capacity(std::max<size_t>(4, (64u << 20) / std::max<uint32_t>(header_p.blockSize, 1))), clock(0) {}
+
+    //Appends bytes [offset, offset + length) of the raw data to out
+    void read(uint64_t offset, uint64_t length, std::vector<unsigned char> &out) {
+        const std::vector<uint64_t> &offsets = header.rawOffsets;
+        if (offset > header.rawSize() || length > header.rawSize() - offset) {
+            throw std::runtime_error("archive refers past the end of its data");
+        }
+        while (length > 0) {
+            size_t index = size_t(std::upper_bound(offsets.begin(), offsets.end(), offset) - offsets.begin()) - 1;
+            const std::vector<unsigned char> &raw = block(index);
+            uint64_t from = offset - offsets[index];
+            uint64_t count = std::min(length, uint64_t(raw.size()) - from);
+            out.insert(out.end(), raw.begin() + from, raw.begin() + from + count);
+            offset += count;
+            length -= count;
+        }
+    }
+
+private:
+    struct Slot {
+        size_t index;
+        uint64_t lastUse;
+        std::vector<unsigned char> raw;
+    };
+
+    const std::vector<unsigned char> &block(size_t index) {
+        clock++;
+        for (auto &slot : slots) {
+            if (slot.index == index) {
+                slot.lastUse = clock;
+                return slot.raw;
+            }
+        }
+        //The least recently used slot is reused once the cache is full
+        Slot *target;
+        if (slots.size() < capacity) {
+            slots.push_back(Slot());
+            target = &slots.back();
+        } else {
+            target = &*std::min_element(slots.begin(), slots.end(), [](const Slot &a, const Slot &b) {
+                return a.lastUse < b.lastUse;
+            });
+        }
+        target->index = index;
+        target->lastUse = clock;
+        readContainerBlock(is, header.blocks[index], encoded);
+        decodeContainerBlock(pipeline, header.version, header.blocks[index], encoded, target->raw);
+        return target->raw;
+    }
+
+    std::istream &is;
+    const ContainerHeader &header;
+    CodecPipeline pipeline;
+    size_t capacity;
+    uint64_t clock;
+    std::vector<Slot> slots;
+    std::vector<unsigned char> encoded;
+};
+
+template <class T>
+T readManifestField(const std::vector<unsigned char> &manifest, size_t &position) {
+    if (manifest.size() - position < sizeof(T)) {
+        throw std::runtime_error("archive manifest is truncated");
+    }
+    T value;
+    std::memcpy(&value, manifest.data() + position, sizeof(T));
+    position += sizeof(T);
+    return value;
+}
+
+/*
+* Read Dedup Manifest
+* The files of an archive and where their bytes are
+*/
+std::vector<DedupEntry> readDedupManifest(ContainerBlockCache &cache, const ContainerHeader &header) {
+    uint64_t rawSize = header.rawSize();
+    if (rawSize < dedupTrailerSize) {
+        throw std::runtime_error("not a deduplicated archive");
+    }
+    std::vector<unsigned char> trailer;
+    cache.read(rawSize - dedupTrailerSize, dedupTrailerSize, trailer);
+    size_t position = 0;
+    uint64_t manifestOffset = readManifestField<uint64_t>(trailer, position);
+    uint32_t fileCount = readManifestField<uint32_t>(trailer, position);
+    if (!std::equal(dedupManifestMagic, dedupManifestMagic + 4, trailer.begin() + position) ||
+        manifestOffset > rawSize - dedupTrailerSize) {
+        throw std::runtime_error("not a deduplicated archive");
+    }
+
+    std::vector<unsigned char> manifest;
+    cache.read(manifestOffset, rawSize - dedupTrailerSize - manifestOffset, manifest);
+    position = 0;
+    std::vector<DedupEntry> entries(fileCount);
+    for (auto &entry : entries) {
+        uint16_t nameLength = readManifestField<uint16_t>(manifest, position);
+        if (manifest.size() - position < nameLength) {
+            throw std::runtime_error("archive manifest is truncated");
+        }
+        entry.name.assign(manifest.begin() + position, manifest.begin() + position + nameLength);
+        position += nameLength;
+        entry.size = readManifestField<uint64_t>(manifest, position);
+        uint32_t pieceCount = readManifestField<uint32_t>(manifest, position);
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < pieceCount; i++) {
+            DedupPiece piece;
+            piece.offset = readManifestField<uint64_t>(manifest, position);
+            piece.length = readManifestField<uint32_t>(manifest, position);
+            if (piece.offset > manifestOffset || piece.length > manifestOffset - piece.offset) {
+                throw std::runtime_error("archive manifest refers past the stored chunks");
+            }
+            total += piece.length;
+            entry.pieces.push_back(piece);
+        }
+        if (total != entry.size) {
+            throw std::runtime_error("archive manifest pieces do not add up for " + entry.name);
+        }
+    }
+    return entries;
+}
+
+/*
+* Extraction Path
+* Where a stored name is written below the output directory; leading
+* slashes, drive letters and ".." parts are dropped so nothing lands outside it
+*/
+std::string extractionPath(const std::string &outputDirectory, const std::string &name) {
+    std::string path = outputDirectory;
+    std::string part;
+    for (size_t i = 0; i <= name.size(); i++) {
+        if (i == name.size() || name[i] == '/' || name[i] == '\\') {
+            if (!part.empty() && part != "." && part != ".." && part.back() != ':') {
+                path += "/" + part;
+            }
+            part.clear();
+        } else {
+            part += name[i];
+        }
+    }
+    return path;
+}
+
+//Creates every directory on the way to path; existing ones are fine
+void makeParentDirectories(const std::string &path) {
+    for (size_t i = 1; i < path.size(); i++) {
+        if (path[i] == '/') {
+#ifdef _WIN32
+            _mkdir(path.substr(0, i).c_str());
+#else
+            mkdir(path.substr(0, i).c_str(), 0755);
+#endif
+        }
+    }
+}
+
+/*
+* Dedup Archive Extract
+* Writes every file of the archive below outputDirectory and returns the
+* paths written
+*/
+std::vector<std::string> dedupArchiveExtract(std::istream &is, const std::string &outputDirectory) {
+    ContainerHeader header = readContainer(is);
+    ContainerBlockCache cache(is, header);
+    std::vector<DedupEntry> entries = readDedupManifest(cache, header);
+
+    std::vector<std::string> written;
+    std::vector<unsigned char> bytes;
+    for (auto &entry : entries) {
+        std::string path = extractionPath(outputDirectory, entry.name);
+        makeParentDirectories(path);
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os.is_open()) {
+            throw std::runtime_error("could not create " + path);
+        }
+        for (auto &piece : entry.pieces) {
+            bytes.clear();
+            cache.read(piece.offset, piece.length, bytes);
+            os.write(reinterpret_cast<const char *>(bytes.data()), std::streamsize(bytes.size()));
+        }
+        os.close();
+        if (!os) {
+            throw std::runtime_error("could not write " + path);
+        }
+        written.push_back(path);
+    }
+    return written;
+}
+
+#endif //DEDUP_ARCHIVE_HPP
@@ -0,0 +1,911 @@
+#ifndef DEFLATE_ALGO_HPP
+#define DEFLATE_ALGO_HPP
+
+/*
+DeflateAlgo:
+A self-contained DEFLATE (RFC 1951) inflater and deflater, with the zlib
+(RFC 1950) and gzip (RFC 1952) wrappers around it, so PNG data can be decoded
+and we can write streams that zlib/gzip tools read.
+Inflate decodes through lookup tables indexed by the next bits of input.
+Deflate finds matches with hash chains; level 1-3 take the first good match
+(fast), level 4-9 also try the next position before committing (lazy), and
+level 0 only writes stored blocks. Each block is written stored, with the
+fixed codes or with its own dynamic codes, whichever is smallest.
+----------------------------------------------------------
+Reference: RFC 1951 https://www.ietf.org/rfc/rfc1951.txt
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include "Checksum.hpp"
+#include "StageStats.hpp"
+
+/* DEFLATE constants */
+const uint16_t deflateLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t deflateLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t deflateDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t deflateDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+//Order the code length code lengths are stored in
+const uint8_t deflateCodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+const int deflateWindowSize = 32768;
+const int deflateMaxMatch = 258;
+const int deflateMinMatch = 3;
+
+//Reverses the lowest 'length' bits, DEFLATE sends Huffman codes MSB first
+uint32_t reverseBits(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+/*
+* Canonical Codes
+* Assigns canonical Huffman codes from code lengths (RFC 1951 3.2.2)
+*/
+std::vector<uint32_t> canonicalCodes(const uint8_t *lengths, int count) {
+    int lengthCount[16] = {0};
+    for (int i = 0; i < count; i++) {
+        lengthCount[lengths[i]]++;
+    }
+    lengthCount[0] = 0;
+    uint32_t nextCode[16] = {0};
+    uint32_t code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + lengthCount[bits - 1]) << 1;
+        nextCode[bits] = code;
+    }
+    std::vector<uint32_t> codes(count, 0);
+    for (int i = 0; i < count; i++) {
+        if (lengths[i] != 0) {
+            codes[i] = nextCode[lengths[i]]++;
+        }
+    }
+    return codes;
+}
+
+/****************Inflate Functions*********************/
+
+/*
+* Inflate Table
+* Every entry is indexed by the next 'bits' input bits and holds
+* (symbol << 4) | code length; 0 marks bit patterns no code uses.
+*/
+struct InflateTable {
+    std::vector<uint32_t> entries;
+    unsigned bits = 0;
+};
+
+void buildInflateTable(const uint8_t *lengths, int count, InflateTable &table) {
+    int lengthCount[16] = {0};
+    unsigned maxLength = 0;
+    for (int i = 0; i < count; i++) {
+        lengthCount[lengths[i]]++;
+        maxLength = std::max<unsigned>(maxLength, lengths[i]);
+    }
+
+    //Over-subscribed codes cannot be decoded; incomplete ones can
+    int left = 1;
+    for (int bits = 1; bits < 16; bits++) {
+        left = (left << 1) - lengthCount[bits];
+        if (left < 0) {
+            throw std::runtime_error("invalid DEFLATE code lengths");
+        }
+    }
+
+    table.bits = std::max(maxLength, 1u);
+    table.entries.assign(size_t(1) << table.bits, 0);
+    std::vector<uint32_t> codes = canonicalCodes(lengths, count);
+    for (int symbol = 0; symbol < count; symbol++) {
+        unsigned length = lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+        uint32_t entry = (uint32_t(symbol) << 4) | length;
+        for (size_t i = reverseBits(codes[symbol], length); i < table.entries.size(); i += size_t(1) << length) {
+            table.entries[i] = entry;
+        }
+    }
+}
+
+//Reads the compressed bit stream, least significant bit first
+class InflateBitReader {
+public:
+    InflateBitReader(const unsigned char *data_p, size_t size_p)
+        : data(data_p), size(size_p), pos(0), bitBuffer(0), bitCount(0) {}
+
+    //Bytes past the end read as zero; running far past it means truncated input
+    void refill() {
+        while (bitCount <= 56) {
+            uint64_t byte = pos < size ? data[pos] : 0;
+            if (pos >= size + 8) {
+                throw std::runtime_error("DEFLATE stream is truncated");
+            }
+            bitBuffer |= byte << bitCount;
+            bitCount += 8;
+            pos++;
+        }
+    }
+
+    uint32_t bits(unsigned count) {
+        if (bitCount < count) {
+            refill();
+        }
+        uint32_t value = uint32_t(bitBuffer & ((uint64_t(1) << count) - 1));
+        bitBuffer >>= count;
+        bitCount -= count;
+        return value;
+    }
+
+    uint32_t decode(const InflateTable &table) {
+        if (bitCount < table.bits) {
+            refill();
+        }
+        uint32_t entry = table.entries[bitBuffer & ((uint64_t(1) << table.bits) - 1)];
+        if (entry == 0) {
+            throw std::runtime_error("invalid DEFLATE code");
+        }
+        bitBuffer >>= (entry & 15);
+        bitCount -= (entry & 15);
+        return entry >> 4;
+    }
+
+    //Drops the buffered bits so the next read starts on a byte boundary
+    void alignToByte() {
+        pos = bytesConsumed();
+        bitBuffer = 0;
+        bitCount = 0;
+    }
+
+    size_t bytesConsumed() const {
+        return pos - bitCount / 8;
+    }
+
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+
+private:
+    uint64_t bitBuffer;
+    unsigned bitCount;
+};
+
+//Fixed litlen and distance tables (RFC 1951 3.2.6), built once
+struct FixedInflateTables {
+    InflateTable litLen;
+    InflateTable dist;
+
+    FixedInflateTables() {
+        uint8_t lengths[288];
+        std::fill(lengths, lengths + 144, 8);
+        std::fill(lengths + 144, lengths + 256, 9);
+        std::fill(lengths + 256, lengths + 280, 7);
+        std::fill(lengths + 280, lengths + 288, 8);
+        buildInflateTable(lengths, 288, litLen);
+        std::fill(lengths, lengths + 30, 5);
+        buildInflateTable(lengths, 30, dist);
+    }
+};
+
+const FixedInflateTables &fixedInflateTables() {
+    static const FixedInflateTables tables;
+    return tables;
+}
+
+/*
+* Read Dynamic Tables
+* Reads the code length code, then the litlen and distance code lengths
+*/
+void readDynamicTables(InflateBitReader &reader, InflateTable &litLen, InflateTable &dist) {
+    int litLenCount = reader.bits(5) + 257;
+    int distCount = reader.bits(5) + 1;
+    int codeLengthCount = reader.bits(4) + 4;
+    if (litLenCount > 286 || distCount > 30) {
+        throw std::runtime_error("invalid DEFLATE table sizes");
+    }
+
+    uint8_t codeLengthLengths[19] = {0};
+    for (int i = 0; i < codeLengthCount; i++) {
+        codeLengthLengths[deflateCodeLengthOrder[i]] = (uint8_t)reader.bits(3);
+    }
+    InflateTable codeLengthTable;
+    buildInflateTable(codeLengthLengths, 19, codeLengthTable);
+
+    uint8_t lengths[286 + 30] = {0};
+    int total = litLenCount + distCount;
+    for (int i = 0; i < total;) {
+        uint32_t symbol = reader.decode(codeLengthTable);
+        if (symbol < 16) {
+            lengths[i++] = (uint8_t)symbol;
+            continue;
+        }
+        int repeat;
+        uint8_t value = 0;
+        if (symbol == 16) {
+            if (i == 0) {
+                throw std::runtime_error("DEFLATE repeat with no previous length");
+            }
+            value = lengths[i - 1];
+            repeat = 3 + reader.bits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + reader.bits(3);
+        } else {
+            repeat = 11 + reader.bits(7);
+        }
+        if (i + repeat > total) {
+            throw std::runtime_error("DEFLATE code lengths overflow");
+        }
+        std::fill(lengths + i, lengths + i + repeat, value);
+        i += repeat;
+    }
+    if (lengths[256] == 0) {
+        throw std::runtime_error("DEFLATE block has no end code");
+    }
+    buildInflateTable(lengths, litLenCount, litLen);
+    buildInflateTable(lengths + litLenCount, distCount, dist);
+}
+
+/*
+* Inflate Decompress
+* Decodes a raw DEFLATE stream, appending to 'out', and throws once it would
+* pass limit bytes. Returns the number of input bytes the stream used.
+*/
+size_t inflateDecompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        size_t limit = SIZE_MAX) {
+    StageScope scope("inflate");
+    scope.countOutput(out);
+    InflateBitReader reader(data, size);
+    const size_t streamStart = out.size();
+    InflateTable dynamicLitLen, dynamicDist;
+
+    bool finalBlock = false;
+    while (!finalBlock) {
+        finalBlock = reader.bits(1) != 0;
+        uint32_t blockType = reader.bits(2);
+
+        if (blockType == 0) {
+            //Stored block: LEN, NLEN, then LEN raw bytes
+            reader.alignToByte();
+            if (reader.pos + 4 > size) {
+                throw std::runtime_error("DEFLATE stream is truncated");
+            }
+            uint32_t length = data[reader.pos] | (data[reader.pos + 1] << 8);
+            uint32_t lengthCheck = data[reader.pos + 2] | (data[reader.pos + 3] << 8);
+            if ((length ^ 0xFFFF) != lengthCheck) {
+                throw std::runtime_error("corrupted DEFLATE stored block");
+            }
+            reader.pos += 4;
+            if (reader.pos + length > size) {
+                throw std::runtime_error("DEFLATE stream is truncated");
+            }
+            if (length > limit - (out.size() - streamStart)) {
+                throw std::runtime_error("DEFLATE stream decodes past the block size");
+            }
+            out.insert(out.end(), data + reader.pos, data + reader.pos + length);
+            reader.pos += length;
+            continue;
+        }
+
+        const InflateTable *litLen;
+        const InflateTable *dist;
+        if (blockType == 1) {
+            litLen = &fixedInflateTables().litLen;
+            dist = &fixedInflateTables().dist;
+        } else if (blockType == 2) {
+            readDynamicTables(reader, dynamicLitLen, dynamicDist);
+            litLen = &dynamicLitLen;
+            dist = &dynamicDist;
+        } else {
+            throw std::runtime_error("invalid DEFLATE block type");
+        }
+
+        while (true) {
+            uint32_t symbol = reader.decode(*litLen);
+            if (symbol < 256) {
+                if (out.size() - streamStart >= limit) {
+                    throw std::runtime_error("DEFLATE stream decodes past the block size");
+                }
+                out.push_back((unsigned char)symbol);
+                continue;
+            }
+            if (symbol == 256) {
+                break;
+            }
+            symbol -= 257;
+            if (symbol >= 29) {
+                throw std::runtime_error("invalid DEFLATE length code");
+            }
+            size_t length = deflateLengthBase[symbol] + reader.bits(deflateLengthExtra[symbol]);
+            uint32_t distSymbol = reader.decode(*dist);
+            if (distSymbol >= 30) {
+                throw std::runtime_error("invalid DEFLATE distance code");
+            }
+            size_t distance = deflateDistBase[distSymbol] + reader.bits(deflateDistExtra[distSymbol]);
+            if (distance > out.size() - streamStart) {
+                throw std::runtime_error("DEFLATE distance is too far back");
+            }
+            if (length > limit - (out.size() - streamStart)) {
+                throw std::runtime_error("DEFLATE stream decodes past the block size");
+            }
+
+            //Byte by byte, since a match may overlap the bytes it produces
+            size_t outPos = out.size();
+            out.resize(outPos + length);
+            unsigned char *dst = out.data() + outPos;
+            const unsigned char *src = dst - distance;
+            for (size_t i = 0; i < length; i++) {
+                dst[i] = src[i];
+            }
+        }
+    }
+
+    size_t consumed = reader.bytesConsumed();
+    if (consumed > size) {
+        throw std::runtime_error("DEFLATE stream is truncated");
+    }
+    scope.addBytesIn(consumed);
+    return consumed;
+}
+
+/****************Deflate Functions*********************/
+
+//Writes the compressed bit stream, least significant bit first
+class DeflateBitWriter {
+public:
+    explicit DeflateBitWriter(std::vector<unsigned char> &out_p) : out(out_p), bitBuffer(0), bitCount(0) {}
+
+    void put(uint32_t value, unsigned count) {
+        bitBuffer |= uint64_t(value) << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            out.push_back((unsigned char)bitBuffer);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    void alignToByte() {
+        if (bitCount > 0) {
+            put(0, 8 - bitCount);
+        }
+    }
+
+private:
+    std::vector<unsigned char> &out;
+    uint64_t bitBuffer;
+    unsigned bitCount;
+};
+
+/*
+* Build Code Lengths
+* Huffman code lengths for the given frequencies, limited to maxLength bits.
+* Over-long codes are clamped and the code is rebalanced by lengthening
+* shorter codes until it is complete again.
+*/
+void buildCodeLengths(const uint32_t *freqs, int count, int maxLength, uint8_t *lengths) {
+    std::fill(lengths, lengths + count, 0);
+    std::vector<std::pair<uint32_t, int>> symbols;
+    for (int i = 0; i < count; i++) {
+        if (freqs[i] != 0) {
+            symbols.push_back(std::make_pair(freqs[i], i));
+        }
+    }
+    //Always at least two codes, so every tree is complete
+    for (int i = 0; symbols.size() < 2; i++) {
+        if (freqs[i] == 0) {
+            symbols.push_back(std::make_pair(1u, i));
+        }
+    }
+    std::sort(symbols.begin(), symbols.end());
+
+    //Two-queue Huffman: leaves are sorted, merged nodes come out in order
+    size_t n = symbols.size();
+    std::vector<uint64_t> weight(2 * n - 1);
+    std::vector<size_t> parent(2 * n - 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        weight[i] = symbols[i].first;
+    }
+    size_t nextLeaf = 0, nextMerged = n;
+    for (size_t node = n; node < 2 * n - 1; node++) {
+        size_t children[2];
+        for (size_t &child : children) {
+            if (nextLeaf < n && (nextMerged >= node || weight[nextLeaf] <= weight[nextMerged])) {
+                child = nextLeaf++;
+            } else {
+                child = nextMerged++;
+            }
+        }
+        weight[node] = weight[children[0]] + weight[children[1]];
+        parent[children[0]] = parent[children[1]] = node;
+    }
+
+    //Depths, root first; parents are always created after their children
+    std::vector<int> depth(2 * n - 1, 0);
+    int lengthCount[64] = {0};
+    for (size_t node = 2 * n - 1; node-- > 0;) {
+        if (node != 2 * n - 2) {
+            depth[node] = depth[parent[node]] + 1;
+        }
+        if (node < n) {
+            lengthCount[std::min(depth[node], maxLength)]++;
+        }
+    }
+
+    //Rebalance after clamping (Kraft sum back to exactly 1)
+    uint32_t total = 0;
+    for (int bits = 1; bits <= maxLength; bits++) {
+        total += uint32_t(lengthCount[bits]) << (maxLength - bits);
+    }
+    while (total != (1u << maxLength)) {
+        lengthCount[maxLength]--;
+        for (int bits = maxLength - 1; bits > 0; bits--) {
+            if (lengthCount[bits] != 0) {
+                lengthCount[bits]--;
+                lengthCount[bits + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    //Least frequent symbols get the longest codes
+    size_t next = 0;
+    for (int bits = maxLength; bits > 0; bits--) {
+        for (int k = 0; k < lengthCount[bits]; k++) {
+            lengths[symbols[next++].second] = (uint8_t)bits;
+        }
+    }
+}
+
+//A literal (distance 0) or a match
+struct DeflateToken {
+    uint16_t litLen;
+    uint16_t distance;
+};
+
+int deflateLengthSymbol(int length) {
+    int index = int(std::upper_bound(deflateLengthBase, deflateLengthBase + 29, length) - deflateLengthBase) - 1;
+    return index;
+}
+
+int deflateDistSymbol(int distance) {
+    return int(std::upper_bound(deflateDistBase, deflateDistBase + 30, distance) - deflateDistBase) - 1;
+}
+
+/*
+* Write Block
+* Writes the tokens of one block with whichever encoding is smallest:
+* stored, fixed codes or dynamic codes
+*/
+void writeDeflateBlock(DeflateBitWriter &writer, const std::vector<DeflateToken> &tokens,
+        const unsigned char *raw, size_t rawSize, bool finalBlock, bool storeOnly) {
+    uint32_t litLenFreq[286] = {0};
+    uint32_t distFreq[30] = {0};
+    uint64_t extraBits = 0;
+    for (const DeflateToken &token : tokens) {
+        if (token.distance == 0) {
+            litLenFreq[token.litLen]++;
+        } else {
+            int lengthSymbol = deflateLengthSymbol(token.litLen);
+            int distSymbol = deflateDistSymbol(token.distance);
+            litLenFreq[257 + lengthSymbol]++;
+            distFreq[distSymbol]++;
+            extraBits += deflateLengthExtra[lengthSymbol] + deflateDistExtra[distSymbol];
+        }
+    }
+    litLenFreq[256] = 1;
+
+    //Dynamic code lengths
+    uint8_t lengths[286 + 30];
+    buildCodeLengths(litLenFreq, 286, 15, lengths);
+    buildCodeLengths(distFreq, 30, 15, lengths + 286);
+    int litLenCount = 286;
+    while (litLenCount > 257 && lengths[litLenCount - 1] == 0) litLenCount--;
+    int distCount = 30;
+    while (distCount > 1 && lengths[286 + distCount - 1] == 0) distCount--;
+
+    //Run length code the lengths with symbols 16 (repeat), 17 and 18 (zeros)
+    uint8_t allLengths[286 + 30];
+    std::copy(lengths, lengths + litLenCount, allLengths);
+    std::copy(lengths + 286, lengths + 286 + distCount, allLengths + litLenCount);
+    int total = litLenCount + distCount;
+    std::vector<std::pair<uint8_t, uint8_t>> lengthCodes; //Symbol, extra bits value
+    uint32_t codeLengthFreq[19] = {0};
+    for (int i = 0; i < total;) {
+        int run = 1;
+        while (i + run < total && allLengths[i + run] == allLengths[i]) run++;
+        int value = allLengths[i];
+        i += run;
+        if (value == 0) {
+            while (run >= 11) {
+                int take = std::min(run, 138);
+                lengthCodes.push_back(std::make_pair(18, take - 11));
+                run -= take;
+            }
+            if (run >= 3) {
+                lengthCodes.push_back(std::make_pair(17, run - 3));
+                run = 0;
+            }
+        } else {
+            lengthCodes.push_back(std::make_pair(value, 0));
+            run--;
+            while (run >= 3) {
+                int take = std::min(run, 6);
+                lengthCodes.push_back(std::make_pair(16, take - 3));
+                run -= take;
+            }
+        }
+        while (run-- > 0) {
+            lengthCodes.push_back(std::make_pair(value, 0));
+        }
+    }
+    for (auto &code : lengthCodes) {
+        codeLengthFreq[code.first]++;
+    }
+    uint8_t codeLengthLengths[19];
+    buildCodeLengths(codeLengthFreq, 19, 7, codeLengthLengths);
+    int codeLengthCount = 19;
+    while (codeLengthCount > 4 && codeLengthLengths[deflateCodeLengthOrder[codeLengthCount - 1]] == 0) {
+        codeLengthCount--;
+    }
+
+    //Cost of each encoding, in bits
+    uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * codeLengthCount + extraBits;
+    for (auto &code : lengthCodes) {
+        dynamicBits += codeLengthLengths[code.first] + (code.first == 16 ? 2 : code.first == 17 ? 3 : code.first == 18 ? 7 : 0);
+    }
+    uint64_t fixedBits = 3 + extraBits;
+    for (int i = 0; i < 286; i++) {
+        dynamicBits += uint64_t(litLenFreq[i]) * lengths[i];
+        fixedBits += uint64_t(litLenFreq[i]) * (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+    }
+    for (int i = 0; i < 30; i++) {
+        dynamicBits += uint64_t(distFreq[i]) * lengths[286 + i];
+        fixedBits += uint64_t(distFreq[i]) * 5;
+    }
+    uint64_t storedBits = (rawSize + 5 * (rawSize / 65535 + 1)) * 8 + 7;
+
+    if (storeOnly || (storedBits <= fixedBits && storedBits <= dynamicBits)) {
+        size_t offset = 0;
+        do {
+            size_t chunk = std::min<size_t>(rawSize - offset, 65535);
+            bool lastChunk = offset + chunk == rawSize;
+            writer.put(finalBlock && lastChunk ? 1 : 0, 1);
+            writer.put(0, 2);
+            writer.alignToByte();
+            writer.put(uint32_t(chunk), 16);
+            writer.put(uint32_t(chunk) ^ 0xFFFF, 16);
+            for (size_t i = 0; i < chunk; i++) {
+                writer.put(raw[offset + i], 8);
+            }
+            offset += chunk;
+        } while (offset < rawSize);
+        return;
+    }
+
+    uint8_t fixedLengths[288 + 30];
+    const uint8_t *litLenLengths = lengths;
+    const uint8_t *distLengths = lengths + 286;
+    writer.put(finalBlock ? 1 : 0, 1);
+    if (fixedBits <= dynamicBits) {
+        writer.put(1, 2);
+        std::fill(fixedLengths, fixedLengths + 144, 8);
+        std::fill(fixedLengths + 144, fixedLengths + 256, 9);
+        std::fill(fixedLengths + 256, fixedLengths + 280, 7);
+        std::fill(fixedLengths + 280, fixedLengths + 288, 8);
+        std::fill(fixedLengths + 288, fixedLengths + 318, 5);
+        litLenLengths = fixedLengths;
+        distLengths = fixedLengths + 288;
+    } else {
+        writer.put(2, 2);
+        writer.put(litLenCount - 257, 5);
+        writer.put(distCount - 1, 5);
+        writer.put(codeLengthCount - 4, 4);
+        for (int i = 0; i < codeLengthCount; i++) {
+            writer.put(codeLengthLengths[deflateCodeLengthOrder[i]], 3);
+        }
+        std::vector<uint32_t> codeLengthCodes = canonicalCodes(codeLengthLengths, 19);
+        for (auto &code : lengthCodes) {
+            writer.put(reverseBits(codeLengthCodes[code.first], codeLengthLengths[code.first]),
+                codeLengthLengths[code.first]);
+            if (code.first == 16) writer.put(code.second, 2);
+            else if (code.first == 17) writer.put(code.second, 3);
+            else if (code.first == 18) writer.put(code.second, 7);
+        }
+    }
+
+    std::vector<uint32_t> litLenCodes = canonicalCodes(litLenLengths, litLenLengths == lengths ? 286 : 288);
+    std::vector<uint32_t> distCodes = canonicalCodes(distLengths, 30);
+    for (uint32_t &code : litLenCodes) {
+        code = reverseBits(code, litLenLengths[&code - litLenCodes.data()]);
+    }
+    for (uint32_t &code : distCodes) {
+        code = reverseBits(code, distLengths[&code - distCodes.data()]);
+    }
+    for (const DeflateToken &token : tokens) {
+        if (token.distance == 0) {
+            writer.put(litLenCodes[token.litLen], litLenLengths[token.litLen]);
+            continue;
+        }
+        int lengthSymbol = deflateLengthSymbol(token.litLen);
+        int distSymbol = deflateDistSymbol(token.distance);
+        writer.put(litLenCodes[257 + lengthSymbol], litLenLengths[257 + lengthSymbol]);
+        writer.put(token.litLen - deflateLengthBase[lengthSymbol], deflateLengthExtra[lengthSymbol]);
+        writer.put(distCodes[distSymbol], distLengths[distSymbol]);
+        writer.put(token.distance - deflateDistBase[distSymbol], deflateDistExtra[distSymbol]);
+    }
+    writer.put(litLenCodes[256], litLenLengths[256]);
+}
+
+//Match finder settings for each compression level
+struct DeflateLevel {
+    int maxChain; //Candidates checked per position
+    int niceLength; //Stop searching once a match is this long
+    bool lazy; //Try the next position before taking a match
+};
+
+DeflateLevel deflateLevel(int level) {
+    static const DeflateLevel levels[10] = {
+        {0, 0, false}, {4, 16, false}, {8, 32, false}, {16, 32, false}, {16, 64, true},
+        {32, 128, true}, {128, 128, true}, {256, 258, true}, {1024, 258, true}, {4096, 258, true}};
+    return levels[std::max(0, std::min(level, 9))];
+}
+
+/*
+* Deflate Compress
+* Compresses data into a raw DEFLATE stream appended to 'out'.
+* Level 0 stores, 1-3 match greedily, 4-9 use lazy matching.
+*/
+void deflateCompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out, int level = 6) {
+    StageScope scope("deflate", size);
+    scope.countOutput(out);
+    DeflateBitWriter writer(out);
+    const DeflateLevel params = deflateLevel(level);
+    const size_t blockTokens = 1 << 15;
+
+    std::vector<DeflateToken> tokens;
+    tokens.reserve(blockTokens);
+    size_t blockStart = 0;
+
+    const int hashBits = 15;
+    const size_t windowMask = deflateWindowSize - 1;
+    std::vector<int64_t> head(size_t(1) << hashBits, -1);
+    std::vector<int64_t> prev(deflateWindowSize, -1);
+
+    const auto hash3 = [data](size_t p) {
+        uint32_t bytes = data[p] | (data[p + 1] << 8) | (data[p + 2] << 16);
+        return (bytes * 2654435761u) >> (32 - hashBits);
+    };
+    const auto insert = [&](size_t p) {
+        if (p + deflateMinMatch <= size) {
+            uint32_t h = hash3(p);
+            prev[p & windowMask] = head[h];
+            head[h] = int64_t(p);
+        }
+    };
+    //Longest earlier match for position p, 0 if none of at least 3 bytes
+    const auto findMatch = [&](size_t p, int &bestDistance) {
+        if (params.maxChain == 0 || p + deflateMinMatch > size) {
+            return 0;
+        }
+        int maxLength = int(std::min<size_t>(deflateMaxMatch, size - p));
+        int bestLength = deflateMinMatch - 1;
+        int64_t candidate = head[hash3(p)];
+        for (int chain = params.maxChain; candidate >= 0 && chain > 0; chain--) {
+            size_t distance = p - size_t(candidate);
+            if (distance > size_t(deflateWindowSize)) {
+                break;
+            }
+            const unsigned char *a = data + candidate;
+            const unsigned char *b = data + p;
+            if (a[bestLength] == b[bestLength]) {
+                int length = 0;
+                while (length < maxLength && a[length] == b[length]) length++;
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = int(distance);
+                    if (length >= params.niceLength || length == maxLength) {
+                        break;
+                    }
+                }
+            }
+            int64_t next = prev[size_t(candidate) & windowMask];
+            if (next >= candidate) {
+                break; //Slot was reused by a newer position
+            }
+            candidate = next;
+        }
+        //Three byte matches far back cost more than the literals
+        if (bestLength < deflateMinMatch || (bestLength == deflateMinMatch && bestDistance > 4096)) {
+            return 0;
+        }
+        return bestLength;
+    };
+    const auto flushBlock = [&](size_t blockEnd, bool finalBlock) {
+        writeDeflateBlock(writer, tokens, data + blockStart, blockEnd - blockStart, finalBlock, params.maxChain == 0);
+        tokens.clear();
+        blockStart = blockEnd;
+    };
+
+    size_t pos = 0;
+    bool havePending = false;
+    int pendingLength = 0, pendingDistance = 0;
+    while (pos < size) {
+        int length, distance = 0;
+        if (havePending) {
+            length = pendingLength;
+            distance = pendingDistance;
+            havePending = false;
+        } else {
+            length = findMatch(pos, distance);
+        }
+        insert(pos);
+
+        //Lazy matching: a longer match one byte later wins over this one
+        if (params.lazy && length != 0 && length < params.niceLength && pos + 1 < size) {
+            int nextDistance = 0;
+            int nextLength = findMatch(pos + 1, nextDistance);
+            if (nextLength > length) {
+                tokens.push_back({data[pos], 0});
+                pos++;
+                havePending = true;
+                pendingLength = nextLength;
+                pendingDistance = nextDistance;
+                continue;
+            }
+        }
+
+        if (length != 0) {
+            tokens.push_back({uint16_t(length), uint16_t(distance)});
+            //Fast levels skip indexing the inside of long matches
+            if (params.lazy || length <= 32) {
+                for (size_t p = pos + 1; p < pos + length; p++) {
+                    insert(p);
+                }
+            }
+            pos += length;
+        } else {
+            tokens.push_back({data[pos], 0});
+            pos++;
+        }
+
+        if (tokens.size() >= blockTokens && !havePending) {
+            flushBlock(pos, false);
+        }
+    }
+    flushBlock(size, true);
+    writer.alignToByte();
+}
+
+/****************zlib and gzip Wrappers*********************/
+
+/*
+* zlib Compress
+* DEFLATE data with a zlib header and Adler-32 trailer
+*/
+void zlibCompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out, int level = 6) {
+    unsigned compressionMethod = 0x78; //DEFLATE, 32K window
+    unsigned levelFlag = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    unsigned flags = levelFlag << 6;
+    flags += 31 - ((compressionMethod << 8) | flags) % 31;
+    out.push_back((unsigned char)compressionMethod);
+    out.push_back((unsigned char)flags);
+    deflateCompress(data, size, out, level);
+    uint32_t adler = adler32(data, size);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back((unsigned char)(adler >> shift));
+    }
+}
+
+/*
+* zlib Decompress
+* Checks the zlib header, inflates and verifies the Adler-32 trailer.
+* Returns the number of input bytes used.
+*/
+size_t zlibDecompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    if (size < 6 || (data[0] & 0x0F) != 8 || ((data[0] << 8) | data[1]) % 31 != 0) {
+        throw std::runtime_error("not a zlib stream");
+    }
+    if (data[1] & 0x20) {
+        throw std::runtime_error("zlib preset dictionaries are not supported");
+    }
+    size_t outStart = out.size();
+    size_t used = 2 + inflateDecompress(data + 2, size - 2, out);
+    if (used + 4 > size) {
+        throw std::runtime_error("zlib stream is truncated");
+    }
+    uint32_t expected = (uint32_t(data[used]) << 24) | (data[used + 1] << 16) | (data[used + 2] << 8) | data[used + 3];
+    if (adler32(out.data() + outStart, out.size() - outStart) != expected) {
+        throw std::runtime_error("zlib checksum mismatch");
+    }
+    return used + 4;
+}
+
+/*
+* gzip Compress
+* Writes one gzip member with a CRC-32 and size trailer
+*/
+void gzipCompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out, int level = 6) {
+    const unsigned char header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0,
+        (unsigned char)(level >= 9 ? 2 : level <= 1 ? 4 : 0), 0xFF};
+    out.insert(out.end(), header, header + sizeof(header));
+    deflateCompress(data, size, out, level);
+    uint32_t crc = crc32(data, size);
+    uint32_t isize = uint32_t(size);
+    for (int shift = 0; shift < 32; shift += 8) out.push_back((unsigned char)(crc >> shift));
+    for (int shift = 0; shift < 32; shift += 8) out.push_back((unsigned char)(isize >> shift));
+}
+
+/*
+* gzip Decompress
+* Decodes every member of a gzip file, verifying CRC-32 and size
+*/
+void gzipDecompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    size_t pos = 0;
+    do {
+        if (size - pos < 18 || data[pos] != 0x1F || data[pos + 1] != 0x8B || data[pos + 2] != 8) {
+            throw std::runtime_error("not a gzip stream");
+        }
+        unsigned flags = data[pos + 3];
+        pos += 10;
+        if (flags & 4) { //FEXTRA
+            if (pos + 2 > size) throw std::runtime_error("gzip header is truncated");
+            pos += 2 + (data[pos] | (data[pos + 1] << 8));
+        }
+        for (unsigned flag = 8; flag <= 16; flag <<= 1) { //FNAME, FCOMMENT
+            if (flags & flag) {
+                while (pos < size && data[pos] != 0) pos++;
+                pos++;
+            }
+        }
+        if (flags & 2) pos += 2; //FHCRC
+        if (pos >= size) {
+            throw std::runtime_error("gzip header is truncated");
+        }
+
+        size_t outStart = out.size();
+        pos += inflateDecompress(data + pos, size - pos, out);
+        if (pos + 8 > size) {
+            throw std::runtime_error("gzip stream is truncated");
+        }
+        uint32_t crc = 0, isize = 0;
+        for (int i = 3; i >= 0; i--) crc = (crc << 8) | data[pos + i];
+        for (int i = 3; i >= 0; i--) isize = (isize << 8) | data[pos + 4 + i];
+        pos += 8;
+        if (crc32(out.data() + outStart, out.size() - outStart) != crc || uint32_t(out.size() - outStart) != isize) {
+            throw std::runtime_error("gzip checksum mismatch");
+        }
+    } while (pos < size);
+}
+
+/*
+* gzip Compress/Decompress on streams, as used by the command line
+*/
+void gzipCompress(std::istream &is, std::ostream &os, int level = 6) {
+    std::vector<unsigned char> input((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    std::vector<unsigned char> output;
+    gzipCompress(input.data(), input.size(), output, level);
+    os.write(reinterpret_cast<const char *>(output.data()), output.size());
+}
+
+void gzipDecompress(std::istream &is, std::ostream &os) {
+    std::vector<unsigned char> input((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    std::vector<unsigned char> output;
+    gzipDecompress(input.data(), input.size(), output);
+    os.write(reinterpret_cast<const char *>(output.data()), output.size());
+}
+
+#endif //DEFLATE_ALGO_HPP
@@ -0,0 +1,254 @@
+#ifndef DELTA_FILTER_HPP
+#define DELTA_FILTER_HPP
+
+/*
+DeltaFilter:
+The "DELTA" pipeline stage, for numeric binary data (sensor dumps, 16- and
+32-bit sample arrays, raw image channels) where a value differs little from
+the one a record earlier. The block is read as little-endian elements of 1,
+2 or 4 bytes and every element is replaced by its difference from the
+element one stride back, so slowly changing values become small numbers; for
+2- and 4-byte elements the differences are then split into byte planes, so
+the mostly-zero high bytes end up together. Element size and stride are picked
+per block by trying each candidate on the same samples BlockStats takes and
+keeping the lowest order-0 entropy of what it would output, or none at all
+if the raw bytes already do best. The differences are taken 16 bytes at a
+time with SSE2 where available, so the filter runs at memory speed.
+----------------------------------------------------------
+Block layout: u8 element size (0 when the block is copied as is), u8 stride
+in bytes, then the byte planes of the differences, then the bytes past the
+last whole element
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include "BlockStats.hpp"
+#include "StageStats.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//Element size and stride of a delta filter; an element size of 0 leaves the bytes alone
+struct DeltaParams {
+    unsigned char width;
+    unsigned char stride;
+};
+
+//Candidates tried on every block: bytes (also interleaved channels), 16-bit and 32-bit samples
+const DeltaParams deltaCandidates[] = {
+    {1, 1}, {1, 2}, {1, 3}, {1, 4}, {1, 6}, {1, 8}, {1, 12}, {1, 16},
+    {2, 2}, {2, 4}, {2, 6}, {2, 8},
+    {4, 4}, {4, 8}, {4, 12}, {4, 16},
+};
+//Bits per byte a filter has to save over the raw bytes to be used
+const double deltaMinGain = 0.25;
+
+/*
+* Delta Residuals
+* out[i] = data[i] - data[i - stride] for bytes [from, to) of the block, in
+* elements of 'width' bytes, wrapping around like unsigned integers
+*/
+void deltaResiduals(const unsigned char *data, size_t from, size_t to, size_t width, size_t stride,
+        unsigned char *out) {
+    size_t i = from;
+#if defined(__SSE2__)
+    for (; i + 16 <= to; i += 16) {
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i - stride));
+        __m128i residual = width == 1 ? _mm_sub_epi8(current, previous) :
+            width == 2 ? _mm_sub_epi16(current, previous) : _mm_sub_epi32(current, previous);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), residual);
+    }
+#endif
+    for (; i < to; i += width) {
+        if (width == 1) {
+            out[i] = (unsigned char)(data[i] - data[i - stride]);
+        } else if (width == 2) {
+            uint16_t current, previous;
+            std::memcpy(&current, data + i, 2);
+            std::memcpy(&previous, data + i - stride, 2);
+            uint16_t residual = uint16_t(current - previous);
+            std::memcpy(out + i, &residual, 2);
+        } else {
+            uint32_t current, previous;
+            std::memcpy(&current, data + i, 4);
+            std::memcpy(&previous, data + i - stride, 4);
+            uint32_t residual = current - previous;
+            std::memcpy(out + i, &residual, 4);
+        }
+    }
+}
+
+/*
+* Delta Restore
+* Undoes deltaResiduals in place over bytes [from, to): every element gets
+* the element one stride back added, which is already restored
+*/
+void deltaRestore(unsigned char *data, size_t from, size_t to, size_t width, size_t stride) {
+    size_t i = from;
+#if defined(__SSE2__)
+    //A stride of 16 bytes or more keeps the 16 bytes added clear of the ones being restored
+    if (stride >= 16) {
+        for (; i + 16 <= to; i += 16) {
+            __m128i residual = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i - stride));
+            __m128i current = width == 1 ? _mm_add_epi8(residual, previous) :
+                width == 2 ? _mm_add_epi16(residual, previous) : _mm_add_epi32(residual, previous);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), current);
+        }
+    }
+#endif
+    for (; i < to; i += width) {
+        if (width == 1) {
+            data[i] = (unsigned char)(data[i] + data[i - stride]);
+        } else if (width == 2) {
+            uint16_t residual, previous;
+            std::memcpy(&residual, data + i, 2);
+            std::memcpy(&previous, data + i - stride, 2);
+            uint16_t current = uint16_t(residual + previous);
+            std::memcpy(data + i, &current, 2);
+        } else {
+            uint32_t residual, previous;
+            std::memcpy(&residual, data + i, 4);
+            std::memcpy(&previous, data + i - stride, 4);
+            uint32_t current = residual + previous;
+            std::memcpy(data + i, &current, 4);
+        }
+    }
+}
+
+/*
+* Choose Delta Params
+* The candidate whose output has the lowest order-0 entropy over the sampled
+* segments, with byte planes counted apart; width 0 if none beats the raw
+* bytes by deltaMinGain bits per byte
+*/
+DeltaParams chooseDeltaParams(const unsigned char *data, size_t size) {
+    DeltaParams best = {0, 0};
+    const size_t lead = 16;   //Room before a segment for the longest stride
+    if (size < lead + statsSegmentSize) {
+        return best;
+    }
+    size_t segments = std::min(statsSampleSegments, (size - lead) / statsSegmentSize);
+    size_t spacing = (size - lead) / segments;
+    std::vector<unsigned char> residuals(lead + statsSegmentSize);
+
+    uint32_t raw[256] = {0};
+    for (size_t s = 0; s < segments; s++) {
+        byteHistogram(data + lead + s * spacing, statsSegmentSize, raw);
+    }
+    size_t sampled = segments * statsSegmentSize;
+    double bestEntropy = histogramEntropy(raw, sampled) - deltaMinGain;
+
+    for (const DeltaParams &candidate : deltaCandidates) {
+        uint32_t planes[4][256] = {{0}};
+        for (size_t s = 0; s < segments; s++) {
+            //Segments start on an element boundary, as the filter sees them
+            size_t start = (lead + s * spacing) / 4 * 4;
+            deltaResiduals(data + start - lead, lead, lead + statsSegmentSize, candidate.width, candidate.stride,
+                residuals.data());
+            for (size_t i = 0; i < statsSegmentSize; i++) {
+                planes[i % candidate.width][residuals[lead + i]]++;
+            }
+        }
+        double entropy = 0;
+        for (size_t plane = 0; plane < candidate.width; plane++) {
+            entropy += histogramEntropy(planes[plane], sampled / candidate.width) / candidate.width;
+        }
+        if (entropy < bestEntropy) {
+            bestEntropy = entropy;
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+/*
+* Delta Encode
+* Appends the block filtered with the parameters chooseDeltaParams picks
+*/
+void deltaEncode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    StageScope scope("deltaEncode", size);
+    size_t outStart = out.size();
+    DeltaParams params = chooseDeltaParams(data, size);
+    out.push_back(params.width);
+    out.push_back(params.stride);
+    if (params.width == 0) {
+        out.insert(out.end(), data, data + size);
+        scope.addBytesOut(out.size() - outStart);
+        return;
+    }
+    size_t width = params.width, stride = params.stride;
+    size_t whole = size / width * width;
+    size_t head = std::min(stride, whole);
+    size_t outPos = out.size();
+    out.resize(outPos + size);
+    unsigned char *planes = out.data() + outPos;
+
+    //The first stride has nothing before it and is kept as is
+    std::vector<unsigned char> residuals(whole);
+    std::memcpy(residuals.data(), data, head);
+    deltaResiduals(data, head, whole, width, stride, residuals.data());
+    if (width == 1) {
+        std::memcpy(planes, residuals.data(), whole);
+    } else {
+        size_t count = whole / width;
+        for (size_t plane = 0; plane < width; plane++) {
+            unsigned char *target = planes + plane * count;
+            for (size_t i = 0; i < count; i++) {
+                target[i] = residuals[i * width + plane];
+            }
+        }
+    }
+    std::memcpy(planes + whole, data + whole, size - whole);
+    scope.addBytesOut(out.size() - outStart);
+}
+
+/*
+* Delta Decode
+* Merges the byte planes back into elements and adds back the differences
+*/
+void deltaDecode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    StageScope scope("deltaDecode", size);
+    if (size < 2) {
+        throw std::runtime_error("DELTA block is truncated");
+    }
+    size_t width = data[0], stride = data[1];
+    data += 2;
+    size -= 2;
+    size_t outPos = out.size();
+    if (width == 0) {
+        out.insert(out.end(), data, data + size);
+        scope.addBytesOut(size);
+        return;
+    }
+    if ((width != 1 && width != 2 && width != 4) || stride == 0 || stride % width != 0) {
+        throw std::runtime_error("invalid DELTA parameters");
+    }
+    if (size == 0) {
+        return;
+    }
+    size_t whole = size / width * width;
+    size_t head = std::min(stride, whole);
+    out.resize(outPos + size);
+    unsigned char *target = out.data() + outPos;
+    if (width == 1) {
+        std::memcpy(target, data, whole);
+    } else {
+        size_t count = whole / width;
+        for (size_t plane = 0; plane < width; plane++) {
+            const unsigned char *source = data + plane * count;
+            for (size_t i = 0; i < count; i++) {
+                target[i * width + plane] = source[i];
+            }
+        }
+    }
+    deltaRestore(target, head, whole, width, stride);
+    std::memcpy(target + whole, data + whole, size - whole);
+    scope.addBytesOut(size);
+}
+
+#endif //DELTA_FILTER_HPP
@@ -0,0 +1,443 @@
+#ifndef FM_INDEX_HPP
+#define FM_INDEX_HPP
+
+/*
+FMIndex:
+A full-text index built from the BWT of a file, which answers "how often and
+where does this pattern occur" without decoding the file, and decodes only
+the bytes around each match. Patterns are matched backwards one byte at a
+time, narrowing a range of sorted suffixes with the C table (rows starting
+with a smaller byte) and rank (occurrences of a byte in the last column
+before a row), so a count takes time proportional to the pattern length.
+Rank comes from a wavelet matrix over the last column: eight bit vectors,
+one per bit of the byte, each with a count every 512 bits and popcount for
+the rest. Every 32nd text position has its row sampled (the rows marked in
+a bit vector of their own) and every 32nd row-of-position kept the other
+way, so locating a match or decoding a region walks the LF mapping at most
+31 steps past its length.
+The BWT is of the text with an end marker below every byte (sortSuffixes),
+so no match runs off the end into the start; a stand-in 0 takes the
+marker's place in the last column and is left out of every rank.
+----------------------------------------------------------
+Index file: "ARBF", u32 version, u64 text size, u32 sample rate, u32 row of
+the end marker, u32 C counts[256], then each bit vector (8 levels, then the
+sampled rows) as u64 words, the sampled text positions and the sampled
+rows, as u32 values.
+The index holds the whole text, so it replaces rather than accompanies it:
+about 1.4 bytes per text byte, and 20 bytes per text byte while it is built.
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include "BWTransform.hpp"
+#include "StageStats.hpp"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+const char fmIndexMagic[4] = {'A', 'R', 'B', 'F'};
+const uint32_t fmIndexVersion = 1;
+const uint32_t fmSampleRate = 32;
+
+//Set bits of a word
+uint32_t popcount64(uint64_t word) {
+#if defined(__GNUC__)
+    return uint32_t(__builtin_popcountll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return uint32_t(__popcnt64(word));
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return uint32_t((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+/*
+* Rank Bit Vector
+* Bits with a running count of ones every 512 bits, so rank is one lookup
+* and at most eight popcounts
+*/
+class RankBitVector {
+public:
+    void resize(size_t bitCount) {
+        words.assign((bitCount + 63) / 64, 0);
+    }
+
+    void set(size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+    bool get(size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+
+    //Fills the counts once every bit is set
+    void buildRanks() {
+        counts.assign(words.size() / 8 + 1, 0);
+        uint32_t total = 0;
+        for (size_t i = 0; i < words.size(); i++) {
+            if (i % 8 == 0) {
+                counts[i / 8] = total;
+            }
+            total += popcount64(words[i]);
+        }
+        if (words.size() % 8 == 0) {
+            counts[words.size() / 8] = total;
+        }
+    }
+
+    //Ones before position i
+    uint32_t rank1(size_t i) const {
+        size_t word = i / 64;
+        uint32_t rank = counts[word / 8];
+        for (size_t w = word / 8 * 8; w < word; w++) {
+            rank += popcount64(words[w]);
+        }
+        if (i % 64 != 0) {
+            rank += popcount64(words[word] & ((uint64_t(1) << (i % 64)) - 1));
+        }
+        return rank;
+    }
+
+    uint32_t rank0(size_t i) const { return uint32_t(i) - rank1(i); }
+
+    void write(std::ostream &os) const {
+        os.write(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(uint64_t));
+    }
+
+    void read(std::istream &is, size_t bitCount) {
+        resize(bitCount);
+        if (!is.read(reinterpret_cast<char *>(words.data()), words.size() * sizeof(uint64_t))) {
+            throw std::runtime_error("FM index is truncated");
+        }
+        buildRanks();
+    }
+
+private:
+    std::vector<uint64_t> words;
+    std::vector<uint32_t> counts;
+};
+
+/*
+* Wavelet Matrix
+* A byte sequence as eight bit vectors, top bit first; each level is the
+* previous one stably split into its 0 and 1 bytes, so rank of a byte and
+* the byte at a position each take one pass over the levels
+*/
+class WaveletMatrix {
+public:
+    void build(const unsigned char *data, size_t size) {
+        std::vector<unsigned char> current(data, data + size), next(size);
+        for (int level = 0; level < 8; level++) {
+            int bit = 7 - level;
+            levels[level].resize(size);
+            size_t zeroCount = 0;
+            for (size_t i = 0; i < size; i++) {
+                if ((current[i] >> bit) & 1) {
+                    levels[level].set(i);
+                } else {
+                    zeroCount++;
+                }
+            }
+            levels[level].buildRanks();
+            zeros[level] = uint32_t(zeroCount);
+            size_t zeroPosition = 0, onePosition = zeroCount;
+            for (size_t i = 0; i < size; i++) {
+                next[(current[i] >> bit) & 1 ? onePosition++ : zeroPosition++] = current[i];
+            }
+            current.swap(next);
+        }
+        findStarts();
+    }
+
+    //Occurrences of byte before position i
+    uint32_t rank(unsigned char byte, size_t i) const {
+        for (int level = 0; level < 8; level++) {
+            i = (byte >> (7 - level)) & 1 ? zeros[level] + levels[level].rank1(i) : levels[level].rank0(i);
+        }
+        return uint32_t(i) - starts[byte];
+    }
+
+    //Byte at position i, and how often it occurs before i
+    unsigned char access(size_t i, uint32_t &rankOut) const {
+        unsigned char byte = 0;
+        for (int level = 0; level < 8; level++) {
+            bool one = levels[level].get(i);
+            byte = (unsigned char)((byte << 1) | (one ? 1 : 0));
+            i = one ? zeros[level] + levels[level].rank1(i) : levels[level].rank0(i);
+        }
+        rankOut = uint32_t(i) - starts[byte];
+        return byte;
+    }
+
+    void write(std::ostream &os) const {
+        for (auto &level : levels) {
+            level.write(os);
+        }
+    }
+
+    void read(std::istream &is, size_t size) {
+        for (int level = 0; level < 8; level++) {
+            levels[level].read(is, size);
+            zeros[level] = levels[level].rank0(size);
+        }
+        findStarts();
+    }
+
+private:
+    //Where each byte's run starts below the last level
+    void findStarts() {
+        for (int byte = 0; byte < 256; byte++) {
+            size_t i = 0;
+            for (int level = 0; level < 8; level++) {
+                i = (byte >> (7 - level)) & 1 ? zeros[level] + levels[level].rank1(i) : levels[level].rank0(i);
+            }
+            starts[byte] = uint32_t(i);
+        }
+    }
+
+    RankBitVector levels[8];
+    uint32_t zeros[8] = {0};
+    uint32_t starts[256] = {0};
+};
+
+template <class T>
+void writeIndexField(std::ostream &os, T value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+T readIndexField(std::istream &is) {
+    T value;
+    if (!is.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+        throw std::runtime_error("FM index is truncated");
+    }
+    return value;
+}
+
+/*
+* FM Index
+* Counting, locating and decoding over the BWT of one text
+*/
+class FMIndex {
+public:
+    /*
+    * Build
+    * Sorts the suffixes of the text and keeps the last column as a wavelet
+    * matrix along with the samples
+    */
+    void build(const unsigned char *data, size_t size) {
+        StageScope scope("fmIndexBuild", size);
+        if (size >= UINT32_MAX) {
+            throw std::invalid_argument("FM index text is larger than 4 GiB");
+        }
+        textSize = size;
+        sampleRate = fmSampleRate;
+        std::vector<uint32_t> order = sortSuffixes(data, size);
+        std::vector<unsigned char> last(size + 1);
+        uint32_t counts[256] = {0};
+        sampledRows.resize(size + 1);
+        positionSamples.clear();
+        rowSamples.assign((size + sampleRate - 1) / sampleRate, 0);
+        for (size_t row = 0; row <= size; row++) {
+            uint32_t position = order[row];
+            if (position == 0) {
+                endRow = uint32_t(row);
+                last[row] = 0;
+            } else {
+                last[row] = data[position - 1];
+                counts[last[row]]++;
+            }
+            if (position % sampleRate == 0 && position < size) {
+                sampledRows.set(row);
+                positionSamples.push_back(position);
+                rowSamples[position / sampleRate] = uint32_t(row);
+            }
+        }
+        sampledRows.buildRanks();
+        setFirstRows(counts);
+        bytes.build(last.data(), last.size());
+    }
+
+    uint64_t size() const { return textSize; }
+
+    /*
+    * Match Rows
+    * Backward search: the rows [first, end) whose suffixes start with the pattern
+    */
+    void matchRows(const std::string &pattern, uint32_t &first, uint32_t &end) const {
+        first = 0;
+        end = uint32_t(textSize + 1);
+        for (size_t i = pattern.size(); i-- > 0 && first < end;) {
+            unsigned char byte = (unsigned char)pattern[i];
+            first = firstRow[byte] + rank(byte, first);
+            end = firstRow[byte] + rank(byte, end);
+        }
+    }
+
+    //Occurrences of the pattern in the text
+    uint64_t count(const std::string &pattern) const {
+        if (pattern.empty()) {
+            return 0;
+        }
+        uint32_t first, end;
+        matchRows(pattern, first, end);
+        return end <= first ? 0 : end - first;
+    }
+
+    /*
+    * Locate
+    * Text offsets of up to 'limit' occurrences, in increasing order; with a
+    * limit, which occurrences are returned is unspecified
+    */
+    std::vector<uint64_t> locate(const std::string &pattern, size_t limit = SIZE_MAX) const {
+        std::vector<uint64_t> positions;
+        if (pattern.empty()) {
+            return positions;
+        }
+        uint32_t first, end;
+        matchRows(pattern, first, end);
+        for (uint32_t row = first; row < end && positions.size() < limit; row++) {
+            positions.push_back(rowPosition(row));
+        }
+        std::sort(positions.begin(), positions.end());
+        return positions;
+    }
+
+    /*
+    * Extract
+    * Decodes text bytes [start, start + length), clamped to the end, walking
+    * back from the nearest sampled position after them
+    */
+    std::string extract(uint64_t start, uint64_t length) const {
+        if (start >= textSize) {
+            return std::string();
+        }
+        uint64_t end = start + std::min(length, textSize - start);
+        uint64_t position = (end + sampleRate - 1) / sampleRate * sampleRate;
+        uint32_t row;
+        if (position >= textSize) {
+            //Row 0 holds the empty suffix, preceded by the last byte
+            position = textSize;
+            row = 0;
+        } else {
+            row = rowSamples[size_t(position / sampleRate)];
+        }
+        std::string text(size_t(end - start), '\0');
+        for (; position > start; position--) {
+            unsigned char byte;
+            uint32_t previous = lastToFirst(row, byte);
+            if (position <= end) {
+                text[size_t(position - 1 - start)] = char(byte);
+            }
+            row = previous;
+        }
+        return text;
+    }
+
+    void write(std::ostream &os) const {
+        os.write(fmIndexMagic, sizeof(fmIndexMagic));
+        writeIndexField<uint32_t>(os, fmIndexVersion);
+        writeIndexField<uint64_t>(os, textSize);
+        writeIndexField<uint32_t>(os, sampleRate);
+        writeIndexField<uint32_t>(os, endRow);
+        for (int byte = 0; byte < 256; byte++) {
+            uint32_t next = byte == 255 ? uint32_t(textSize + 1) : firstRow[byte + 1];
+            writeIndexField<uint32_t>(os, next - firstRow[byte]);
+        }
+        bytes.write(os);
+        sampledRows.write(os);
+        os.write(reinterpret_cast<const char *>(positionSamples.data()), positionSamples.size() * sizeof(uint32_t));
+        os.write(reinterpret_cast<const char *>(rowSamples.data()), rowSamples.size() * sizeof(uint32_t));
+        if (!os) {
+            throw std::runtime_error("failed writing the FM index");
+        }
+    }
+
+    void read(std::istream &is) {
+        char magic[4];
+        if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, fmIndexMagic)) {
+            throw std::runtime_error("not an FM index");
+        }
+        if (readIndexField<uint32_t>(is) != fmIndexVersion) {
+            throw std::runtime_error("unsupported FM index version");
+        }
+        textSize = readIndexField<uint64_t>(is);
+        sampleRate = readIndexField<uint32_t>(is);
+        endRow = readIndexField<uint32_t>(is);
+        if (textSize >= UINT32_MAX || sampleRate == 0 || endRow > textSize) {
+            throw std::runtime_error("corrupted FM index header");
+        }
+        uint32_t counts[256];
+        uint64_t total = 0;
+        for (auto &count : counts) {
+            count = readIndexField<uint32_t>(is);
+            total += count;
+        }
+        if (total != textSize) {
+            throw std::runtime_error("corrupted FM index header");
+        }
+        setFirstRows(counts);
+        bytes.read(is, size_t(textSize + 1));
+        sampledRows.read(is, size_t(textSize + 1));
+        positionSamples.resize(sampledRows.rank1(size_t(textSize + 1)));
+        rowSamples.resize(size_t((textSize + sampleRate - 1) / sampleRate));
+        if (positionSamples.size() != rowSamples.size() ||
+            !is.read(reinterpret_cast<char *>(positionSamples.data()), positionSamples.size() * sizeof(uint32_t)) ||
+            !is.read(reinterpret_cast<char *>(rowSamples.data()), rowSamples.size() * sizeof(uint32_t))) {
+            throw std::runtime_error("FM index is truncated");
+        }
+        for (size_t i = 0; i < rowSamples.size(); i++) {
+            if (rowSamples[i] > textSize || positionSamples[i] >= textSize) {
+                throw std::runtime_error("corrupted FM index samples");
+            }
+        }
+    }
+
+private:
+    //Row 0 is the empty suffix, below every byte
+    void setFirstRows(const uint32_t counts[256]) {
+        uint32_t total = 1;
+        for (int byte = 0; byte < 256; byte++) {
+            firstRow[byte] = total;
+            total += counts[byte];
+        }
+    }
+
+    //Occurrences of byte in the last column before row; the end row holds a stand-in 0 that does not count
+    uint32_t rank(unsigned char byte, uint32_t row) const {
+        return bytes.rank(byte, row) - (byte == 0 && row > endRow ? 1 : 0);
+    }
+
+    //LF mapping: the row of the suffix one byte longer, and that byte
+    uint32_t lastToFirst(uint32_t row, unsigned char &byte) const {
+        if (row == endRow) {
+            throw std::runtime_error("FM index walked past the start of the text");
+        }
+        uint32_t before;
+        byte = bytes.access(row, before);
+        return firstRow[byte] + before - (byte == 0 && row > endRow ? 1 : 0);
+    }
+
+    //Text offset of the suffix in a row, walking LF to the nearest sampled row
+    uint64_t rowPosition(uint32_t row) const {
+        uint64_t steps = 0;
+        unsigned char byte;
+        while (!sampledRows.get(row)) {
+            row = lastToFirst(row, byte);
+            steps++;
+        }
+        return positionSamples[sampledRows.rank1(row)] + steps;
+    }
+
+    uint64_t textSize = 0;
+    uint32_t sampleRate = fmSampleRate;
+    uint32_t endRow = 0;                     //Row of the whole text, whose last column is the end marker
+    uint32_t firstRow[256] = {0};            //C table: rows starting with a smaller byte
+    WaveletMatrix bytes;                     //Last column
+    RankBitVector sampledRows;               //Rows whose text position is a multiple of the rate
+    std::vector<uint32_t> positionSamples;   //Their text positions, in row order
+    std::vector<uint32_t> rowSamples;        //Row of every multiple of the rate, in text order
+};
+
+#endif //FM_INDEX_HPP
@@ -15,6 +15,8 @@ Author: Curtis Davis
 #include <iostream>
 #include <queue>
 #include <unordered_map>
+#include <cstring>
+#include "Deflate_Algo.hpp"
 
 //Node of the Huffman Tree
 struct HuffNode {
@@ -76,6 +78,7 @@ void decodeHuff(HuffNode* rootNode, int &index, std::string string_p){
 }
 
 void buildHuffTree(std::string textInput){
+    StageScope scope("buildHuffTree", textInput.size());
     //Gets frequency of characters of the input string
     std::unordered_map<char, int> numOfChars;
     for(char ch : textInput){
@@ -132,4 +135,106 @@ void buildHuffTree(std::string textInput){
     }
 }
 
+/****************Block Huffman Functions*********************/
+
+/*
+* Huffman Encode Block
+* Byte-wise Huffman coding of a block for the codec pipeline. Writes the
+* block size, the 256 code lengths packed two per byte, then the canonical
+* codes of every byte. Lengths are limited to 15 bits so the decoder can use
+* the same lookup tables as DEFLATE. Returns false, without writing the
+* codes, if the output would pass limit bytes.
+*/
+bool huffEncodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        size_t limit = SIZE_MAX) {
+    StageScope scope("huffEncodeBlock", size);
+    scope.countOutput(out);
+    uint32_t rawSize = uint32_t(size);
+    unsigned char sizeBytes[4];
+    std::memcpy(sizeBytes, &rawSize, 4);
+    out.insert(out.end(), sizeBytes, sizeBytes + 4);
+    if (size == 0) {
+        return limit >= 4;
+    }
+
+    //Gets frequency of every byte of the block and builds the code from it
+    uint32_t numOfChars[256] = {0};
+    uint8_t lengths[256];
+    {
+        StageScope build("huffmanBuild", size);
+        for (size_t i = 0; i < size; i++) {
+            numOfChars[data[i]]++;
+        }
+        buildCodeLengths(numOfChars, 256, 15, lengths);
+    }
+
+    //The exact output size is known from the code lengths, before any bit is written
+    uint64_t totalBits = 0;
+    for (int i = 0; i < 256; i++) {
+        totalBits += uint64_t(numOfChars[i]) * lengths[i];
+    }
+    if (4 + 128 + (totalBits + 7) / 8 > limit) {
+        return false;
+    }
+    for (int i = 0; i < 256; i += 2) {
+        out.push_back((unsigned char)(lengths[i] | (lengths[i + 1] << 4)));
+    }
+
+    std::vector<uint32_t> huffmanCode = canonicalCodes(lengths, 256);
+    for (int i = 0; i < 256; i++) {
+        huffmanCode[i] = reverseBits(huffmanCode[i], lengths[i]);
+    }
+    DeflateBitWriter writer(out);
+    for (size_t i = 0; i < size; i++) {
+        writer.put(huffmanCode[data[i]], lengths[data[i]]);
+    }
+    writer.alignToByte();
+    return true;
+}
+
+/*
+* Huffman Decode Block
+* Decodes huffEncodeBlock output through a table lookup per byte, refusing
+* blocks whose recorded size passes limit
+*/
+void huffDecodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        size_t limit = SIZE_MAX) {
+    StageScope scope("huffDecodeBlock", size);
+    scope.countOutput(out);
+    if (size < 4) {
+        throw std::runtime_error("Huffman block is truncated");
+    }
+    uint32_t rawSize;
+    std::memcpy(&rawSize, data, 4);
+    if (rawSize == 0) {
+        return;
+    }
+    if (rawSize > limit) {
+        throw std::runtime_error("Huffman block decodes past the block size");
+    }
+    const size_t headerSize = 4 + 128;
+    //Every byte costs at least one bit
+    if (size < headerSize || rawSize / 8 > size - headerSize) {
+        throw std::runtime_error("Huffman block is truncated");
+    }
+
+    uint8_t lengths[256];
+    for (int i = 0; i < 256; i += 2) {
+        lengths[i] = data[4 + i / 2] & 0x0F;
+        lengths[i + 1] = data[4 + i / 2] >> 4;
+    }
+    InflateTable table;
+    buildInflateTable(lengths, 256, table);
+
+    InflateBitReader reader(data + headerSize, size - headerSize);
+    size_t outPos = out.size();
+    out.resize(outPos + rawSize);
+    for (uint32_t i = 0; i < rawSize; i++) {
+        out[outPos + i] = (unsigned char)reader.decode(table);
+    }
+    if (reader.bytesConsumed() > size - headerSize) {
+        throw std::runtime_error("Huffman block is truncated");
+    }
+}
+
 #endif //HUFF_ALGO_HPP
\ No newline at end of file
@@ -3,6 +3,16 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <map>
+#include <limits>
+#include <cstdint>
+#include <stdexcept>
+#include <cstring>
+#include <unordered_map>
+#include <algorithm>
+#include "StageStats.hpp"
+#include "Checksum.hpp"
 
 /*Type of code for compressing and decompressing*/
 using CodeType = std::uint16_t; //Unsigned 16bit short
@@ -20,16 +30,136 @@ namespace globals {
     const CodeType dms {std::numeric_limits<CodeType>::max()};
 }
 
+/****************Preset Dictionaries*********************/
+
+const char lzDictionaryMagic[4] = {'A', 'R', 'B', 'D'};
+const uint32_t lzDictionaryVersion = 1;
+const size_t lzDictionaryDefaultEntries = 4096;
+//Leaves at least half the codes for strings learned from the input itself
+const size_t lzDictionaryMaxEntries = globals::dms / 2;
+
+/*
+* LZ Dictionary
+* Entries preloaded after the 256 single bytes, so short inputs start with the
+* strings of similar data instead of an empty dictionary. Entry i has code
+* 256 + i and is the string of its prefix code plus one byte; prefixes always
+* come before the entries extending them. A reset (when the dictionary fills
+* up) goes back to the preloaded entries.
+* File layout: "ARBD", u32 version, u32 id, u32 entry count, then per entry
+* u16 prefix code and the byte.
+*/
+struct LZDictionary {
+    uint32_t id = 0;                               //CRC-32 of the entries, written to the output to name the dictionary
+    std::vector<CodeType> prefix;
+    std::vector<unsigned char> lastByte;
+    std::unordered_map<uint32_t, CodeType> codes;  //(prefix << 8) | byte -> code, as lzCompressBlock keys its dictionary
+    std::vector<unsigned char> firstByte;          //First byte and length of every entry, as lzDecompressBlock keeps them
+    std::vector<uint32_t> length;
+
+    size_t size() const { return prefix.size(); }
+
+    //The string of a code, bytes as chars like the stream functions use them
+    std::vector<char> spell(CodeType code) const {
+        std::vector<char> text;
+        for (; code >= 256; code = prefix[code - 256]) {
+            text.push_back(char(lastByte[code - 256]));
+        }
+        text.push_back(char(code ^ 0x80));
+        std::reverse(text.begin(), text.end());
+        return text;
+    }
+};
+
+//Entries as stored in a dictionary file, which is also what the id is taken over
+std::vector<unsigned char> lzDictionaryEntryBytes(const LZDictionary &dictionary) {
+    std::vector<unsigned char> bytes;
+    bytes.reserve(dictionary.size() * (sizeof(CodeType) + 1));
+    for (size_t i = 0; i < dictionary.size(); i++) {
+        unsigned char code[sizeof(CodeType)];
+        std::memcpy(code, &dictionary.prefix[i], sizeof(CodeType));
+        bytes.insert(bytes.end(), code, code + sizeof(CodeType));
+        bytes.push_back(dictionary.lastByte[i]);
+    }
+    return bytes;
+}
+
+/*
+* Finish LZ Dictionary
+* Checks the entries, then builds the lookup table and the id
+*/
+void finishLZDictionary(LZDictionary &dictionary) {
+    if (dictionary.size() > lzDictionaryMaxEntries || dictionary.lastByte.size() != dictionary.size()) {
+        throw std::runtime_error("LZ dictionary has too many entries");
+    }
+    dictionary.codes.clear();
+    dictionary.codes.reserve(dictionary.size());
+    dictionary.firstByte.resize(dictionary.size());
+    dictionary.length.resize(dictionary.size());
+    for (size_t i = 0; i < dictionary.size(); i++) {
+        CodeType prefix = dictionary.prefix[i];
+        if (prefix >= 256 + i) {
+            throw std::runtime_error("LZ dictionary entry refers to a later entry");
+        }
+        dictionary.firstByte[i] = prefix < 256 ? (unsigned char)(prefix ^ 0x80) : dictionary.firstByte[prefix - 256];
+        dictionary.length[i] = (prefix < 256 ? 1 : dictionary.length[prefix - 256]) + 1;
+        uint32_t key = (uint32_t(dictionary.prefix[i]) << 8) | dictionary.lastByte[i];
+        if (!dictionary.codes.emplace(key, CodeType(256 + i)).second) {
+            throw std::runtime_error("LZ dictionary has a repeated entry");
+        }
+    }
+    std::vector<unsigned char> bytes = lzDictionaryEntryBytes(dictionary);
+    dictionary.id = crc32(bytes.data(), bytes.size());
+}
+
+void writeLZDictionary(const LZDictionary &dictionary, std::ostream &os) {
+    std::vector<unsigned char> bytes = lzDictionaryEntryBytes(dictionary);
+    uint32_t fields[3] = {lzDictionaryVersion, dictionary.id, uint32_t(dictionary.size())};
+    os.write(lzDictionaryMagic, sizeof(lzDictionaryMagic));
+    os.write(reinterpret_cast<const char *>(fields), sizeof(fields));
+    os.write(reinterpret_cast<const char *>(bytes.data()), std::streamsize(bytes.size()));
+}
+
+/*
+* Read LZ Dictionary
+* Reads a dictionary file, throwing if it is not one or does not match its id
+*/
+LZDictionary readLZDictionary(std::istream &is) {
+    char magic[4];
+    uint32_t fields[3];
+    if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, lzDictionaryMagic) ||
+        !is.read(reinterpret_cast<char *>(fields), sizeof(fields))) {
+        throw std::runtime_error("not an LZ dictionary");
+    }
+    if (fields[0] != lzDictionaryVersion || fields[2] > lzDictionaryMaxEntries) {
+        throw std::runtime_error("unsupported LZ dictionary");
+    }
+    LZDictionary dictionary;
+    dictionary.prefix.resize(fields[2]);
+    dictionary.lastByte.resize(fields[2]);
+    for (size_t i = 0; i < fields[2]; i++) {
+        if (!is.read(reinterpret_cast<char *>(&dictionary.prefix[i]), sizeof(CodeType)) ||
+            !is.read(reinterpret_cast<char *>(&dictionary.lastByte[i]), 1)) {
+            throw std::runtime_error("LZ dictionary is truncated");
+        }
+    }
+    finishLZDictionary(dictionary);
+    if (dictionary.id != fields[1]) {
+        throw std::runtime_error("LZ dictionary is corrupted");
+    }
+    return dictionary;
+}
+
 /*
 * Lempel-Ziv Compress
 * This function uses the Lempel-Ziv algorithm to compress an image
 */
-void lzCompress(std::istream &is, std::ostream &os) {
+void lzCompress(std::istream &is, std::ostream &os, const LZDictionary *preset = nullptr) {
+    StageScope scope("lzCompress");
     //Compression dictonary
     std::map<std::vector<char>, CodeType> compDictionary;
     
-    //Resets the dictionary
-    const auto resetDictionary = [&compDictionary] {
+    //Resets the dictionary, to the preset entries if there are any
+    const auto resetDictionary = [&compDictionary, preset] {
         compDictionary.clear();
 
         const long int minc = std::numeric_limits<char>::min();
@@ -40,6 +170,9 @@ void lzCompress(std::istream &is, std::ostream &os) {
 
             compDictionary[{static_cast<char> (c)}] = dictionarySize;
         }
+        for (size_t i = 0; preset != nullptr && i < preset->size(); i++) {
+            compDictionary[preset->spell(CodeType(256 + i))] = CodeType(256 + i);
+        }
     };
 
     resetDictionary();
@@ -48,6 +181,7 @@ void lzCompress(std::istream &is, std::ostream &os) {
     std::vector<char> str;
     char ch;
     while (is.get(ch)) {
+        scope.addBytesIn(1);
         //If the dictionary size becomes too large
         if (compDictionary.size() == globals::dms) {
             resetDictionary();
@@ -59,12 +193,14 @@ void lzCompress(std::istream &is, std::ostream &os) {
             compDictionary[str] = dictionarySize;
             str.pop_back();
             os.write(reinterpret_cast<const char*> (&compDictionary.at(str)), sizeof (CodeType));
+            scope.addBytesOut(sizeof (CodeType));
             str = {ch};
         }
     }
 
     if (!str.empty()) {
         os.write(reinterpret_cast<const char *> (&compDictionary.at(str)), sizeof (CodeType));
+        scope.addBytesOut(sizeof (CodeType));
     }
 }
 
@@ -72,11 +208,12 @@ void lzCompress(std::istream &is, std::ostream &os) {
 * Lempel-Ziv Decompress
 * This function uses the Lempel-Ziv algorithm to decompress an image
 */
-void lzDecompress(std::istream &is, std::ostream &os) {
+void lzDecompress(std::istream &is, std::ostream &os, const LZDictionary *preset = nullptr) {
+    StageScope scope("lzDecompress");
     std::vector<std::vector<char>> dictionary;
 
     //Lamda to reset dictionary and set limits
-    const auto reset_dictionary = [&dictionary] {
+    const auto reset_dictionary = [&dictionary, preset] {
         dictionary.clear();
         dictionary.reserve(globals::dms); //Reserve space for dictionary's max size
 
@@ -86,6 +223,9 @@ void lzDecompress(std::istream &is, std::ostream &os) {
         for (long int c = minc; c <= maxc; ++c) {
             dictionary.push_back({static_cast<char> (c)}); //Put 'chars' to setup dictionary
         }
+        for (size_t i = 0; preset != nullptr && i < preset->size(); i++) {
+            dictionary.push_back(preset->spell(CodeType(256 + i)));
+        }
     };
 
     reset_dictionary();
@@ -94,6 +234,7 @@ void lzDecompress(std::istream &is, std::ostream &os) {
 
     //Read the LZ encoded input stream, with 'keys'
     while ( is.read(reinterpret_cast<char *> (&key), sizeof (CodeType)) ) {
+        scope.addBytesIn(sizeof (CodeType));
         //Dictionary reaches maximum size, reset
         if (dictionary.size() == globals::dms){
             reset_dictionary();
@@ -108,6 +249,7 @@ void lzDecompress(std::istream &is, std::ostream &os) {
         }
         //Write key and the size of the key
         os.write(&dictionary.at(key).front(), dictionary.at(key).size());
+        scope.addBytesOut(dictionary.at(key).size());
         //String is current dictionary
         str = dictionary.at(key);
     }
@@ -118,4 +260,284 @@ void lzDecompress(std::istream &is, std::ostream &os) {
     }
 }
 
+/****************Block LZ Functions*********************/
+
+//Code of a single byte in the initial dictionary, which is ordered by signed char value
+inline CodeType lzByteCode(unsigned char byte) {
+    return CodeType(byte ^ 0x80);
+}
+
+void lzWriteCode(std::vector<unsigned char> &out, CodeType code) {
+    unsigned char bytes[sizeof(CodeType)];
+    std::memcpy(bytes, &code, sizeof(CodeType));
+    out.insert(out.end(), bytes, bytes + sizeof(CodeType));
+}
+
+/*
+* Lempel-Ziv Compress Block
+* Same output as lzCompress for data already in memory. The dictionary maps
+* (code of the current string, next byte) to a code, which is equivalent to
+* the map of whole strings since every entry extends an existing one.
+* Stops and returns false once the output passes limit bytes.
+*/
+bool lzCompressBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        size_t limit = SIZE_MAX, const LZDictionary *preset = nullptr) {
+    StageScope scope("lzCompressBlock", size);
+    scope.countOutput(out);
+    size_t start = out.size();
+    //Preset entries are looked up in the dictionary's own table, so a block does not copy it
+    size_t presetSize = 256 + (preset != nullptr ? preset->size() : 0);
+    std::unordered_map<uint32_t, CodeType> compDictionary;
+    //Every byte adds at most one entry, so short inputs do not reserve the whole code space
+    compDictionary.reserve(std::min<size_t>(globals::dms, size));
+    size_t dictionarySize = presetSize;
+
+    long current = -1; //Code of the current string, -1 when empty
+    for (size_t i = 0; i < size; i++) {
+        //If the dictionary size becomes too large
+        if (dictionarySize == globals::dms) {
+            compDictionary.clear();
+            dictionarySize = presetSize;
+        }
+        if (current < 0) {
+            current = lzByteCode(data[i]);
+            continue;
+        }
+        uint32_t key = (uint32_t(current) << 8) | data[i];
+        //Only strings with a preset or single byte code can extend to a preset entry
+        if (size_t(current) < presetSize && preset != nullptr) {
+            auto presetFound = preset->codes.find(key);
+            if (presetFound != preset->codes.end()) {
+                current = presetFound->second;
+                continue;
+            }
+        }
+        auto found = compDictionary.find(key);
+        if (found != compDictionary.end()) {
+            current = found->second;
+        } else {
+            compDictionary[key] = CodeType(dictionarySize++);
+            lzWriteCode(out, CodeType(current));
+            if (out.size() - start > limit) {
+                return false;
+            }
+            current = lzByteCode(data[i]);
+        }
+    }
+
+    if (current >= 0) {
+        lzWriteCode(out, CodeType(current));
+    }
+    return out.size() - start <= limit;
+}
+
+/*
+* Lempel-Ziv Compress
+* Compresses bytes already in memory (e.g. a mapped file) to the same output
+* as the stream version, without reading them through a stream
+*/
+void lzCompress(const unsigned char *data, size_t size, std::ostream &os, const LZDictionary *preset = nullptr) {
+    std::vector<unsigned char> codes;
+    lzCompressBlock(data, size, codes, SIZE_MAX, preset);
+    os.write(reinterpret_cast<const char *>(codes.data()), std::streamsize(codes.size()));
+}
+
+/*
+* Lempel-Ziv Decompress Block
+* Decodes lzCompress output held in memory. Entries are stored as
+* (prefix code, last byte) and spelled out backwards, so adding an entry
+* costs O(1) instead of copying its whole string. Throws once the output
+* would pass limit bytes.
+*/
+void lzDecompressBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        size_t limit = SIZE_MAX, const LZDictionary *preset = nullptr) {
+    StageScope scope("lzDecompressBlock", size);
+    scope.countOutput(out);
+    size_t outStart = out.size();
+    if (size % sizeof(CodeType) != 0) {
+        throw std::runtime_error("corrupted compressed file");
+    }
+    size_t presetSize = 256 + (preset != nullptr ? preset->size() : 0);
+    //Every code adds at most one entry
+    size_t capacity = std::min<size_t>(globals::dms, presetSize + size / sizeof(CodeType)) + 1;
+    std::vector<CodeType> prefix(capacity);
+    std::vector<unsigned char> lastByte(capacity), firstByte(capacity);
+    std::vector<uint32_t> length(capacity);
+    for (uint32_t c = 0; c < 256; c++) {
+        lastByte[c] = firstByte[c] = (unsigned char)(c ^ 0x80);
+        length[c] = 1;
+    }
+    if (preset != nullptr) {
+        std::copy(preset->prefix.begin(), preset->prefix.end(), prefix.begin() + 256);
+        std::copy(preset->lastByte.begin(), preset->lastByte.end(), lastByte.begin() + 256);
+        std::copy(preset->firstByte.begin(), preset->firstByte.end(), firstByte.begin() + 256);
+        std::copy(preset->length.begin(), preset->length.end(), length.begin() + 256);
+    }
+    size_t dictionarySize = presetSize;
+
+    long previous = -1; //Code of the previous string, -1 when empty
+    for (size_t pos = 0; pos < size; pos += sizeof(CodeType)) {
+        CodeType key;
+        std::memcpy(&key, data + pos, sizeof(CodeType));
+
+        //Dictionary reaches maximum size, reset
+        if (dictionarySize == globals::dms) {
+            dictionarySize = presetSize;
+        }
+        if (key > dictionarySize || (key == dictionarySize && previous < 0)) {
+            throw std::runtime_error("invalid compressed code");
+        }
+        if (previous >= 0) {
+            //New entry is the previous string plus the first byte of this one
+            unsigned char nextByte = (key == dictionarySize) ? firstByte[previous] : firstByte[key];
+            prefix[dictionarySize] = CodeType(previous);
+            lastByte[dictionarySize] = nextByte;
+            firstByte[dictionarySize] = firstByte[previous];
+            length[dictionarySize] = length[previous] + 1;
+            dictionarySize++;
+        }
+
+        //Spell the string out from its last byte back to its first
+        size_t outPos = out.size();
+        if (length[key] > limit - (outPos - outStart)) {
+            throw std::runtime_error("LZ data decodes past the block size");
+        }
+        out.resize(outPos + length[key]);
+        CodeType code = key;
+        for (size_t i = length[key]; i-- > 0;) {
+            out[outPos + i] = lastByte[code];
+            code = prefix[code];
+        }
+        previous = key;
+    }
+}
+
+/*
+* LZ Preset Frame
+* A whole file as one block of lzCompress output made with a preset
+* dictionary, for records too small to carry a container's header, block
+* framing and index. Layout: "ARBZ", u32 dictionary id, u32 CRC32C of the
+* raw bytes, then the codes.
+*/
+const char lzPresetMagic[4] = {'A', 'R', 'B', 'Z'};
+const size_t lzPresetHeaderSize = sizeof(lzPresetMagic) + 2 * sizeof(uint32_t);
+
+void lzPresetCompress(const unsigned char *data, size_t size, std::ostream &os, const LZDictionary &preset) {
+    uint32_t fields[2] = {preset.id, crc32c(data, size)};
+    os.write(lzPresetMagic, sizeof(lzPresetMagic));
+    os.write(reinterpret_cast<const char *>(fields), sizeof(fields));
+    lzCompress(data, size, os, &preset);
+}
+
+//Dictionary id of a preset frame; throws if the data is not one
+uint32_t lzPresetId(const unsigned char *data, size_t size) {
+    if (size < lzPresetHeaderSize || !std::equal(data, data + 4, lzPresetMagic)) {
+        throw std::runtime_error("not an LZ preset frame");
+    }
+    uint32_t id;
+    std::memcpy(&id, data + 4, sizeof(id));
+    return id;
+}
+
+bool isLZPresetFile(const std::string &fileName) {
+    std::ifstream is(fileName, std::ios::binary);
+    char magic[4];
+    return is.read(magic, sizeof(magic)) && std::equal(magic, magic + 4, lzPresetMagic);
+}
+
+/*
+* LZ Preset Decompress
+* Decodes a preset frame with its dictionary and checks the CRC32C
+*/
+void lzPresetDecompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        const LZDictionary &preset) {
+    if (lzPresetId(data, size) != preset.id) {
+        throw std::runtime_error("LZ data was compressed with another dictionary");
+    }
+    uint32_t checksum;
+    std::memcpy(&checksum, data + 8, sizeof(checksum));
+    size_t outStart = out.size();
+    lzDecompressBlock(data + lzPresetHeaderSize, size - lzPresetHeaderSize, out, SIZE_MAX, &preset);
+    if (crc32c(out.data() + outStart, out.size() - outStart) != checksum) {
+        throw std::runtime_error("LZ data fails its checksum");
+    }
+}
+
+/*
+* LZ Dictionary Trainer
+* Parses sample inputs the way lzCompressBlock does, each from an empty
+* string but all growing one shared dictionary, and counts how often every
+* entry is stepped through. build keeps the most used entries.
+*/
+class LZDictionaryTrainer {
+public:
+    LZDictionaryTrainer() {
+        codes.reserve(globals::dms);
+    }
+
+    void addSample(const unsigned char *data, size_t size) {
+        long current = -1;
+        for (size_t i = 0; i < size; i++) {
+            if (current < 0) {
+                current = lzByteCode(data[i]);
+                continue;
+            }
+            uint32_t key = (uint32_t(current) << 8) | data[i];
+            auto found = codes.find(key);
+            if (found != codes.end()) {
+                current = found->second;
+                visits[current - 256]++;
+                continue;
+            }
+            //Once the code space is used up the samples are only counted
+            if (256 + prefix.size() < globals::dms) {
+                codes[key] = CodeType(256 + prefix.size());
+                prefix.push_back(CodeType(current));
+                lastByte.push_back(data[i]);
+                visits.push_back(0);
+            }
+            current = lzByteCode(data[i]);
+        }
+    }
+
+    /*
+    * Build
+    * The entries used at least twice, most used first, up to maxEntries. An
+    * entry is never used more often than its prefix, which was created
+    * earlier, so with ties kept in creation order every kept entry's prefix
+    * is kept too.
+    */
+    LZDictionary build(size_t maxEntries = lzDictionaryDefaultEntries) const {
+        std::vector<size_t> order;
+        for (size_t i = 0; i < visits.size(); i++) {
+            if (visits[i] >= 2) {
+                order.push_back(i);
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return visits[a] > visits[b];
+        });
+        order.resize(std::min(order.size(), std::min(maxEntries, lzDictionaryMaxEntries)));
+        std::sort(order.begin(), order.end());
+
+        //Renumbers the kept entries from 256 on, in creation order
+        std::vector<CodeType> renumbered(prefix.size());
+        LZDictionary dictionary;
+        for (size_t i = 0; i < order.size(); i++) {
+            size_t entry = order[i];
+            renumbered[entry] = CodeType(256 + i);
+            dictionary.prefix.push_back(prefix[entry] < 256 ? prefix[entry] : renumbered[prefix[entry] - 256]);
+            dictionary.lastByte.push_back(lastByte[entry]);
+        }
+        finishLZDictionary(dictionary);
+        return dictionary;
+    }
+
+private:
+    std::unordered_map<uint32_t, CodeType> codes;
+    std::vector<CodeType> prefix;
+    std::vector<unsigned char> lastByte;
+    std::vector<uint64_t> visits;
+};
+
 #endif //LZ_ALGORITHMS_HPP
\ No newline at end of file
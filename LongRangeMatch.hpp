@@ -0,0 +1,205 @@
+#ifndef LONG_RANGE_MATCH_HPP
+#define LONG_RANGE_MATCH_HPP
+
+/*
+LongRangeMatch:
+A pre-pass that replaces repeats far apart in a block with references, for
+codecs whose own reach is short (LZW resets its dictionary every 65535
+codes, DEFLATE looks back 32 KiB). A rolling hash over 64 bytes is computed
+at every position, and about one position in eight, picked by the hash
+itself so that repeated content is picked at the same places, is kept in a
+sparse table of the last position seen per hash. A hit is checked against
+the data, then extended both ways. The window is the whole block, so a
+chain such as "LRM,LZ:256M" finds repeats up to 256 MiB apart; the table
+stays at most 32 MiB however large the block.
+----------------------------------------------------------
+Output: number of matches, then per match the literal bytes before it, its
+length less 64 and its distance (all LEB128 numbers), then every literal
+byte of the block back to back, so the next stage sees them uninterrupted.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include "StageStats.hpp"
+
+const size_t lrmMinMatch = 64;        //Bytes under the rolling hash, and the shortest match
+const uint64_t lrmSampleMask = 7;     //One position in eight goes into the table
+const uint64_t lrmPrime = 0x100000001B3ull;
+const int lrmMaxTableLog = 22;
+
+struct LrmEntry {
+    uint32_t position;
+    uint32_t check;
+};
+
+//Spreads the rolling hash, whose low bits only depend on the low bits of the bytes
+uint64_t lrmMix(uint64_t hash) {
+    return (hash ^ (hash >> 29)) * 0x9E3779B97F4A7C15ull;
+}
+
+uint64_t lrmHash(const unsigned char *data) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < lrmMinMatch; i++) {
+        hash = hash * lrmPrime + data[i] + 1;
+    }
+    return hash;
+}
+
+void writeLrmNumber(uint64_t value, std::vector<unsigned char> &out) {
+    while (value >= 0x80) {
+        out.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+uint64_t readLrmNumber(const unsigned char *data, size_t size, size_t &position) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (position >= size) {
+            throw std::runtime_error("LRM block is truncated");
+        }
+        unsigned char byte = data[position++];
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw std::runtime_error("LRM block has an invalid number");
+}
+
+/*
+* Long Range Match Encode
+* Appends the block with its long repeats replaced by references
+*/
+void lrmEncode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    StageScope scope("lrmEncode", size);
+    size_t outStart = out.size();
+    std::vector<uint64_t> matches;   //Literal length, length less the minimum and distance of each match
+    std::vector<unsigned char> literals;
+
+    size_t literalStart = 0;
+    if (size >= 2 * lrmMinMatch) {
+        //About one table entry per 16 bytes, sampled at one in eight, so recent entries mostly survive
+        int tableLog = 10;
+        while (tableLog < lrmMaxTableLog && (size_t(1) << tableLog) < size / 16) {
+            tableLog++;
+        }
+        std::vector<LrmEntry> table(size_t(1) << tableLog, LrmEntry{0, 0});
+        uint64_t outFactor = 1;
+        for (size_t i = 0; i < lrmMinMatch; i++) {
+            outFactor *= lrmPrime;
+        }
+
+        size_t position = 0;
+        uint64_t hash = lrmHash(data);
+        while (true) {
+            uint64_t mixed = lrmMix(hash);
+            if (((mixed >> 20) & lrmSampleMask) == 0) {
+                LrmEntry &entry = table[size_t(mixed >> (64 - tableLog))];
+                uint32_t check = uint32_t(mixed);
+                size_t candidate = entry.position;
+                if (entry.check == check && candidate < position &&
+                    std::memcmp(data + candidate, data + position, lrmMinMatch) == 0) {
+                    size_t length = lrmMinMatch;
+                    while (position + length < size && data[candidate + length] == data[position + length]) {
+                        length++;
+                    }
+                    //Takes in the pending literals the match also covers
+                    while (position > literalStart && candidate > 0 && data[candidate - 1] == data[position - 1]) {
+                        position--;
+                        candidate--;
+                        length++;
+                    }
+                    matches.push_back(position - literalStart);
+                    matches.push_back(length - lrmMinMatch);
+                    matches.push_back(position - candidate);
+                    literals.insert(literals.end(), data + literalStart, data + position);
+                    entry = LrmEntry{uint32_t(position), check};
+                    position += length;
+                    literalStart = position;
+                    if (position + lrmMinMatch > size) {
+                        break;
+                    }
+                    hash = lrmHash(data + position);
+                    continue;
+                }
+                entry = LrmEntry{uint32_t(position), check};
+            }
+            if (position + lrmMinMatch >= size) {
+                break;
+            }
+            hash = hash * lrmPrime + data[position + lrmMinMatch] + 1 - (uint64_t(data[position]) + 1) * outFactor;
+            position++;
+        }
+    }
+    literals.insert(literals.end(), data + literalStart, data + size);
+
+    writeLrmNumber(matches.size() / 3, out);
+    for (uint64_t value : matches) {
+        writeLrmNumber(value, out);
+    }
+    out.insert(out.end(), literals.begin(), literals.end());
+    scope.addBytesOut(out.size() - outStart);
+}
+
+/*
+* Long Range Match Decode
+* Rebuilds the block, copying every match from the output written so far;
+* throws once the output would pass limit bytes
+*/
+void lrmDecode(const unsigned char *data, size_t size, std::vector<unsigned char> &out, size_t limit = SIZE_MAX) {
+    StageScope scope("lrmDecode", size);
+    size_t outStart = out.size();
+    size_t position = 0;
+    uint64_t matchCount = readLrmNumber(data, size, position);
+    if (matchCount > size / 3) {
+        throw std::runtime_error("LRM block is truncated");
+    }
+    //Literals follow the match list, so it is read once to find where they start
+    size_t literalPosition = position;
+    for (uint64_t i = 0; i < matchCount * 3; i++) {
+        readLrmNumber(data, size, literalPosition);
+    }
+
+    for (uint64_t i = 0; i < matchCount; i++) {
+        uint64_t literalLength = readLrmNumber(data, size, position);
+        uint64_t length = readLrmNumber(data, size, position) + lrmMinMatch;
+        uint64_t distance = readLrmNumber(data, size, position);
+        if (literalLength > size - literalPosition) {
+            throw std::runtime_error("LRM block is truncated");
+        }
+        if (literalLength > limit - (out.size() - outStart)) {
+            throw std::runtime_error("LRM block decodes past the block size");
+        }
+        out.insert(out.end(), data + literalPosition, data + literalPosition + literalLength);
+        literalPosition += literalLength;
+        size_t written = out.size() - outStart;
+        if (distance == 0 || distance > written || length > UINT32_MAX) {
+            throw std::runtime_error("LRM match refers outside the block");
+        }
+        if (length > limit - written) {
+            throw std::runtime_error("LRM block decodes past the block size");
+        }
+        size_t from = out.size() - size_t(distance);
+        out.resize(out.size() + size_t(length));
+        unsigned char *target = out.data() + out.size() - size_t(length);
+        if (distance >= length) {
+            std::memcpy(target, out.data() + from, size_t(length));
+        } else {
+            //Overlapping copies repeat the last distance bytes
+            for (size_t j = 0; j < length; j++) {
+                target[j] = out[from + j];
+            }
+        }
+    }
+    if (size - literalPosition > limit - (out.size() - outStart)) {
+        throw std::runtime_error("LRM block decodes past the block size");
+    }
+    out.insert(out.end(), data + literalPosition, data + size);
+    scope.addBytesOut(out.size() - outStart);
+}
+
+#endif //LONG_RANGE_MATCH_HPP
@@ -0,0 +1,68 @@
+#ifndef MTF_TRANSFORM_HPP
+#define MTF_TRANSFORM_HPP
+
+/*
+MTFTransform:
+Move-to-front transform. Each byte is replaced by its position in a list of
+recently used bytes and then moved to the front, so the runs of similar
+bytes that BWT produces become runs of small numbers (mostly zeros) for RLE
+and Huffman coding to work on.
+*/
+
+#include <cstddef>
+#include <vector>
+#include "StageStats.hpp"
+
+/*
+* Move To Front Encode
+* Writes the list position of every byte
+*/
+void mtfEncode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    StageScope scope("mtfEncode", size);
+    scope.addBytesOut(size);
+    unsigned char order[256];
+    for (int i = 0; i < 256; i++) {
+        order[i] = (unsigned char)i;
+    }
+    size_t outPos = out.size();
+    out.resize(outPos + size);
+    for (size_t i = 0; i < size; i++) {
+        unsigned char byte = data[i];
+        unsigned char position = 0;
+        while (order[position] != byte) {
+            position++;
+        }
+        out[outPos + i] = position;
+        //Shift the bytes in front of it back by one
+        for (; position > 0; position--) {
+            order[position] = order[position - 1];
+        }
+        order[0] = byte;
+    }
+}
+
+/*
+* Move To Front Decode
+* Replays the list updates to turn positions back into bytes
+*/
+void mtfDecode(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    StageScope scope("mtfDecode", size);
+    scope.addBytesOut(size);
+    unsigned char order[256];
+    for (int i = 0; i < 256; i++) {
+        order[i] = (unsigned char)i;
+    }
+    size_t outPos = out.size();
+    out.resize(outPos + size);
+    for (size_t i = 0; i < size; i++) {
+        unsigned char position = data[i];
+        unsigned char byte = order[position];
+        out[outPos + i] = byte;
+        for (; position > 0; position--) {
+            order[position] = order[position - 1];
+        }
+        order[0] = byte;
+    }
+}
+
+#endif //MTF_TRANSFORM_HPP
@@ -0,0 +1,132 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+/*
+MappedFile:
+Maps a whole file read-only into memory so algorithms can work on the bytes
+directly, without reading them through a stream into their own buffers.
+The mapping is released when the object goes out of scope.
+*/
+
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+
+#ifdef _WIN32
+//Keeps windows.h from defining min and max macros, which break std::min and std::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+public:
+    MappedFile() : mappedData(nullptr), mappedSize(0) {}
+
+    explicit MappedFile(const std::string &fileName) : mappedData(nullptr), mappedSize(0) {
+        open(fileName);
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    //Mappings own OS handles, so they can be moved but not copied
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) : mappedData(other.mappedData), mappedSize(other.mappedSize) {
+        other.mappedData = nullptr;
+        other.mappedSize = 0;
+    }
+
+    /*
+    * Open
+    * Maps the named file, throws if it cannot be opened or mapped
+    */
+    void open(const std::string &fileName) {
+        close();
+#ifdef _WIN32
+        HANDLE fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("cannot open file " + fileName);
+        }
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(fileHandle, &fileSize);
+        mappedSize = static_cast<size_t>(fileSize.QuadPart);
+        if (mappedSize != 0) {
+            HANDLE mapHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapHandle != NULL) {
+                mappedData = static_cast<const unsigned char *>(MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapHandle);
+            }
+        }
+        CloseHandle(fileHandle);
+#else
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open file " + fileName);
+        }
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat file " + fileName);
+        }
+        mappedSize = static_cast<size_t>(fileInfo.st_size);
+        if (mappedSize != 0) {
+            void *addr = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                mappedData = static_cast<const unsigned char *>(addr);
+            }
+        }
+        ::close(fd);
+#endif
+        //An empty file is valid and simply has no bytes to map
+        if (mappedSize != 0 && mappedData == nullptr) {
+            mappedSize = 0;
+            throw std::runtime_error("cannot map file " + fileName);
+        }
+    }
+
+    //Releases the mapping, safe to call more than once
+    void close() {
+        if (mappedData != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(mappedData);
+#else
+            munmap(const_cast<unsigned char *>(mappedData), mappedSize);
+#endif
+        }
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+
+    const unsigned char *data() const { return mappedData; }
+    size_t size() const { return mappedSize; }
+    bool empty() const { return mappedSize == 0; }
+
+    //Tells the OS the bytes will be read front to back, so it reads ahead aggressively
+    void adviseSequential() const {
+#ifndef _WIN32
+        if (mappedData != nullptr) {
+            posix_madvise(const_cast<unsigned char *>(mappedData), mappedSize, POSIX_MADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+private:
+    const unsigned char *mappedData;
+    size_t mappedSize;
+};
+
+#endif //MAPPED_FILE_HPP
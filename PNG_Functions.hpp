@@ -0,0 +1,252 @@
+#ifndef PNG_FUNCTIONS_HPP
+#define PNG_FUNCTIONS_HPP
+
+/*
+PNGFunctions:
+Decodes PNG files with the built-in DEFLATE engine into the same pixel layout
+the BMP module uses (top-down rows, BGR/BGRA or palette indices), so PNG input
+can go through every image codec instead of being treated as opaque bytes.
+Handles every non-interlaced color type and bit depth; 16-bit samples keep
+their high byte and grayscale images become 8 bpp with a gray palette.
+----------------------------------------------------------
+Reference: PNG specification https://www.w3.org/TR/PNG/
+*/
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include "BitMapFunctions.hpp"
+#include "Deflate_Algo.hpp"
+
+const unsigned char pngSignature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+bool isPNG(const unsigned char *data, size_t size) {
+    return size >= sizeof(pngSignature) && std::equal(pngSignature, pngSignature + 8, data);
+}
+
+uint32_t pngReadBE32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+//Paeth predictor (PNG filter type 4)
+unsigned char paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+/*
+* Unfilter Row
+* Undoes the per-row filter in place, given the already unfiltered row above
+*/
+void unfilterPNGRow(int filterType, unsigned char *row, const unsigned char *above, size_t rowBytes, size_t stride) {
+    switch (filterType) {
+        case 0: //None
+            break;
+        case 1: //Sub
+            for (size_t i = stride; i < rowBytes; i++) row[i] += row[i - stride];
+            break;
+        case 2: //Up
+            for (size_t i = 0; i < rowBytes; i++) row[i] += above[i];
+            break;
+        case 3: //Average
+            for (size_t i = 0; i < rowBytes; i++) {
+                int left = i >= stride ? row[i - stride] : 0;
+                row[i] += (unsigned char)((left + above[i]) / 2);
+            }
+            break;
+        case 4: //Paeth
+            for (size_t i = 0; i < rowBytes; i++) {
+                int left = i >= stride ? row[i - stride] : 0;
+                int upperLeft = i >= stride ? above[i - stride] : 0;
+                row[i] += paethPredictor(left, above[i], upperLeft);
+            }
+            break;
+        default:
+            throw std::runtime_error("invalid PNG filter type");
+    }
+}
+
+/*
+* Decode PNG
+* Parses the chunks (verifying their CRCs), inflates the image data,
+* unfilters it and converts it to BMP channel order
+*/
+PixelBuffer decodePNG(const unsigned char *data, size_t size) {
+    if (!isPNG(data, size)) {
+        throw std::runtime_error("not a PNG file");
+    }
+
+    uint32_t width = 0, height = 0;
+    int bitDepth = 0, colorType = -1;
+    std::vector<unsigned char> palette; //RGB triples from PLTE
+    std::vector<unsigned char> idat;
+    bool ended = false;
+
+    size_t pos = sizeof(pngSignature);
+    while (!ended && pos + 12 <= size) {
+        uint32_t length = pngReadBE32(data + pos);
+        const unsigned char *type = data + pos + 4;
+        const unsigned char *chunk = data + pos + 8;
+        if (length > size - pos - 12) {
+            throw std::runtime_error("PNG chunk is truncated");
+        }
+        if (crc32(type, length + 4) != pngReadBE32(chunk + length)) {
+            throw std::runtime_error("PNG chunk checksum mismatch");
+        }
+        std::string typeName(reinterpret_cast<const char *>(type), 4);
+
+        if (typeName == "IHDR") {
+            if (length != 13) {
+                throw std::runtime_error("invalid PNG header");
+            }
+            width = pngReadBE32(chunk);
+            height = pngReadBE32(chunk + 4);
+            bitDepth = chunk[8];
+            colorType = chunk[9];
+            if (chunk[10] != 0 || chunk[11] != 0) {
+                throw std::runtime_error("unknown PNG compression or filter method");
+            }
+            if (chunk[12] != 0) {
+                throw std::runtime_error("interlaced PNG files are not supported");
+            }
+        } else if (typeName == "PLTE") {
+            palette.assign(chunk, chunk + length);
+        } else if (typeName == "IDAT") {
+            idat.insert(idat.end(), chunk, chunk + length);
+        } else if (typeName == "IEND") {
+            ended = true;
+        } else if (!(type[0] & 0x20)) {
+            throw std::runtime_error("unknown critical PNG chunk " + typeName);
+        }
+        pos += 12 + size_t(length);
+    }
+
+    //Valid color type and bit depth pairs
+    int channels;
+    switch (colorType) {
+        case 0: channels = 1; break; //Gray
+        case 2: channels = 3; break; //RGB
+        case 3: channels = 1; break; //Palette
+        case 4: channels = 2; break; //Gray + alpha
+        case 6: channels = 4; break; //RGBA
+        default: throw std::runtime_error("missing or invalid PNG header");
+    }
+    bool depthValid = (bitDepth == 8) || (bitDepth == 16 && colorType != 3) ||
+        ((bitDepth == 1 || bitDepth == 2 || bitDepth == 4) && (colorType == 0 || colorType == 3));
+    if (!depthValid || width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF) {
+        throw std::runtime_error("invalid PNG dimensions or bit depth");
+    }
+    if (colorType == 3 && (palette.empty() || palette.size() % 3 != 0 || palette.size() > 256 * 3)) {
+        throw std::runtime_error("invalid PNG palette");
+    }
+
+    size_t bitsPerPixel = size_t(channels) * bitDepth;
+    size_t rowBytes = (size_t(width) * bitsPerPixel + 7) / 8;
+    size_t filterStride = std::max<size_t>(1, bitsPerPixel / 8);
+
+    std::vector<unsigned char> raw;
+    raw.reserve((rowBytes + 1) * height);
+    zlibDecompress(idat.data(), idat.size(), raw);
+    if (raw.size() < (rowBytes + 1) * height) {
+        throw std::runtime_error("PNG image data is truncated");
+    }
+
+    std::vector<unsigned char> zeroRow(rowBytes, 0);
+    const unsigned char *above = zeroRow.data();
+    for (uint32_t y = 0; y < height; y++) {
+        unsigned char *row = raw.data() + y * (rowBytes + 1);
+        unfilterPNGRow(row[0], row + 1, above, rowBytes, filterStride);
+        above = row + 1;
+    }
+
+    //Sample i of a row, scaled down to 8 bits
+    const auto sample = [bitDepth](const unsigned char *row, size_t i) -> unsigned char {
+        if (bitDepth == 8) return row[i];
+        if (bitDepth == 16) return row[i * 2];
+        size_t bit = i * bitDepth;
+        unsigned mask = (1u << bitDepth) - 1;
+        return (unsigned char)((row[bit / 8] >> (8 - bitDepth - bit % 8)) & mask);
+    };
+
+    int outBytesPerPixel = (colorType == 0 || colorType == 3) ? 1 : (colorType == 2 ? 3 : 4);
+    PixelBuffer image(width, height, outBytesPerPixel);
+    if (colorType == 3) {
+        image.palette.resize(palette.size() / 3 * 4, 0);
+        for (size_t i = 0; i * 3 < palette.size(); i++) {
+            image.palette[i * 4 + 0] = palette[i * 3 + 2];
+            image.palette[i * 4 + 1] = palette[i * 3 + 1];
+            image.palette[i * 4 + 2] = palette[i * 3 + 0];
+        }
+    } else if (colorType == 0) {
+        image.palette.resize(256 * 4, 0);
+        for (int i = 0; i < 256; i++) {
+            image.palette[i * 4] = image.palette[i * 4 + 1] = image.palette[i * 4 + 2] = (unsigned char)i;
+        }
+    }
+
+    int grayScale = (colorType == 0 && bitDepth < 8) ? 255 / ((1 << bitDepth) - 1) : 1;
+    for (uint32_t y = 0; y < height; y++) {
+        const unsigned char *row = raw.data() + y * (rowBytes + 1) + 1;
+        unsigned char *out = image.row(y);
+        for (uint32_t x = 0; x < width; x++) {
+            size_t s = size_t(x) * channels;
+            switch (colorType) {
+                case 0:
+                    out[x] = (unsigned char)(sample(row, s) * grayScale);
+                    break;
+                case 3:
+                    out[x] = sample(row, s);
+                    break;
+                case 2:
+                    out[x * 3 + 0] = sample(row, s + 2);
+                    out[x * 3 + 1] = sample(row, s + 1);
+                    out[x * 3 + 2] = sample(row, s);
+                    break;
+                case 4:
+                    out[x * 4 + 0] = out[x * 4 + 1] = out[x * 4 + 2] = sample(row, s);
+                    out[x * 4 + 3] = sample(row, s + 1);
+                    break;
+                case 6:
+                    out[x * 4 + 0] = sample(row, s + 2);
+                    out[x * 4 + 1] = sample(row, s + 1);
+                    out[x * 4 + 2] = sample(row, s);
+                    out[x * 4 + 3] = sample(row, s + 3);
+                    break;
+            }
+        }
+    }
+    return image;
+}
+
+/*
+* SourceImage
+* Any supported input image, chosen by its signature. BMP files stay mapped
+* and are viewed in place; PNG files are decoded once into a pixel buffer.
+*/
+class SourceImage {
+public:
+    explicit SourceImage(const std::string &fileName) : file(fileName) {
+        if (isPNG(file.data(), file.size())) {
+            decoded = decodePNG(file.data(), file.size());
+            imageView = decoded.view();
+            file.close();
+        } else {
+            imageView = bmpView(file.data(), parseBmpHeader(file.data(), file.size()));
+        }
+    }
+
+    const ImageView &view() const { return imageView; }
+
+private:
+    MappedFile file;
+    PixelBuffer decoded;
+    ImageView imageView;
+};
+
+#endif //PNG_FUNCTIONS_HPP
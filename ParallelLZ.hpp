@@ -0,0 +1,176 @@
+#ifndef PARALLEL_LZ_HPP
+#define PARALLEL_LZ_HPP
+
+/*
+ParallelLZ:
+Lempel-Ziv over independent chunks. The input is cut into fixed-size chunks
+and each one is compressed with its own dictionary on the thread pool, so
+one large file uses every core in both directions. Chunks are written in
+order behind length prefixes; only a window of chunks is in flight at once,
+so memory stays bounded however large the file is.
+----------------------------------------------------------
+File layout (host byte order, like the LZ codes), for every chunk:
+    u32 raw size, u32 stored size, then a tag byte followed by the LZ codes,
+    or by the raw chunk when LZ would not shrink it
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include "LZ_Algorithms.hpp"
+#include "Codec_Pipeline.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+const size_t defaultLZChunkSize = 1 << 22;
+
+/*
+* Drain Chunks
+* Waits for every chunk still in flight; tasks point into the caller's
+* buffers, so none may outlive an early exit
+*/
+template <class T>
+void drainChunks(std::deque<std::future<T>> &inFlight, ThreadPool &pool) {
+    for (auto &chunk : inFlight) {
+        if (chunk.valid()) pool.waitFor(chunk);
+    }
+    inFlight.clear();
+}
+
+/*
+* Parallel LZ Compress
+* Compresses the chunks of data in parallel and writes them in order
+*/
+void parallelLZCompress(const unsigned char *data, size_t size, std::ostream &os, ThreadPool &pool,
+        size_t chunkSize = defaultLZChunkSize) {
+    if (chunkSize == 0 || chunkSize > UINT32_MAX) {
+        throw std::invalid_argument("chunk size must be between 1 byte and 4 GiB");
+    }
+    size_t chunkCount = (size + chunkSize - 1) / chunkSize;
+    size_t window = pool.size() * 4;
+
+    std::deque<std::future<std::vector<unsigned char>>> inFlight;
+    size_t submitted = 0;
+    try {
+        for (size_t written = 0; written < chunkCount; written++) {
+            //Keep the window full; chunks finish out of order but are written in order
+            while (submitted < chunkCount && inFlight.size() < window) {
+                const unsigned char *chunk = data + submitted * chunkSize;
+                size_t chunkBytes = std::min(chunkSize, size - submitted * chunkSize);
+                inFlight.push_back(pool.submit([chunk, chunkBytes] {
+                    std::vector<unsigned char> codes;
+                    codes.reserve(chunkBytes + 1);
+                    codes.push_back(encodedBlockTag);
+                    if (!lzCompressBlock(chunk, chunkBytes, codes, chunkBytes - 1)) {
+                        codes.assign(1, storedBlockTag);
+                        codes.insert(codes.end(), chunk, chunk + chunkBytes);
+                    }
+                    return codes;
+                }));
+                submitted++;
+            }
+
+            pool.waitFor(inFlight.front());
+            std::vector<unsigned char> codes = inFlight.front().get();
+            inFlight.pop_front();
+            uint32_t sizes[2] = {uint32_t(std::min(chunkSize, size - written * chunkSize)), uint32_t(codes.size())};
+            os.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+            os.write(reinterpret_cast<const char *>(codes.data()), codes.size());
+        }
+    }
+    catch (...) {
+        drainChunks(inFlight, pool);
+        throw;
+    }
+    if (!os) {
+        throw std::runtime_error("failed writing the compressed chunks");
+    }
+}
+
+/*
+* Parallel LZ Decompress
+* Finds every chunk from the length prefixes, then decodes them in parallel
+* and writes them in order
+*/
+void parallelLZDecompress(const unsigned char *data, size_t size, std::ostream &os, ThreadPool &pool) {
+    struct Chunk {
+        const unsigned char *codes;
+        uint32_t rawSize;
+        uint32_t codeSize;
+    };
+    std::vector<Chunk> chunks;
+    for (size_t pos = 0; pos < size;) {
+        uint32_t sizes[2];
+        if (size - pos < sizeof(sizes)) {
+            throw std::runtime_error("chunk header is truncated");
+        }
+        std::memcpy(sizes, data + pos, sizeof(sizes));
+        pos += sizeof(sizes);
+        if (sizes[1] > size - pos) {
+            throw std::runtime_error("chunk is truncated");
+        }
+        chunks.push_back(Chunk{data + pos, sizes[0], sizes[1]});
+        pos += sizes[1];
+    }
+
+    size_t window = pool.size() * 4;
+    std::deque<std::future<std::vector<unsigned char>>> inFlight;
+    size_t submitted = 0;
+    try {
+        for (size_t written = 0; written < chunks.size(); written++) {
+            while (submitted < chunks.size() && inFlight.size() < window) {
+                Chunk chunk = chunks[submitted++];
+                inFlight.push_back(pool.submit([chunk] {
+                    std::vector<unsigned char> raw;
+                    if (chunk.codeSize == 0 || chunk.codes[0] > encodedBlockTag) {
+                        throw std::runtime_error("invalid chunk tag");
+                    }
+                    if (chunk.codes[0] == storedBlockTag) {
+                        raw.assign(chunk.codes + 1, chunk.codes + chunk.codeSize);
+                    } else {
+                        //The recorded size caps the decode, so a damaged chunk cannot grow past it
+                        lzDecompressBlock(chunk.codes + 1, chunk.codeSize - 1, raw, chunk.rawSize);
+                    }
+                    if (raw.size() != chunk.rawSize) {
+                        throw std::runtime_error("decoded chunk has the wrong size");
+                    }
+                    return raw;
+                }));
+            }
+
+            pool.waitFor(inFlight.front());
+            std::vector<unsigned char> raw = inFlight.front().get();
+            inFlight.pop_front();
+            os.write(reinterpret_cast<const char *>(raw.data()), raw.size());
+        }
+    }
+    catch (...) {
+        drainChunks(inFlight, pool);
+        throw;
+    }
+    if (!os) {
+        throw std::runtime_error("failed writing the decompressed chunks");
+    }
+}
+
+/*
+* Parallel LZ File
+* Maps the input file and compresses or decompresses it into os
+*/
+void parallelLZFile(const std::string &input, std::ostream &os, bool compress, ThreadPool &pool,
+        size_t chunkSize = defaultLZChunkSize) {
+    MappedFile file(input);
+    if (compress) {
+        parallelLZCompress(file.data(), file.size(), os, pool, chunkSize);
+    } else {
+        parallelLZDecompress(file.data(), file.size(), os, pool);
+    }
+}
+
+#endif //PARALLEL_LZ_HPP
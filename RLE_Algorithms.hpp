@@ -1,6 +1,14 @@
 #ifndef RLE_ALGOS_HPP
 #define RLE_ALGOS_HPP
 
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+#include "BitMapFunctions.hpp"
+#include "StageStats.hpp"
+
 using std::cout;
 using std::endl;
 using std::ios;
@@ -13,11 +21,14 @@ char escCharEndNum = 0x02;
 * This function uses the RLE algorithm to encode/compress data
 */
 void runLengthEncode(std::istream &is, std::ostream &os){
+    StageScope scope("runLengthEncode");
+    std::streampos outStart = os.tellp();
     char ch; //Buffering character
     char prev_ch; //Holds previous characters
     int count = 1; //Counts number of chars in a run
-    is.get(prev_ch); //Get first char of input stream
+    uint64_t bytesRead = is.get(prev_ch) ? 1 : 0; //Get first char of input stream
     while (is.get(ch)) {
+        bytesRead++;
         if(ch != prev_ch) { //Character has changed from a run
             
             os << count << escCharEndNum << prev_ch;
@@ -26,6 +37,11 @@ void runLengthEncode(std::istream &is, std::ostream &os){
         count++;
         prev_ch = ch; //Set prev_ch to char just read
     } os << count << escCharEndNum << prev_ch; //Reads last character to output
+
+    scope.addBytesIn(bytesRead);
+    if (outStart != std::streampos(-1) && os.tellp() != std::streampos(-1)) {
+        scope.addBytesOut(uint64_t(os.tellp() - outStart));
+    }
 }
 
 /*
@@ -33,6 +49,7 @@ void runLengthEncode(std::istream &is, std::ostream &os){
 * This function uses the RLE algorithm to decode/decompress data
 */
 std::string runLengthDecode(std::istream &is){
+    StageScope scope("runLengthDecode");
 
     std::string returnString;
 
@@ -41,6 +58,7 @@ std::string runLengthDecode(std::istream &is){
 
     char ch; //Buffering character
     while (is.get(ch)) {
+        scope.addBytesIn(1);
         numToPrint.push_back(ch);
 
         //Gets number of chars to print
@@ -51,6 +69,7 @@ std::string runLengthDecode(std::istream &is){
             try {
                 int iterationsToPrint = std::stoi(numToPrint); //Converts to int to print
                 is.get(ch); //Gets char to print
+                scope.addBytesIn(1);
                 while(iterationsToPrint--){
                     returnString.push_back( ch );
                 }                
@@ -65,95 +84,228 @@ std::string runLengthDecode(std::istream &is){
             numToPrint = ""; //Clears num and starts again
         }
     }
+    scope.addBytesOut(returnString.size());
     return returnString;
 }
+/*
+* Run Length Encode Block
+* Same format as runLengthEncode (count, escape, character) for data that
+* is already in memory. Stops and returns false once the output passes
+* limit bytes.
+*/
+bool runLengthEncodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        size_t limit = SIZE_MAX) {
+    StageScope scope("runLengthEncodeBlock", size);
+    scope.countOutput(out);
+    size_t start = out.size();
+    size_t i = 0;
+    while (i < size) {
+        if (out.size() - start > limit) {
+            return false;
+        }
+        size_t run = 1;
+        while (i + run < size && data[i + run] == data[i] && run < 0x7FFFFFFF) run++;
+        std::string count = std::to_string(run);
+        out.insert(out.end(), count.begin(), count.end());
+        out.push_back((unsigned char)escCharEndNum);
+        out.push_back(data[i]);
+        i += run;
+    }
+    return out.size() - start <= limit;
+}
+
+/*
+* Run Length Encoding
+* Encodes bytes already in memory (e.g. a mapped file) to the same format as
+* the stream version, writing to the stream in 64 KiB pieces
+*/
+void runLengthEncode(const unsigned char *data, size_t size, std::ostream &os) {
+    StageScope scope("runLengthEncode", size);
+    std::vector<unsigned char> pending;
+    size_t i = 0;
+    while (i < size) {
+        size_t run = 1;
+        while (i + run < size && data[i + run] == data[i] && run < 0x7FFFFFFF) run++;
+        std::string count = std::to_string(run);
+        pending.insert(pending.end(), count.begin(), count.end());
+        pending.push_back((unsigned char)escCharEndNum);
+        pending.push_back(data[i]);
+        i += run;
+        if (pending.size() >= (1 << 16) || i == size) {
+            os.write(reinterpret_cast<const char *>(pending.data()), std::streamsize(pending.size()));
+            scope.addBytesOut(pending.size());
+            pending.clear();
+        }
+    }
+}
+
+/*
+* Run Length Decode Block
+* Decodes runLengthEncodeBlock output, throws on malformed counts
+*/
+void runLengthDecodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+        size_t limit = SIZE_MAX) {
+    StageScope scope("runLengthDecodeBlock", size);
+    scope.countOutput(out);
+    size_t outStart = out.size();
+    size_t pos = 0;
+    while (pos < size) {
+        size_t count = 0;
+        size_t digits = 0;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9' && digits < 10) {
+            count = count * 10 + (data[pos++] - '0');
+            digits++;
+        }
+        if (digits == 0 || pos + 1 >= size || data[pos] != (unsigned char)escCharEndNum || count > 0x7FFFFFFF) {
+            throw std::runtime_error("corrupted RLE data");
+        }
+        if (count > limit - (out.size() - outStart)) {
+            throw std::runtime_error("RLE data decodes past the block size");
+        }
+        out.insert(out.end(), count, data[pos + 1]);
+        pos += 2;
+    }
+}
 /* End of Arbitrary RLE Functions */
 
 /**********************************/
 /*********BMP Fucntions************/
 /**********************************/
 
-typedef struct SPixel {
-    uint8_t red;    
-    uint8_t green;
-    uint8_t blue;
-} PIXEL;
-
-bool compare(SPixel pixel1, SPixel pixel2) {
-    if (pixel1.red == pixel2.red && pixel1.green == pixel2.green && pixel1.blue == pixel2.blue)
-        return true;
-    else return false;
-}
-
-void bmpEncode(std::string &input, std::string &output){
-    unsigned short repetition = 1;
-    PIXEL current;
-    PIXEL next;
+/*
+* BMP Encode View
+* Run length encodes an image view in the row order its BMP header stores
+* rows. The header (and palette) is written first, as-is, then runs of
+* (repetition, pixel); runs continue across rows and padding is left out.
+*/
+void bmpEncodeView(const std::vector<unsigned char> &header, const ImageView &view, std::ostream &compressed) {
+    BmpInfo info = parseBmpHeader(header.data(), header.size(), false);
+    const int pixelSize = view.bytesPerPixel;
 
-std::cout << input << endl; 
+    //Headers are kept so the decoder can rebuild an identical file
+    uint32_t headerLength = uint32_t(header.size());
+    compressed.write((char*)&headerLength, sizeof(headerLength));
+    compressed.write((const char*)header.data(), headerLength);
 
-    std::fstream file;
-    std::fstream compressed;
-    file.open(input, ios::in | ios::binary);
-    if (!file.is_open()) {
-        cout << "cannot open file to encode." << endl;
-        getchar();
-        exit(1);
+    std::vector<char> encodedRow;
+    const unsigned char *current = nullptr;
+    unsigned short repetition = 0;
+    for (int r = 0; r < view.height; r++) {
+        const unsigned char *rowData = view.row(info.topDown ? r : view.height - 1 - r);
+        for (int x = 0; x < view.width; x++) {
+            const unsigned char *next = rowData + x * pixelSize;
+            if (repetition != 0 && repetition < 0xFFFF && std::equal(next, next + pixelSize, current)) {
+                repetition++;
+                continue;
+            }
+            if (repetition != 0) {
+                encodedRow.insert(encodedRow.end(), (char*)&repetition, (char*)&repetition + sizeof(repetition));
+                encodedRow.insert(encodedRow.end(), current, current + pixelSize);
+            }
+            current = next;
+            repetition = 1;
+        }
+        compressed.write(encodedRow.data(), encodedRow.size());
+        encodedRow.clear();
     }
+    if (repetition != 0) {
+        compressed.write((char*)&repetition, sizeof(repetition));
+        compressed.write((const char*)current, pixelSize);
+    }
+}
 
+/*
+* BMP Encode
+* Run length encodes the pixels of a BMP file, read straight from the
+* mapped rows. Works for every bit depth the BMP module supports.
+* Throws std::runtime_error if a file cannot be opened or read.
+*/
+void bmpEncode(const std::string &input, const std::string &output){
+    std::fstream compressed;
     compressed.open(output, ios::out | ios::trunc | ios::binary);
     if (!compressed.is_open()) {
-        cout << "cannot open file to save encoded file." << endl;
-        getchar();
-        exit(1);
+        throw std::runtime_error("cannot open file to save encoded file");
     }
 
-    file.read((char*)&current, sizeof(PIXEL));
-    file.read((char*)&next, sizeof(PIXEL));
+    BmpImage image(input);
+    std::vector<unsigned char> header(image.data(), image.data() + image.info().dataOffset);
+    bmpEncodeView(header, image.view(), compressed);
 
-    while (!file.eof()) {
-        if (!compare(current, next)) {
-            compressed.write((char*)&repetition, sizeof(repetition));
-            compressed.write((char*)&current, sizeof(PIXEL));
-            repetition = 0;
-        }
-        repetition++;
-        current = next;
-        file.read((char*)&next, sizeof(PIXEL));
-    }
-
-    file.close();
     compressed.close();
+    if (!compressed) {
+        throw std::runtime_error("cannot write the encoded file");
+    }
 }
 
-void bmpDecode(std::string &input, std::string &output) {
+/*
+* BMP Decode
+* Rebuilds a BMP written by bmpEncode, restoring row padding.
+* Throws std::runtime_error if a file cannot be opened or the data is damaged.
+*/
+void bmpDecode(const std::string &input, const std::string &output) {
     std::fstream file;
     std::fstream ready;
-    PIXEL current;
-    unsigned short repetition = 0;
 
     file.open(input, ios::in | ios::binary);
     if (!file.is_open()) {
-        cout << "cannot open file to decode." << endl;
-        getchar();
-        exit(1);
+        throw std::runtime_error("cannot open file to decode");
     }
     ready.open(output, ios::trunc | ios::out | ios::binary);
     if (!ready.is_open()) {
-        cout << "cannot open file to save decoded file." << endl;
-        getchar();
-        exit(1);
+        throw std::runtime_error("cannot open file to save decoded file");
+    }
+
+    file.seekg(0, std::ios::end);
+    uint64_t inputSize = uint64_t(file.tellg());
+    file.seekg(0, std::ios::beg);
+
+    //The header length comes from the file, so it is checked against the file before anything is allocated
+    uint32_t headerLength = 0;
+    file.read((char*)&headerLength, sizeof(headerLength));
+    if (!file || headerLength > inputSize - sizeof(headerLength)) {
+        throw std::runtime_error("encoded BMP header is truncated");
+    }
+    std::vector<unsigned char> header(headerLength);
+    file.read((char*)header.data(), headerLength);
+    if (!file) {
+        throw std::runtime_error("encoded BMP header is truncated");
     }
+    BmpInfo info = parseBmpHeader(header.data(), header.size(), false);
+    ready.write((const char*)header.data(), header.size());
 
-    while (!file.eof()){
-        file.read((char*)&repetition, sizeof(repetition));
-        file.read((char*)&current, sizeof(PIXEL));
-        for (int j = 0; j < repetition; j++)
-            ready.write((char*)&current, sizeof(PIXEL));
+    const int pixelSize = info.bitsPerPixel / 8;
+    const size_t pixelBytes = size_t(info.width) * pixelSize;
+    //A run covers at most 65535 pixels, so a row needs runs the rest of the file has to hold
+    uint64_t runsLeft = (inputSize - sizeof(headerLength) - headerLength) / (sizeof(unsigned short) + pixelSize);
+    if (uint64_t(info.width) > runsLeft * 65535) {
+        throw std::runtime_error("encoded BMP data is too short for its width");
+    }
+    std::vector<char> rowData(info.rowSize, 0); //Padding bytes stay zero
+    size_t filled = 0;
+    int rowsLeft = info.height;
+
+    unsigned short repetition = 0;
+    char current[4];
+    while (rowsLeft > 0 && file.read((char*)&repetition, sizeof(repetition)) && file.read(current, pixelSize)) {
+        for (int j = 0; j < repetition && rowsLeft > 0; j++) {
+            std::copy(current, current + pixelSize, rowData.begin() + filled);
+            filled += pixelSize;
+            if (filled == pixelBytes) {
+                ready.write(rowData.data(), rowData.size());
+                filled = 0;
+                rowsLeft--;
+            }
+        }
+    }
+    if (rowsLeft > 0) {
+        throw std::runtime_error("encoded BMP data ended early, " + std::to_string(rowsLeft) + " rows missing");
     }
 
     file.close();
     ready.close();
+    if (!ready) {
+        throw std::runtime_error("cannot write the decoded file");
+    }
 }
 
 #endif //RLE_ALGOS_HPP
\ No newline at end of file
@@ -0,0 +1,103 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+/*
+SpscQueue:
+A bounded lock-free queue between exactly one producer thread and one
+consumer thread. Slots live in a ring whose size is a power of two; the
+producer only writes the tail and the consumer only writes the head, so each
+side needs one acquire load of the other's index and one release store of
+its own. Blocking push and pop spin briefly, then yield, then sleep in short
+steps (a stage can wait on a slow neighbour for a long time), and give up
+when an abort flag shared by the whole pipeline is raised.
+*/
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <utility>
+
+template <typename T>
+class SpscQueue {
+public:
+    //Capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) : head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    size_t capacity() const { return slots.size(); }
+
+    //Producer side; false when the queue is full
+    bool tryPush(T &item) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == slots.size()) {
+            return false;
+        }
+        slots[currentTail & mask] = std::move(item);
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    //Consumer side; false when the queue is empty
+    bool tryPop(T &item) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == currentHead) {
+            return false;
+        }
+        item = std::move(slots[currentHead & mask]);
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    //Waits for room; false if abort was raised first
+    bool push(T &item, const std::atomic<bool> &abort) {
+        for (unsigned spins = 0; !tryPush(item); spins++) {
+            if (!waitTurn(spins, abort)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //Waits for an item; false if abort was raised first
+    bool pop(T &item, const std::atomic<bool> &abort) {
+        for (unsigned spins = 0; !tryPop(item); spins++) {
+            if (!waitTurn(spins, abort)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static bool waitTurn(unsigned spins, const std::atomic<bool> &abort) {
+        if (abort.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        if (spins >= 256) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        } else if (spins >= 64) {
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    std::vector<T> slots;
+    size_t mask;
+    //Padded onto separate cache lines so the two threads do not share one
+    std::atomic<size_t> head;
+    char headPadding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+};
+
+#endif //SPSC_QUEUE_HPP
@@ -0,0 +1,328 @@
+#ifndef STAGE_STATS_HPP
+#define STAGE_STATS_HPP
+
+/*
+StageStats:
+Per-stage counters: calls, bytes in and out, wall time and CPU time. Each
+algorithm opens a StageScope for the duration of a call; when statistics
+are off (the default) a scope costs one flag check, when on it reads the
+steady clock and the thread's CPU clock at both ends. Counters are atomic,
+so stages running on the thread pool add to the same totals (times are
+summed over calls, so parallel stages can exceed the elapsed time).
+
+Building with -DARB_TRACK_ALLOCATIONS replaces the global operator new and
+delete to also count allocations, bytes allocated and the peak of live heap
+bytes per stage (on the stage's own thread, nested stages included), plus
+process-wide totals in heapTotals.
+*/
+
+#include <cstdint>
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <new>
+
+struct StageCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> wallNanos{0};
+    std::atomic<uint64_t> cpuNanos{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocatedBytes{0};
+    std::atomic<uint64_t> peakHeapBytes{0};   //Largest peak of any one call
+};
+
+//Copy of one stage's counters
+struct StageSnapshot {
+    std::string name;
+    uint64_t calls, bytesIn, bytesOut, wallNanos, cpuNanos;
+    uint64_t allocations, allocatedBytes, peakHeapBytes;
+};
+
+std::atomic<bool> &stageStatsEnabled() {
+    static std::atomic<bool> enabled(false);
+    return enabled;
+}
+
+std::mutex &stageStatsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+//Counters by stage name; std::map keeps references valid as stages are added
+std::map<std::string, StageCounters> &stageStatsTable() {
+    static std::map<std::string, StageCounters> table;
+    return table;
+}
+
+StageCounters &stageCounters(const char *name) {
+    std::lock_guard<std::mutex> lock(stageStatsMutex());
+    return stageStatsTable()[name];
+}
+
+//CPU time of the calling thread, in nanoseconds
+uint64_t threadCpuNanos() {
+#if defined(_WIN32)
+    return uint64_t(std::clock()) * (1000000000ull / CLOCKS_PER_SEC);
+#else
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return uint64_t(now.tv_sec) * 1000000000ull + uint64_t(now.tv_nsec);
+#endif
+}
+
+#if defined(ARB_TRACK_ALLOCATIONS)
+
+//Heap use of one open StageScope on its thread
+struct AllocFrame {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    int64_t live = 0;   //Can go negative when the stage frees older memory
+    int64_t peak = 0;
+};
+
+//Innermost open scope of this thread, null outside stages or while stats are off
+thread_local AllocFrame *currentAllocFrame = nullptr;
+
+//Process-wide heap use, whether or not a stage is open
+struct HeapTotals {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+};
+HeapTotals heapTotals;
+
+//Starts a new peak from the current live bytes
+void resetHeapPeak() {
+    heapTotals.peak = heapTotals.live.load();
+}
+
+void recordAllocation(size_t size) {
+    heapTotals.allocations++;
+    heapTotals.bytes += size;
+    int64_t live = heapTotals.live += int64_t(size);
+    int64_t peak = heapTotals.peak.load(std::memory_order_relaxed);
+    while (live > peak && !heapTotals.peak.compare_exchange_weak(peak, live)) {
+    }
+    if (AllocFrame *frame = currentAllocFrame) {
+        frame->allocations++;
+        frame->bytes += size;
+        frame->live += int64_t(size);
+        frame->peak = std::max(frame->peak, frame->live);
+    }
+}
+
+void recordRelease(size_t size) {
+    heapTotals.live -= int64_t(size);
+    if (AllocFrame *frame = currentAllocFrame) {
+        frame->live -= int64_t(size);
+    }
+}
+
+//Every block carries its size in front, so delete knows how much is freed
+const size_t allocHeaderSize = alignof(std::max_align_t);
+
+//Kept out of line, where GCC would otherwise pair inlined malloc and free calls with new and delete
+#if defined(__GNUC__)
+#define ALLOC_HOOK __attribute__((noinline))
+#else
+#define ALLOC_HOOK
+#endif
+
+ALLOC_HOOK void *operator new(std::size_t size) {
+    void *block = std::malloc(size + allocHeaderSize);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    *static_cast<size_t *>(block) = size;
+    recordAllocation(size);
+    return static_cast<char *>(block) + allocHeaderSize;
+}
+
+ALLOC_HOOK void operator delete(void *pointer) noexcept {
+    if (pointer == nullptr) {
+        return;
+    }
+    void *block = static_cast<char *>(pointer) - allocHeaderSize;
+    recordRelease(*static_cast<size_t *>(block));
+    std::free(block);
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete[](void *pointer) noexcept {
+    operator delete(pointer);
+}
+
+#endif
+
+/*
+* StageScope
+* Times the enclosing block as one call of the named stage. Byte counts can
+* be given up front or added once they are known.
+*/
+class StageScope {
+public:
+    explicit StageScope(const char *name_p, uint64_t bytesIn_p = 0)
+        : name(name_p), active(stageStatsEnabled().load(std::memory_order_relaxed)),
+          bytesIn(bytesIn_p), bytesOut(0), cpuStart(0), output(nullptr), outputStart(0) {
+        if (active) {
+            wallStart = std::chrono::steady_clock::now();
+            cpuStart = threadCpuNanos();
+#if defined(ARB_TRACK_ALLOCATIONS)
+            parentFrame = currentAllocFrame;
+            currentAllocFrame = &frame;
+#endif
+        }
+    }
+
+    ~StageScope() {
+        if (!active) {
+            return;
+        }
+        uint64_t wall = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - wallStart).count());
+        uint64_t cpu = threadCpuNanos() - cpuStart;
+        if (output != nullptr) {
+            bytesOut += output->size() - outputStart;
+        }
+#if defined(ARB_TRACK_ALLOCATIONS)
+        //The table's own allocations belong to no stage
+        currentAllocFrame = nullptr;
+#endif
+        StageCounters &counters = stageCounters(name);
+        counters.calls++;
+        counters.bytesIn += bytesIn;
+        counters.bytesOut += bytesOut;
+        counters.wallNanos += wall;
+        counters.cpuNanos += cpu;
+#if defined(ARB_TRACK_ALLOCATIONS)
+        counters.allocations += frame.allocations;
+        counters.allocatedBytes += frame.bytes;
+        uint64_t peak = uint64_t(std::max<int64_t>(frame.peak, 0));
+        uint64_t largest = counters.peakHeapBytes.load();
+        while (peak > largest && !counters.peakHeapBytes.compare_exchange_weak(largest, peak)) {
+        }
+        //An enclosing stage includes this one
+        currentAllocFrame = parentFrame;
+        if (parentFrame != nullptr) {
+            parentFrame->allocations += frame.allocations;
+            parentFrame->bytes += frame.bytes;
+            parentFrame->peak = std::max(parentFrame->peak, parentFrame->live + frame.peak);
+            parentFrame->live += frame.live;
+        }
+#endif
+    }
+
+    StageScope(const StageScope &) = delete;
+    StageScope &operator=(const StageScope &) = delete;
+
+    void addBytesIn(uint64_t bytes) { bytesIn += bytes; }
+    void addBytesOut(uint64_t bytes) { bytesOut += bytes; }
+
+    //Counts whatever is appended to out before the scope ends, on any return path
+    void countOutput(const std::vector<unsigned char> &out) {
+        output = &out;
+        outputStart = out.size();
+    }
+
+private:
+    const char *name;
+    bool active;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    std::chrono::steady_clock::time_point wallStart;
+    uint64_t cpuStart;
+    const std::vector<unsigned char> *output;
+    size_t outputStart;
+#if defined(ARB_TRACK_ALLOCATIONS)
+    AllocFrame frame;
+    AllocFrame *parentFrame = nullptr;
+#endif
+};
+
+/*
+* Stage Stats Snapshot
+* Copies the counters of every stage that ran, in name order
+*/
+std::vector<StageSnapshot> stageStatsSnapshot() {
+    std::lock_guard<std::mutex> lock(stageStatsMutex());
+    std::vector<StageSnapshot> snapshot;
+    for (auto &entry : stageStatsTable()) {
+        const StageCounters &c = entry.second;
+        snapshot.push_back(StageSnapshot{entry.first, c.calls, c.bytesIn, c.bytesOut, c.wallNanos, c.cpuNanos,
+            c.allocations, c.allocatedBytes, c.peakHeapBytes});
+    }
+    return snapshot;
+}
+
+//Forgets every stage, e.g. between benchmark runs
+void resetStageStats() {
+    std::lock_guard<std::mutex> lock(stageStatsMutex());
+    stageStatsTable().clear();
+}
+
+/*
+* Print Stage Stats
+* One row per stage that ran, as a table
+*/
+void printStageStats(std::ostream &os) {
+    os << std::endl << std::left << std::setw(22) << "stage" << std::right << std::setw(8) << "calls" <<
+        std::setw(14) << "bytes in" << std::setw(14) << "bytes out" << std::setw(11) << "wall ms" <<
+        std::setw(11) << "cpu ms" << std::setw(10) << "MB/s";
+#if defined(ARB_TRACK_ALLOCATIONS)
+    os << std::setw(11) << "allocs" << std::setw(11) << "alloc MB" << std::setw(10) << "peak MB";
+#endif
+    os << std::endl;
+    for (auto &s : stageStatsSnapshot()) {
+        double wallMs = s.wallNanos / 1e6;
+        os << std::left << std::setw(22) << s.name << std::right << std::setw(8) << s.calls <<
+            std::setw(14) << s.bytesIn << std::setw(14) << s.bytesOut << std::fixed << std::setprecision(2) <<
+            std::setw(11) << wallMs << std::setw(11) << s.cpuNanos / 1e6 <<
+            std::setw(10) << (wallMs > 0 ? s.bytesIn / wallMs / 1e3 : 0);
+#if defined(ARB_TRACK_ALLOCATIONS)
+        os << std::setw(11) << s.allocations << std::setw(11) << s.allocatedBytes / 1e6 <<
+            std::setw(10) << s.peakHeapBytes / 1e6;
+#endif
+        os << std::endl;
+    }
+}
+
+/*
+* Write Stage Stats JSON
+* Counters as a JSON object keyed by stage name, indented for nesting
+*/
+void writeStageStatsJson(const std::vector<StageSnapshot> &snapshot, std::ostream &os,
+        const std::string &indent = "") {
+    os << "{";
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        const StageSnapshot &s = snapshot[i];
+        os << (i ? "," : "") << "\n" << indent << "  \"" << s.name << "\": {\"calls\": " << s.calls <<
+            ", \"bytes_in\": " << s.bytesIn << ", \"bytes_out\": " << s.bytesOut <<
+            ", \"wall_ns\": " << s.wallNanos << ", \"cpu_ns\": " << s.cpuNanos;
+#if defined(ARB_TRACK_ALLOCATIONS)
+        os << ", \"allocations\": " << s.allocations << ", \"allocated_bytes\": " << s.allocatedBytes <<
+            ", \"peak_heap_bytes\": " << s.peakHeapBytes;
+#endif
+        os << "}";
+    }
+    os << "\n" << indent << "}";
+}
+
+void writeStageStatsJson(std::ostream &os) {
+    writeStageStatsJson(stageStatsSnapshot(), os);
+    os << "\n";
+}
+
+#endif //STAGE_STATS_HPP
@@ -0,0 +1,223 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+/*
+ThreadPool:
+A fixed set of worker threads that run submitted tasks. Codecs that split
+their input into independent pieces (image tiles, blocks, chunks) hand each
+piece to the pool and collect the results through futures.
+Every worker owns a task deque: it runs its own newest task first and, when
+it runs dry, steals the oldest task of another worker, so uneven pieces keep
+every core busy without one shared queue becoming the bottleneck.
+*/
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+
+class ThreadPool {
+public:
+    //Defaults to one worker per hardware thread
+    explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency())
+        : stopping(false), queuedTasks(0), nextQueue(0) {
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    /*
+    * Submit
+    * Queues a task, the future holds its result or the exception it threw.
+    * Tasks submitted by a worker go on its own deque, others are spread
+    * round-robin.
+    */
+    template <class F>
+    std::future<typename std::result_of<F()>::type> submit(F task) {
+        typedef typename std::result_of<F()>::type ResultType;
+        auto packaged = std::make_shared<std::packaged_task<ResultType()>>(std::move(task));
+        std::future<ResultType> result = packaged->get_future();
+
+        size_t target = currentPool() == this ? currentWorker() : nextQueue++ % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back([packaged] { (*packaged)(); });
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queuedTasks++;
+        }
+        taskReady.notify_one();
+        return result;
+    }
+
+    /*
+    * Parallel For
+    * Runs body(i) for every i in [0, count) across the workers and the
+    * calling thread, and waits for all of them; the first exception thrown by
+    * any body is rethrown here. The caller runs queued tasks while it waits,
+    * so this may also be called from inside a pool task.
+    */
+    void parallelFor(size_t count, const std::function<void(size_t)> &body) {
+        if (count == 0) {
+            return;
+        }
+        //Threads pull indices from a shared counter, so uneven items balance out
+        auto nextIndex = std::make_shared<std::atomic<size_t>>(0);
+        auto loop = [nextIndex, count, &body] {
+            for (size_t i = (*nextIndex)++; i < count; i = (*nextIndex)++) {
+                body(i);
+            }
+        };
+        size_t helperCount = std::min(count, workers.size()) - 1;
+        std::vector<std::future<void>> pending;
+        for (size_t t = 0; t < helperCount; t++) {
+            pending.push_back(submit(loop));
+        }
+
+        std::exception_ptr error;
+        try {
+            loop();
+        }
+        catch (...) {
+            error = std::current_exception();
+            nextIndex->store(count); //No new items once one has failed
+        }
+        for (auto &task : pending) {
+            waitFor(task);
+        }
+        for (auto &task : pending) {
+            try {
+                task.get();
+            }
+            catch (...) {
+                if (!error) error = std::current_exception();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /*
+    * Wait For
+    * Waits for a future, running other queued tasks in the meantime so a
+    * worker that waits on work it submitted cannot deadlock the pool
+    */
+    template <class T>
+    void waitFor(std::future<T> &task) {
+        while (task.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!runPendingTask()) {
+                task.wait_for(std::chrono::microseconds(100));
+            }
+        }
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    //The pool and worker index of the calling thread, if it is a worker
+    static ThreadPool *&currentPool() {
+        static thread_local ThreadPool *pool = nullptr;
+        return pool;
+    }
+    static size_t &currentWorker() {
+        static thread_local size_t worker = 0;
+        return worker;
+    }
+
+    /*
+    * Take Task
+    * Newest task of the own deque first, then the oldest task of the others
+    */
+    bool takeTask(size_t self, std::function<void()> &task) {
+        for (size_t n = 0; n < queues.size(); n++) {
+            WorkerQueue &queue = *queues[(self + n) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (n == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> sleepLock(sleepMutex);
+            queuedTasks--;
+            return true;
+        }
+        return false;
+    }
+
+    bool runPendingTask() {
+        std::function<void()> task;
+        size_t self = currentPool() == this ? currentWorker() : nextQueue % queues.size();
+        if (!takeTask(self, task)) {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+    void workerLoop(size_t self) {
+        currentPool() = this;
+        currentWorker() = self;
+        while (true) {
+            std::function<void()> task;
+            if (takeTask(self, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            taskReady.wait(lock, [this] { return stopping || queuedTasks > 0; });
+            if (stopping && queuedTasks == 0) {
+                return; //Stopping and nothing left to run
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable taskReady;
+    bool stopping;
+    size_t queuedTasks; //Tasks in all deques, guarded by sleepMutex
+    std::atomic<size_t> nextQueue;
+};
+
+#endif //THREAD_POOL_HPP
@@ -0,0 +1,299 @@
+#ifndef TILED_IMAGE_HPP
+#define TILED_IMAGE_HPP
+
+/*
+TiledImage:
+A tiled image container. The image is cut into fixed-size square tiles that
+are compressed independently on a thread pool, and a tile index is stored up
+front. Decoding a region reads and decompresses only the tiles it covers, so
+crops and thumbnails cost work proportional to the region, not the image.
+----------------------------------------------------------
+File layout (all integers in host byte order, like the LZ codes):
+    "ARBT", version, width, height, bytesPerPixel, tileSize, paletteEntries
+    palette (paletteEntries * 4 bytes, BGRA)
+    tile index: per tile, row-major, u64 file offset + u32 compressed size
+    tile data: each tile's pixel rows, top to bottom, behind a tag byte: LZ
+               compressed, or stored as they are when LZ would not shrink them
+Version 1 files, whose tiles are LZ compressed without a tag byte, are still read.
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include "BitMapFunctions.hpp"
+#include "LZ_Algorithms.hpp"
+#include "Codec_Pipeline.hpp"
+#include "ThreadPool.hpp"
+
+const char tiledMagic[4] = {'A', 'R', 'B', 'T'};
+const uint32_t tiledVersion = 2;
+const uint32_t tiledUntaggedVersion = 1;
+const int defaultTileSize = 64;
+
+//Header and tile index of a tiled image file
+struct TiledHeader {
+    uint32_t version = tiledVersion;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t bytesPerPixel = 0;
+    uint32_t tileSize = 0;
+    std::vector<unsigned char> palette;
+    std::vector<uint64_t> tileOffsets;
+    std::vector<uint32_t> tileSizes;
+
+    uint32_t tilesX() const { return uint32_t((uint64_t(width) + tileSize - 1) / tileSize); }
+    uint32_t tilesY() const { return uint32_t((uint64_t(height) + tileSize - 1) / tileSize); }
+};
+
+template <class T>
+void writeTiledField(std::ostream &os, T value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+T readTiledField(std::istream &is) {
+    T value;
+    if (!is.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+        throw std::runtime_error("tiled image header is truncated");
+    }
+    return value;
+}
+
+/*
+* Encode Tile
+* Copies one tile's rows out of the image and LZ compresses them behind a tag
+* byte, or stores them if the codes would not be smaller
+*/
+std::vector<unsigned char> encodeTile(const ImageView &view, uint32_t tileX, uint32_t tileY, uint32_t tileSize) {
+    uint32_t x0 = tileX * tileSize;
+    uint32_t y0 = tileY * tileSize;
+    uint32_t w = std::min<uint32_t>(tileSize, view.width - x0);
+    uint32_t h = std::min<uint32_t>(tileSize, view.height - y0);
+    size_t rowBytes = size_t(w) * view.bytesPerPixel;
+
+    std::vector<unsigned char> tilePixels;
+    tilePixels.reserve(rowBytes * h);
+    for (uint32_t y = 0; y < h; y++) {
+        const unsigned char *rowStart = view.row(y0 + y) + size_t(x0) * view.bytesPerPixel;
+        tilePixels.insert(tilePixels.end(), rowStart, rowStart + rowBytes);
+    }
+
+    std::vector<unsigned char> tile(1, encodedBlockTag);
+    if (!lzCompressBlock(tilePixels.data(), tilePixels.size(), tile, tilePixels.size() - 1)) {
+        tile.assign(1, storedBlockTag);
+        tile.insert(tile.end(), tilePixels.begin(), tilePixels.end());
+    }
+    return tile;
+}
+
+/*
+* Tiled Encode
+* Compresses every tile of the image in parallel, then writes the header,
+* the tile index and the tiles in order
+*/
+void tiledEncode(const ImageView &view, const std::string &output, ThreadPool &pool,
+        uint32_t tileSize = defaultTileSize) {
+    TiledHeader header;
+    header.width = view.width;
+    header.height = view.height;
+    header.bytesPerPixel = view.bytesPerPixel;
+    header.tileSize = tileSize;
+    if (view.palette != nullptr) {
+        header.palette.assign(view.palette, view.palette + view.paletteSize * 4);
+    }
+
+    uint32_t tilesX = header.tilesX();
+    size_t tileCount = size_t(tilesX) * header.tilesY();
+    std::vector<std::vector<unsigned char>> tiles(tileCount);
+    pool.parallelFor(tileCount, [&](size_t i) {
+        tiles[i] = encodeTile(view, uint32_t(i % tilesX), uint32_t(i / tilesX), tileSize);
+    });
+
+    std::ofstream os(output, std::ios::binary | std::ios::trunc);
+    if (!os.is_open()) {
+        throw std::runtime_error("cannot open " + output + " for writing");
+    }
+    os.write(tiledMagic, sizeof(tiledMagic));
+    writeTiledField<uint32_t>(os, tiledVersion);
+    writeTiledField<uint32_t>(os, header.width);
+    writeTiledField<uint32_t>(os, header.height);
+    writeTiledField<uint32_t>(os, header.bytesPerPixel);
+    writeTiledField<uint32_t>(os, header.tileSize);
+    writeTiledField<uint32_t>(os, uint32_t(header.palette.size() / 4));
+    os.write(reinterpret_cast<const char *>(header.palette.data()), header.palette.size());
+
+    //Tile data starts right after the index
+    uint64_t offset = uint64_t(os.tellp()) + tileCount * (sizeof(uint64_t) + sizeof(uint32_t));
+    for (auto &tile : tiles) {
+        writeTiledField<uint64_t>(os, offset);
+        writeTiledField<uint32_t>(os, uint32_t(tile.size()));
+        offset += tile.size();
+    }
+    for (auto &tile : tiles) {
+        os.write(reinterpret_cast<const char *>(tile.data()), tile.size());
+    }
+    if (!os) {
+        throw std::runtime_error("failed writing " + output);
+    }
+}
+
+/*
+* Read Tiled Header
+* Reads the header and tile index, leaving the tile data untouched. Every
+* size read is checked against the file before anything is allocated: the
+* index has to fit in the file, every tile has to end inside it, and the
+* image can be at most 65535 bytes per two bytes of file (the longest string
+* one LZ code spells).
+*/
+TiledHeader readTiledHeader(std::istream &is) {
+    std::streampos start = is.tellg();
+    is.seekg(0, std::ios::end);
+    uint64_t fileSize = uint64_t(is.tellg());
+    is.seekg(start);
+    char magic[4];
+    if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, tiledMagic)) {
+        throw std::runtime_error("not a tiled image file");
+    }
+    TiledHeader header;
+    header.version = readTiledField<uint32_t>(is);
+    if (header.version != tiledVersion && header.version != tiledUntaggedVersion) {
+        throw std::runtime_error("unsupported tiled image version");
+    }
+    header.width = readTiledField<uint32_t>(is);
+    header.height = readTiledField<uint32_t>(is);
+    header.bytesPerPixel = readTiledField<uint32_t>(is);
+    header.tileSize = readTiledField<uint32_t>(is);
+    uint32_t paletteEntries = readTiledField<uint32_t>(is);
+    if (header.width == 0 || header.height == 0 || header.tileSize == 0 || paletteEntries > 256 ||
+        (header.bytesPerPixel != 1 && header.bytesPerPixel != 3 && header.bytesPerPixel != 4)) {
+        throw std::runtime_error("corrupted tiled image header");
+    }
+    uint64_t maxImageBytes = fileSize / 2 * 65535;
+    if (header.width > maxImageBytes / header.height / header.bytesPerPixel) {
+        throw std::runtime_error("tiled image is larger than its file can hold");
+    }
+    header.palette.resize(paletteEntries * 4);
+    if (!is.read(reinterpret_cast<char *>(header.palette.data()), header.palette.size())) {
+        throw std::runtime_error("tiled image palette is truncated");
+    }
+
+    const uint64_t indexEntrySize = sizeof(uint64_t) + sizeof(uint32_t);
+    uint64_t tileCount = uint64_t(header.tilesX()) * header.tilesY();
+    uint64_t indexEnd = uint64_t(is.tellg());
+    if (tileCount > (fileSize - indexEnd) / indexEntrySize) {
+        throw std::runtime_error("tiled image index is truncated");
+    }
+    indexEnd += tileCount * indexEntrySize;
+    header.tileOffsets.resize(size_t(tileCount));
+    header.tileSizes.resize(size_t(tileCount));
+    for (size_t i = 0; i < tileCount; i++) {
+        header.tileOffsets[i] = readTiledField<uint64_t>(is);
+        header.tileSizes[i] = readTiledField<uint32_t>(is);
+        if (header.tileOffsets[i] < indexEnd || header.tileOffsets[i] > fileSize ||
+            header.tileSizes[i] > fileSize - header.tileOffsets[i]) {
+            throw std::runtime_error("tile data runs past the end of the file");
+        }
+    }
+    return header;
+}
+
+/*
+* Tiled Decode Region
+* Decodes the rectangle (x, y, w, h) of a tiled image file. Only the tiles
+* overlapping the rectangle are read and decompressed.
+*/
+PixelBuffer tiledDecodeRegion(const std::string &input, uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+        ThreadPool &pool) {
+    std::ifstream is(input, std::ios::binary);
+    if (!is.is_open()) {
+        throw std::runtime_error("cannot open " + input);
+    }
+    TiledHeader header = readTiledHeader(is);
+
+    //Clamp the region to the image
+    if (x >= header.width || y >= header.height || w == 0 || h == 0) {
+        throw std::runtime_error("region lies outside the image");
+    }
+    w = std::min(w, header.width - x);
+    h = std::min(h, header.height - y);
+
+    PixelBuffer region(w, h, header.bytesPerPixel);
+    region.palette = header.palette;
+
+    //Covered tiles; their compressed bytes are read in file order
+    uint32_t tileSize = header.tileSize;
+    uint32_t firstX = x / tileSize, lastX = (x + w - 1) / tileSize;
+    uint32_t firstY = y / tileSize, lastY = (y + h - 1) / tileSize;
+    std::vector<size_t> covered;
+    std::vector<std::string> compressedTiles;
+    for (uint32_t ty = firstY; ty <= lastY; ty++) {
+        for (uint32_t tx = firstX; tx <= lastX; tx++) {
+            size_t index = size_t(ty) * header.tilesX() + tx;
+            std::string tile(header.tileSizes[index], '\0');
+            is.seekg(header.tileOffsets[index]);
+            if (!is.read(&tile[0], tile.size())) {
+                throw std::runtime_error("tile data is truncated");
+            }
+            covered.push_back(index);
+            compressedTiles.push_back(std::move(tile));
+        }
+    }
+
+    //Each tile writes a disjoint part of the region, so tiles decode independently
+    uint32_t bytesPerPixel = header.bytesPerPixel;
+    pool.parallelFor(covered.size(), [&](size_t i) {
+        uint32_t tileX = uint32_t(covered[i] % header.tilesX());
+        uint32_t tileY = uint32_t(covered[i] / header.tilesX());
+        uint32_t tileX0 = tileX * tileSize, tileY0 = tileY * tileSize;
+        uint32_t tileW = std::min(tileSize, header.width - tileX0);
+        uint32_t tileH = std::min(tileSize, header.height - tileY0);
+
+        const std::string &tile = compressedTiles[i];
+        const unsigned char *codes = reinterpret_cast<const unsigned char *>(tile.data());
+        size_t codeSize = tile.size();
+        size_t tileBytes = size_t(tileW) * tileH * bytesPerPixel;
+        std::vector<unsigned char> pixels;
+        if (header.version != tiledUntaggedVersion) {
+            if (codeSize == 0 || codes[0] > encodedBlockTag) {
+                throw std::runtime_error("invalid tile tag");
+            }
+            bool stored = codes[0] == storedBlockTag;
+            codes++;
+            codeSize--;
+            if (stored) {
+                pixels.assign(codes, codes + codeSize);
+            } else {
+                lzDecompressBlock(codes, codeSize, pixels, tileBytes);
+            }
+        } else {
+            lzDecompressBlock(codes, codeSize, pixels, tileBytes);
+        }
+        if (pixels.size() != tileBytes) {
+            throw std::runtime_error("corrupted tile data");
+        }
+
+        //Intersection of this tile with the region
+        uint32_t fromX = std::max(x, tileX0), toX = std::min(x + w, tileX0 + tileW);
+        uint32_t fromY = std::max(y, tileY0), toY = std::min(y + h, tileY0 + tileH);
+        for (uint32_t row = fromY; row < toY; row++) {
+            const unsigned char *src = pixels.data() + (size_t(row - tileY0) * tileW + (fromX - tileX0)) * bytesPerPixel;
+            unsigned char *dst = region.row(row - y) + size_t(fromX - x) * bytesPerPixel;
+            std::copy(src, src + size_t(toX - fromX) * bytesPerPixel, dst);
+        }
+    });
+    return region;
+}
+
+/*
+* Tiled Decode
+* Decodes the whole image
+*/
+PixelBuffer tiledDecode(const std::string &input, ThreadPool &pool) {
+    return tiledDecodeRegion(input, 0, 0, UINT32_MAX, UINT32_MAX, pool);
+}
+
+#endif //TILED_IMAGE_HPP